@@ -13,8 +13,22 @@
 //
 #include "pch.h"
 #include "RequestRateTracker.h"
+#include "ClientListLoader.h"
+#include "ClusterRateLimiter.h"
+#include "LeaseRateLimiter.h"
+#include "PropertyLayers.h"
+#include "QuotaCoordinator.h"
+#include "RespRateLimitStore.h"
+#include "StateHandoff.h"
+#include "StoreRateLimiter.h"
 
 using Poco::Net::ServerSocket;
+using Poco::Net::SocketAddress;
+using Poco::Net::StreamSocket;
+using Poco::Net::TCPServer;
+using Poco::Net::TCPServerConnection;
+using Poco::Net::TCPServerConnectionFactory;
+using Poco::Net::TCPServerParams;
 using Poco::Net::HTTPRequestHandler;
 using Poco::Net::HTTPRequestHandlerFactory;
 using Poco::Net::HTTPResponse;
@@ -29,6 +43,12 @@ using Poco::DateTimeFormat;
 using Poco::ThreadPool;
 using Poco::Util::ServerApplication;
 using Poco::Util::Application;
+using Poco::Util::Option;
+using Poco::Util::OptionSet;
+using Poco::Util::OptionCallback;
+using Poco::Util::Timer;
+using Poco::Util::TimerTask;
+using Poco::AutoPtr;
 
 class ServiceUnavailableHandler : public HTTPRequestHandler
     /// Returns HTTP response with status 503 (Service Unavailable)
@@ -67,6 +87,7 @@ public:
         std::string reason("Rate limit exceeded. Try again in " + waitTimeStr + " seconds.");
         HTTPResponse::HTTPStatus status = HTTPResponse::HTTP_TOO_MANY_REQUESTS;
         response.setStatusAndReason(status, reason);
+        response.set("Retry-After", waitTimeStr);
 
         auto& ostr = response.send();
         ostr << "<html><head><title>HTTPBaseServer with limited requests rate</title></head>";
@@ -103,24 +124,54 @@ public:
 };
 
 class TimeRequestHandlerFactory : public HTTPRequestHandlerFactory
+    /// Creates request handlers and tracks requests rate.
+    ///
+    /// If shardsPerNode is not 0, the rate tracker is split into shards over
+    /// NUMA nodes of the host and every worker thread is pinned to a node
+    /// (round-robin) when it handles its first request.
+    ///
+    /// A worker thread serves all requests of a keep-alive connection, so
+    /// the client resolved for the previous request on the thread is reused
+    /// while the peer address stays the same.
+    ///
+    /// Requests of criticalClients and bulkClients are tracked with the
+    /// respective priority, requests of other clients as normal ones.
+    /// Priority tiers loaded from a file (see setPriorityTiers()) take
+    /// precedence over them.
+    ///
+    /// If cluster is set, requests are decided by the node of the cluster
+    /// which owns the client instead of rateTracker alone. If store is set,
+    /// requests are counted in a store shared with other servers. If lease
+    /// is set, requests are admitted from quotas leased from a coordinator.
 {
 public:
-    TimeRequestHandlerFactory(RequestRate rateLimit) : rateTracker(rateLimit)
+    TimeRequestHandlerFactory(RequestRate rateLimit, unsigned shardsPerNode = 0)
+        : rateTracker(rateLimit,
+            shardsPerNode > 0 ? NumaTopology::system() : NumaTopology::singleNode(),
+            shardsPerNode > 0 ? shardsPerNode : 1)
+        , pinWorkers(shardsPerNode > 0 && NumaTopology::system().nodeCount() > 1)
+        , nextWorkerNode(0)
     {
     }
     
     HTTPRequestHandler* createRequestHandler(const HTTPServerRequest& request)
     {
+        if (pinWorkers)
+            pinCurrentWorker();
+
         if (request.getURI() == "/") {
             // Track requests rate and deny service if rate exceeded the limit
-            std::string clientAddrStr = request.clientAddress().toString();
-            RequestRateTracker::HTTPClientID clientId = 
-                RequestRateTracker::getClientId(clientAddrStr);
-
-            if (clientId == 0)
+            const RequestRateTracker::ClientHandle& client = resolveClient(request);
+            if (client.id == 0)
                 return new ServiceUnavailableHandler();
 
-            RequestRate::Seconds waitTime = rateTracker.addRequest(clientId);
+            RequestRate::Seconds waitTime = (store != nullptr)
+                ? store->addRequest(client.id, priorityOf(client.id))
+                : (lease != nullptr)
+                ? lease->addRequest(client.id, priorityOf(client.id))
+                : (cluster != nullptr)
+                ? cluster->addRequest(client.id, priorityOf(client.id))
+                : rateTracker.addRequest(client, priorityOf(client.id));
             if (waitTime > 0)
                 return new RateLimitExceededHandler(waitTime);
 
@@ -133,8 +184,780 @@ public:
     }
 
     RequestRateTracker  rateTracker;
+    ClientAllowlist     criticalClients;
+    ClientAllowlist     bulkClients;
+        /// Must not be changed after the server is started.
+    ClusterRateLimiter* cluster = nullptr;
+    StoreRateLimiter*   store = nullptr;
+    LeaseRateLimiter*   lease = nullptr;
+        /// Must not be changed after the server is started.
+
+    void setPriorityTiers(std::vector<ClientAllowlist> tiers)
+        /// Atomically replaces the clients of each priority class, indexed
+        /// by Priority. Replaced tiers are kept until the factory is
+        /// destroyed, since worker threads may still be reading them.
+    {
+        std::lock_guard<std::mutex> lock(tiersMutex);
+        tierSets.emplace_back(new std::vector<ClientAllowlist>(std::move(tiers)));
+        priorityTiers.store(tierSets.back().get(), std::memory_order_release);
+    }
+
+private:
+    RequestRateTracker::Priority priorityOf(RequestRateTracker::HTTPClientID client) const
+    {
+        const std::vector<ClientAllowlist>* tiers =
+            priorityTiers.load(std::memory_order_acquire);
+        if (tiers != nullptr) {
+            for (size_t i = 0; i < tiers->size(); i++) {
+                if ((*tiers)[i].contains(client))
+                    return (RequestRateTracker::Priority)i;
+            }
+        }
+        if (!criticalClients.empty() && criticalClients.contains(client))
+            return RequestRateTracker::Priority::Critical;
+        if (!bulkClients.empty() && bulkClients.contains(client))
+            return RequestRateTracker::Priority::Bulk;
+        return RequestRateTracker::Priority::Normal;
+    }
+
+    struct ConnectionClient
+        /// Client resolved for the connection a worker thread served last.
+    {
+        const TimeRequestHandlerFactory*    factory = nullptr;
+        SocketAddress                       address;
+        RequestRateTracker::ClientHandle    client = { 0, 0 };
+    };
+
+    const RequestRateTracker::ClientHandle& resolveClient(const HTTPServerRequest& request)
+    {
+        thread_local ConnectionClient connection;
+        const SocketAddress& address = request.clientAddress();
+        if (connection.factory != this || !(connection.address == address)) {
+            RequestRateTracker::HTTPClientID clientId =
+                RequestRateTracker::getClientId(address.toString());
+            connection.factory = this;
+            connection.address = address;
+            connection.client = rateTracker.resolveClient(clientId);
+        }
+        return connection.client;
+    }
+
+    void pinCurrentWorker()
+    {
+        thread_local bool pinned = false;
+        if (pinned)
+            return;
+        const NumaTopology& topology = NumaTopology::system();
+        topology.pinCurrentThread(nextWorkerNode++ % topology.nodeCount());
+        pinned = true;
+    }
+
+    bool                    pinWorkers;
+    std::atomic<unsigned>   nextWorkerNode;
+
+    std::mutex              tiersMutex;
+    std::vector<std::unique_ptr<const std::vector<ClientAllowlist>>>
+                            tierSets;
+    std::atomic<const std::vector<ClientAllowlist>*>
+                            priorityTiers = nullptr;
+};
+
+void setExemptClients(RequestRateTracker& rateTracker, const std::string& prefixes)
+    /// Replaces clients exempt from rate limiting with the comma separated
+    /// list of prefixes, e.g. "10.0.0.0/8, 127.0.0.1".
+{
+    Application& app = Application::instance();
+    ClientAllowlist allowlist;
+    size_t invalid = allowlist.addList(prefixes);
+    if (invalid > 0)
+        app.logger().warning(std::to_string(invalid) + " invalid exempt prefixes in: " + prefixes);
+    rateTracker.setExemptClients(allowlist);
+    app.logger().information("Exempt clients=" + prefixes);
+}
+
+class ExemptClientsReloader : public TimerTask
+    /// Rereads exempt clients from the configuration files the server was
+    /// started with and replaces them in the rate tracker when they have
+    /// changed.
+{
+public:
+    ExemptClientsReloader(RequestRateTracker& rateTracker, const std::vector<std::string>& configPaths,
+        const std::string& prefixes)
+        : rateTracker(rateTracker), config(configPaths), prefixes(prefixes)
+    {
+    }
+
+    void run()
+    {
+        if (!config.load()) {
+            Application::instance().logger().warning("Cannot reload " + config.unreadablePath());
+            return;
+        }
+        std::string current = config.getString("HTTPBasicServer.exemptClients", "");
+        if (current != prefixes) {
+            prefixes = current;
+            setExemptClients(rateTracker, prefixes);
+        }
+    }
+
+private:
+    RequestRateTracker& rateTracker;
+    PropertyLayers      config;
+    std::string         prefixes;
+};
+
+std::vector<RequestRateTracker::ShadowLimit> parseShadowLimits(const std::string& limits,
+    RequestRateTracker::WindowAlignment alignment)
+    /// Parses comma separated limits written as requests/seconds, e.g.
+    /// "50/3600, 200/3600". Limits which cannot be parsed are skipped.
+{
+    std::vector<RequestRateTracker::ShadowLimit> parsed;
+    std::istringstream fields(limits);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        std::istringstream limit(field);
+        int num = 0;
+        char slash = 0;
+        long period = 0;
+        if (limit >> num >> slash >> period && slash == '/' && period > 0)
+            parsed.push_back({ RequestRate{ num, period }, alignment });
+    }
+    return parsed;
+}
+
+class ClientListReloader : public TimerTask
+    /// Loads lists of tracked and blocked clients and priority tiers from
+    /// files, and loads them again when the files have been modified.
+    /// Each list is built aside and then swapped in, so requests are never
+    /// checked against a partly loaded list. Files which are not set are
+    /// ignored.
+{
+public:
+    ClientListReloader(TimeRequestHandlerFactory& factory, const std::string& trackedPath,
+        const std::string& blockedPath, const std::string& tiersPath)
+        : factory(factory)
+        , files{ { trackedPath, {} }, { blockedPath, {} }, { tiersPath, {} } }
+    {
+    }
+
+    void run()
+    {
+        if (modified(files[0])) {
+            ClientAllowlist tracked;
+            if (load(files[0], tracked))
+                factory.rateTracker.setTrackedClients(std::move(tracked));
+        }
+        if (modified(files[1])) {
+            ClientAllowlist blocked;
+            if (load(files[1], blocked))
+                factory.rateTracker.setBlockedClients(std::move(blocked));
+        }
+        if (modified(files[2])) {
+            std::vector<ClientAllowlist> tiers(PriorityCapacity::classCount);
+            if (load(files[2], tiers))
+                factory.setPriorityTiers(std::move(tiers));
+        }
+    }
+
+private:
+    struct ListFile
+    {
+        std::string                     path;
+        std::filesystem::file_time_type loadedTime;
+            /// Modification time of the file when it was last loaded.
+    };
+
+    static bool modified(ListFile& file)
+    {
+        if (file.path.empty())
+            return false;
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(file.path, error);
+        if (error || time == file.loadedTime)
+            return false;
+        file.loadedTime = time;
+        return true;
+    }
+
+    template <class Target>
+    static bool load(const ListFile& file, Target& target)
+    {
+        Application& app = Application::instance();
+        auto start = std::chrono::steady_clock::now();
+        ClientListLoader::Result result = ClientListLoader::load(file.path, target);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        if (!result.opened) {
+            app.logger().warning("Cannot read client list " + file.path);
+            return false;
+        }
+        app.logger().information("Loaded " + std::to_string(result.entries)
+            + " entries from " + file.path + " in " + std::to_string(elapsed.count()) + " ms");
+        if (result.invalid > 0) {
+            app.logger().warning(std::to_string(result.invalid)
+                + " invalid lines skipped in " + file.path);
+        }
+        return true;
+    }
+
+    TimeRequestHandlerFactory&  factory;
+    ListFile                    files[3];
+        /// Tracked clients, blocked clients and priority tiers.
+};
+
+class FairShareUpdater : public TimerTask
+    /// Recomputes the fair share of the rate tracker's capacity, one shard
+    /// at a time.
+{
+public:
+    explicit FairShareUpdater(RequestRateTracker& rateTracker)
+        : rateTracker(rateTracker)
+    {
+    }
+
+    void run()
+    {
+        rateTracker.updateFairShare();
+    }
+
+private:
+    RequestRateTracker& rateTracker;
 };
 
+class FrameChannel
+    /// Exchanges fixed-size frames with other processes over one TCP
+    /// connection per process. Frames of both directions start with a
+    /// little-endian sequence number, chosen by the channel.
+    ///
+    /// Request threads write their frames to the connection in turn and
+    /// wait for the response with their sequence number, which the reader
+    /// thread of the connection hands over, so requests of all threads are
+    /// pipelined over the connection. A process which does not answer
+    /// within the timeout is reported as unreachable; a closed connection
+    /// is reopened by a later request, at most once a second.
+{
+public:
+    FrameChannel(const std::vector<std::string>& addresses, size_t responseSize,
+        std::chrono::milliseconds timeout, const std::string& role)
+        : peers(addresses.size())
+        , responseSize(responseSize)
+        , timeout(timeout)
+        , role(role)
+    {
+        for (size_t i = 0; i < addresses.size(); i++)
+            peers[i].address = addresses[i];
+    }
+
+    ~FrameChannel()
+    {
+        for (Peer& peer : peers) {
+            {
+                std::lock_guard<std::mutex> lock(peer.mutex);
+                peer.closing = true;
+                if (peer.connected)
+                    peer.socket.shutdown();
+            }
+            if (peer.reader.joinable())
+                peer.reader.join();
+        }
+    }
+
+    bool exchange(size_t index, uint8_t* request, size_t requestSize, uint8_t* response)
+        /// Sends the request to the process and copies its response to
+        /// response. Returns false if the process cannot be reached.
+    {
+        Peer& peer = peers[index];
+        Answer answer{ {}, false, false, response };
+        std::unique_lock<std::mutex> lock(peer.mutex);
+        if (!peer.connected && !connect(peer))
+            return false;
+        uint32_t sequence = peer.nextSequence++;
+        for (int i = 0; i < 4; i++)
+            request[i] = (uint8_t)(sequence >> (8 * i));
+        try {
+            peer.socket.sendBytes(request, (int)requestSize);
+        }
+        catch (Poco::Exception&) {
+            peer.socket.shutdown();
+            return false;
+        }
+        peer.pending[sequence] = &answer;
+        if (!answer.answered.wait_for(lock, timeout, [&] { return answer.done; })) {
+            peer.pending.erase(sequence);
+            return false;
+        }
+        return answer.received;
+    }
+
+private:
+    struct Answer
+        /// Response awaited by a request thread.
+    {
+        std::condition_variable answered;
+        bool                    done;
+        bool                    received;
+        uint8_t*                response;
+    };
+
+    struct Peer
+    {
+        std::string             address;
+        std::mutex              mutex;
+            /// This mutex must be locked to access the members below, and
+            /// to write to the socket.
+        StreamSocket            socket;
+        bool                    connected = false;
+        bool                    closing = false;
+        uint32_t                nextSequence = 0;
+        std::unordered_map<uint32_t, Answer*>
+                                pending;
+        std::chrono::steady_clock::time_point
+                                retryTime;
+        std::thread             reader;
+    };
+
+    bool connect(Peer& peer)
+        /// Opens the connection to the peer, whose mutex is locked.
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (peer.closing || now < peer.retryTime)
+            return false;
+        // The previous reader has given up the connection and is finishing
+        if (peer.reader.joinable())
+            peer.reader.join();
+        try {
+            peer.socket = StreamSocket();
+            const Timespan span(0, (long)std::chrono::microseconds(timeout).count());
+            peer.socket.connect(SocketAddress(peer.address), span);
+            peer.socket.setNoDelay(true);
+            // A peer which stops reading must not block writers under the lock
+            peer.socket.setSendTimeout(span);
+        }
+        catch (Poco::Exception& e) {
+            peer.retryTime = now + std::chrono::seconds(1);
+            Application::instance().logger().warning("Cannot connect to " + role + " "
+                + peer.address + ": " + e.displayText());
+            return false;
+        }
+        peer.connected = true;
+        peer.reader = std::thread(&FrameChannel::read, this, std::ref(peer));
+        return true;
+    }
+
+    void read(Peer& peer)
+        /// Hands responses over to the waiting request threads until the
+        /// connection is closed.
+    {
+        std::vector<uint8_t> buffer(responseSize * 256);
+        size_t used = 0;
+        for (;;) {
+            int received = 0;
+            try {
+                received = peer.socket.receiveBytes(buffer.data() + used,
+                    (int)(buffer.size() - used));
+            }
+            catch (Poco::Exception&) {
+            }
+            if (received <= 0)
+                break;
+            used += (size_t)received;
+            size_t frames = used / responseSize;
+            std::lock_guard<std::mutex> lock(peer.mutex);
+            for (size_t i = 0; i < frames; i++) {
+                const uint8_t* frame = buffer.data() + i * responseSize;
+                uint32_t sequence = 0;
+                for (int b = 0; b < 4; b++)
+                    sequence |= (uint32_t)frame[b] << (8 * b);
+                auto found = peer.pending.find(sequence);
+                if (found == peer.pending.end())
+                    continue; // Given up after the timeout
+                std::memcpy(found->second->response, frame, responseSize);
+                found->second->received = true;
+                found->second->done = true;
+                found->second->answered.notify_one();
+                peer.pending.erase(found);
+            }
+            used -= frames * responseSize;
+            std::memmove(buffer.data(), buffer.data() + frames * responseSize, used);
+        }
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        peer.connected = false;
+        for (auto& waiting : peer.pending) {
+            waiting.second->done = true;
+            waiting.second->answered.notify_one();
+        }
+        peer.pending.clear();
+        peer.socket.close();
+    }
+
+    std::vector<Peer>           peers;
+    size_t                      responseSize;
+    std::chrono::milliseconds   timeout;
+    std::string                 role;
+        /// Kind of process, for log messages.
+};
+
+class PeerChannel : public ClusterRateLimiter::Channel
+    /// Forwards decisions to the other nodes of the cluster.
+{
+public:
+    PeerChannel(const std::vector<std::string>& nodes, std::chrono::milliseconds timeout)
+        : frames(nodes, ClusterRateLimiter::responseSize, timeout, "cluster node")
+    {
+    }
+
+    RequestRate::Seconds forward(size_t node, RequestRateTracker::HTTPClientID client,
+        RequestRateTracker::Priority priority) override
+    {
+        uint8_t request[ClusterRateLimiter::requestSize];
+        uint8_t response[ClusterRateLimiter::responseSize];
+        ClusterRateLimiter::encodeRequest({ 0, client, priority }, request);
+        if (!frames.exchange(node, request, sizeof(request), response))
+            return -1;
+        return ClusterRateLimiter::decodeResponse(response).waitTime;
+    }
+
+private:
+    FrameChannel    frames;
+};
+
+class CoordinatorChannel : public LeaseRateLimiter::Coordinator
+    /// Leases quotas from the coordinator process.
+{
+public:
+    CoordinatorChannel(const std::string& address, std::chrono::milliseconds timeout)
+        : frames({ address }, QuotaCoordinator::grantSize, timeout, "coordinator")
+    {
+    }
+
+    bool lease(const QuotaCoordinator::LeaseRequest& request,
+        QuotaCoordinator::LeaseGrant& grant) override
+    {
+        uint8_t frame[QuotaCoordinator::requestSize];
+        uint8_t response[QuotaCoordinator::grantSize];
+        QuotaCoordinator::encodeRequest(request, frame);
+        if (!frames.exchange(0, frame, sizeof(frame), response))
+            return false;
+        grant = QuotaCoordinator::decodeGrant(response);
+        return true;
+    }
+
+private:
+    FrameChannel    frames;
+};
+
+using FrameHandler = std::function<void(const uint8_t* request, uint8_t* response)>;
+    /// Answers one request frame of a FrameConnection.
+
+class FrameConnection : public TCPServerConnection
+    /// Answers fixed-size frames sent through a FrameChannel by another
+    /// process. All requests read at once are answered before their
+    /// responses are sent back in one write.
+{
+public:
+    FrameConnection(const StreamSocket& socket, const FrameHandler& handler,
+        size_t requestSize, size_t responseSize, const std::string& role)
+        : TCPServerConnection(socket)
+        , handler(handler)
+        , requestSize(requestSize)
+        , responseSize(responseSize)
+        , role(role)
+    {
+    }
+
+    void run()
+    {
+        StreamSocket& peer = socket();
+        peer.setNoDelay(true);
+        std::vector<uint8_t> requests(requestSize * 256);
+        std::vector<uint8_t> responses(responseSize * 256);
+        size_t used = 0;
+        try {
+            for (;;) {
+                int received = peer.receiveBytes(requests.data() + used,
+                    (int)(requests.size() - used));
+                if (received <= 0)
+                    break;
+                used += (size_t)received;
+                size_t frames = used / requestSize;
+                for (size_t i = 0; i < frames; i++)
+                    handler(requests.data() + i * requestSize, responses.data() + i * responseSize);
+                if (frames > 0)
+                    peer.sendBytes(responses.data(), (int)(frames * responseSize));
+                used -= frames * requestSize;
+                std::memmove(requests.data(), requests.data() + frames * requestSize, used);
+            }
+        }
+        catch (Poco::Exception& e) {
+            Application::instance().logger().warning(role + " connection from "
+                + peer.peerAddress().toString() + " closed: " + e.displayText());
+        }
+    }
+
+private:
+    FrameHandler    handler;
+    size_t          requestSize;
+    size_t          responseSize;
+    std::string     role;
+};
+
+class FrameConnectionFactory : public TCPServerConnectionFactory
+{
+public:
+    FrameConnectionFactory(const FrameHandler& handler, size_t requestSize,
+        size_t responseSize, const std::string& role)
+        : handler(handler)
+        , requestSize(requestSize)
+        , responseSize(responseSize)
+        , role(role)
+    {
+    }
+
+    TCPServerConnection* createConnection(const StreamSocket& socket)
+    {
+        return new FrameConnection(socket, handler, requestSize, responseSize, role);
+    }
+
+private:
+    FrameHandler    handler;
+    size_t          requestSize;
+    size_t          responseSize;
+    std::string     role;
+};
+
+class LeaseReturner : public TimerTask
+    /// Returns the unused requests of ended leases to the coordinator.
+{
+public:
+    explicit LeaseReturner(LeaseRateLimiter& limiter)
+        : limiter(limiter)
+    {
+    }
+
+    void run()
+    {
+        limiter.returnUnused();
+    }
+
+private:
+    LeaseRateLimiter& limiter;
+};
+
+class StoreTransport : public RespClient::Transport
+    /// TCP connection to a Redis compatible store. Connecting and writing
+    /// give up after the timeout, so a request thread never waits longer
+    /// for a store which does not answer. A connection whose replies are
+    /// overdue by ten timeouts is considered hung and reopened.
+{
+public:
+    StoreTransport(const std::string& address, std::chrono::milliseconds timeout)
+        : address(address), timeout(timeout)
+    {
+    }
+
+    bool open()
+    {
+        try {
+            socket = StreamSocket();
+            const Timespan span(0, (long)std::chrono::microseconds(timeout).count());
+            socket.connect(SocketAddress(address), span);
+            socket.setNoDelay(true);
+            socket.setSendTimeout(span);
+            socket.setReceiveTimeout(Timespan(0,
+                (long)std::chrono::microseconds(timeout * 10).count()));
+            return true;
+        }
+        catch (Poco::Exception& e) {
+            Application::instance().logger().warning("Cannot connect to store "
+                + address + ": " + e.displayText());
+            return false;
+        }
+    }
+
+    bool write(const char* data, size_t size)
+    {
+        try {
+            while (size > 0) {
+                int sent = socket.sendBytes(data, (int)size);
+                if (sent <= 0)
+                    return false;
+                data += sent;
+                size -= (size_t)sent;
+            }
+            return true;
+        }
+        catch (Poco::Exception&) {
+            return false;
+        }
+    }
+
+    long read(char* data, size_t size)
+    {
+        try {
+            return socket.receiveBytes(data, (int)size);
+        }
+        catch (Poco::TimeoutException&) {
+            return timedOut;
+        }
+        catch (Poco::Exception&) {
+            return -1;
+        }
+    }
+
+    void close()
+    {
+        try {
+            socket.shutdown();
+        }
+        catch (Poco::Exception&) {
+            // Not connected
+        }
+    }
+
+private:
+    std::string                 address;
+    std::chrono::milliseconds   timeout;
+    StreamSocket                socket;
+};
+
+class HandoffConnection : public TCPServerConnection
+    /// Imports the state of a draining server, streamed by handOffToPeer(),
+    /// while requests are tracked.
+{
+public:
+    HandoffConnection(const StreamSocket& socket, RequestRateTracker& rateTracker)
+        : TCPServerConnection(socket), rateTracker(rateTracker)
+    {
+    }
+
+    void run()
+    {
+        StreamSocket& peer = socket();
+        Application& app = Application::instance();
+        StateHandoff::Reader reader(rateTracker);
+        uint8_t buffer[64 * 1024];
+        try {
+            for (;;) {
+                int received = peer.receiveBytes(buffer, (int)sizeof(buffer));
+                if (received <= 0 || !reader.feed(buffer, (size_t)received))
+                    break;
+            }
+        }
+        catch (Poco::Exception& e) {
+            app.logger().warning("Handoff from " + peer.peerAddress().toString()
+                + " closed: " + e.displayText());
+        }
+        if (!reader.finished()) {
+            app.logger().warning("Incomplete handoff from " + peer.peerAddress().toString()
+                + ", imported clients=" + std::to_string(reader.imported()));
+            return;
+        }
+        app.logger().information("Handoff from " + peer.peerAddress().toString()
+            + " imported clients=" + std::to_string(reader.imported())
+            + " of " + std::to_string(reader.decoded()));
+    }
+
+private:
+    RequestRateTracker& rateTracker;
+};
+
+class HandoffConnectionFactory : public TCPServerConnectionFactory
+{
+public:
+    explicit HandoffConnectionFactory(RequestRateTracker& rateTracker)
+        : rateTracker(rateTracker)
+    {
+    }
+
+    TCPServerConnection* createConnection(const StreamSocket& socket)
+    {
+        return new HandoffConnection(socket, rateTracker);
+    }
+
+private:
+    RequestRateTracker& rateTracker;
+};
+
+bool handOffToPeer(const RequestRateTracker& rateTracker, const std::string& address)
+    /// Streams the state of the tracker to the server listening for
+    /// handoffs at address.
+{
+    Application& app = Application::instance();
+    try {
+        StreamSocket peer;
+        peer.connect(SocketAddress(address), Timespan(5, 0));
+        bool sent = StateHandoff::exportTo(rateTracker, [&](const uint8_t* data, size_t size) {
+            while (size > 0) {
+                int written = peer.sendBytes(data, (int)size);
+                if (written <= 0)
+                    return false;
+                data += written;
+                size -= (size_t)written;
+            }
+            return true;
+        });
+        peer.shutdownSend();
+        peer.close();
+        if (sent)
+            app.logger().information("State handed off to " + address);
+        return sent;
+    }
+    catch (Poco::Exception& e) {
+        app.logger().warning("Cannot hand off state to " + address + ": " + e.displayText());
+        return false;
+    }
+}
+
+bool handOffToFile(const RequestRateTracker& rateTracker, const std::string& path)
+    /// Writes the state of the tracker to a temporary file which is renamed
+    /// to path, so a server importing path never reads a partial state.
+{
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    bool written = out && StateHandoff::exportTo(rateTracker, [&](const uint8_t* data, size_t size) {
+        out.write((const char*)data, (std::streamsize)size);
+        return (bool)out;
+    });
+    out.close();
+    std::error_code error;
+    if (written && !out.fail())
+        std::filesystem::rename(temporaryPath, path, error);
+    if (!written || out.fail() || error) {
+        std::filesystem::remove(temporaryPath, error);
+        Application::instance().logger().error("Cannot hand off state to " + path);
+        return false;
+    }
+    Application::instance().logger().information("State handed off to " + path);
+    return true;
+}
+
+void importHandoffFile(RequestRateTracker& rateTracker, const std::string& path)
+    /// Imports the state written by handOffToFile() and removes the file,
+    /// so that it is imported once.
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return;
+    Application& app = Application::instance();
+    StateHandoff::Reader reader(rateTracker);
+    std::vector<char> buffer(64 * 1024);
+    while (in && !reader.failed()) {
+        in.read(buffer.data(), (std::streamsize)buffer.size());
+        reader.feed((const uint8_t*)buffer.data(), (size_t)in.gcount());
+    }
+    in.close();
+    if (reader.finished()) {
+        app.logger().information("Handoff file " + path + " imported clients="
+            + std::to_string(reader.imported()));
+    }
+    else {
+        app.logger().warning("Invalid handoff file " + path + ", imported clients="
+            + std::to_string(reader.imported()));
+    }
+    std::error_code error;
+    std::filesystem::remove(path, error);
+}
+
 class HTTPBasicServer : public Poco::Util::ServerApplication
     /// The main application class.
     ///
@@ -167,7 +990,11 @@ public:
 protected:
     void initialize(Application& self)
     {
-        loadConfiguration(); // load default configuration files, if present
+        // load default configuration files, if present
+        if (loadConfiguration() > 0) {
+            configFiles.push_back(config().getString("application.configDir", "")
+                + config().getString("application.baseName", "HTTPBasicServer") + ".properties");
+        }
         ServerApplication::initialize(self);
     }
 
@@ -176,6 +1003,26 @@ protected:
         ServerApplication::uninitialize();
     }
 
+    void defineOptions(OptionSet& options)
+    {
+        ServerApplication::defineOptions(options);
+        options.addOption(
+            Option("config-file", "f", "load configuration data from a file")
+                .required(false)
+                .repeatable(true)
+                .argument("file")
+                .callback(OptionCallback<HTTPBasicServer>(this, &HTTPBasicServer::handleConfig)));
+    }
+
+    void handleConfig(const std::string& name, const std::string& value)
+        /// Loads a configuration file given on the command line, which
+        /// takes precedence over the default one, e.g. to run several
+        /// nodes of a cluster from one directory.
+    {
+        loadConfiguration(value);
+        configFiles.push_back(value);
+    }
+
     int main(const std::vector<std::string>& args)
     {
         // get parameters from configuration file
@@ -186,25 +1033,348 @@ protected:
         };
         auto client = config().getString("HTTPBasicServer.client", "");
         auto clientId = RequestRateTracker::getClientId(client);
+        auto alignment = config().getString("HTTPBasicServer.windowAlignment", "global");
+        auto retryJitter = config().getInt("HTTPBasicServer.retryJitter", 0);
+        auto shardsPerNode = config().getInt("HTTPBasicServer.numaShardsPerNode", 0);
+        auto fixedCapacity = config().getInt("HTTPBasicServer.fixedCapacity", 0);
+        auto hugePages = config().getBool("HTTPBasicServer.hugePages", false);
+        auto exemptClients = config().getString("HTTPBasicServer.exemptClients", "");
+        auto exemptReloadInterval = config().getInt("HTTPBasicServer.exemptReloadInterval", 0);
+        RequestRate globalLimit = {
+            config().getInt("HTTPBasicServer.globalLimitRequests", 0),
+            config().getInt("HTTPBasicServer.globalLimitPeriod", 1)
+        };
+        auto fairCapacity = config().getInt("HTTPBasicServer.fairCapacity", 0);
+        auto fairUpdateInterval = config().getInt("HTTPBasicServer.fairUpdateInterval", 1000);
+        auto shadowLimits = config().getString("HTTPBasicServer.shadowLimits", "");
+        auto priorityReserved = config().getString("HTTPBasicServer.priorityReserved", "");
+        auto priorityPeriod = config().getInt("HTTPBasicServer.priorityPeriod", 1);
+        auto criticalClients = config().getString("HTTPBasicServer.criticalClients", "");
+        auto bulkClients = config().getString("HTTPBasicServer.bulkClients", "");
+        RequestRate subnetLimit = {
+            config().getInt("HTTPBasicServer.subnetLimitRequests", 0),
+            config().getInt("HTTPBasicServer.subnetLimitPeriod", 3600)
+        };
+        CalendarQuotas::Quotas calendarQuotas = {
+            (uint32_t)std::max(config().getInt("HTTPBasicServer.dailyQuota", 0), 0),
+            (uint32_t)std::max(config().getInt("HTTPBasicServer.monthlyQuota", 0), 0)
+        };
+        auto quotaUtcOffset = config().getInt("HTTPBasicServer.quotaUtcOffset", 0);
+        auto quotaJournal = config().getString("HTTPBasicServer.quotaJournal", "");
+        auto quotaCommitInterval = config().getInt("HTTPBasicServer.quotaCommitInterval", 100);
+        auto trackedClientsFile = config().getString("HTTPBasicServer.trackedClientsFile", "");
+        auto blockedClientsFile = config().getString("HTTPBasicServer.blockedClientsFile", "");
+        auto priorityTiersFile = config().getString("HTTPBasicServer.priorityTiersFile", "");
+        auto listReloadInterval = config().getInt("HTTPBasicServer.listReloadInterval", 0);
+        auto clusterNodes = config().getString("HTTPBasicServer.clusterNodes", "");
+        auto clusterNode = config().getInt("HTTPBasicServer.clusterNode", 0);
+        auto clusterSeed = config().getString("HTTPBasicServer.clusterSeed", "0");
+        auto clusterTimeout = config().getInt("HTTPBasicServer.clusterTimeout", 50);
+        auto storeAddress = config().getString("HTTPBasicServer.storeAddress", "");
+        auto storeKeyPrefix = config().getString("HTTPBasicServer.storeKeyPrefix", "rrt:");
+        auto storeBatch = config().getInt("HTTPBasicServer.storeBatch", 16);
+        auto storeTimeout = config().getInt("HTTPBasicServer.storeTimeout", 50);
+        auto coordinatorListen = config().getString("HTTPBasicServer.coordinatorListen", "");
+        auto coordinatorAddress = config().getString("HTTPBasicServer.coordinatorAddress", "");
+        auto leaseSize = config().getInt("HTTPBasicServer.leaseSize", 16);
+        auto leaseTime = config().getInt("HTTPBasicServer.leaseTime", 5);
+        auto coordinatorTimeout = config().getInt("HTTPBasicServer.coordinatorTimeout", 50);
+        auto handoffListen = config().getString("HTTPBasicServer.handoffListen", "");
+        auto handoffPeer = config().getString("HTTPBasicServer.handoffPeer", "");
+        auto handoffFile = config().getString("HTTPBasicServer.handoffFile", "");
+        CircuitBreaker::Settings breakerSettings;
+        breakerSettings.failureThreshold =
+            (unsigned)std::max(config().getInt("HTTPBasicServer.breakerFailures", 3), 1);
+        breakerSettings.openTime = std::chrono::milliseconds(
+            config().getInt("HTTPBasicServer.breakerOpenTime", 1000));
 
         HTTPServerParams* params = new HTTPServerParams;
         ServerSocket socket(port);
-        auto factory = new TimeRequestHandlerFactory(rateLimit);
+        auto factory = new TimeRequestHandlerFactory(rateLimit,
+            shardsPerNode > 0 ? (unsigned)shardsPerNode : 0);
         if (clientId != 0)
             factory->rateTracker.addClient(clientId);
+        if (alignment == "client")
+            factory->rateTracker.setWindowAlignment(
+                RequestRateTracker::WindowAlignment::ClientHash);
+        else if (alignment == "firstRequest")
+            factory->rateTracker.setWindowAlignment(
+                RequestRateTracker::WindowAlignment::FirstRequest);
+        factory->rateTracker.setRetryJitter(retryJitter);
+        if (globalLimit.num > 0)
+            factory->rateTracker.setGlobalLimit(globalLimit);
+        if (subnetLimit.num > 0 && !factory->rateTracker.setSubnetLimit(subnetLimit))
+            this->logger().warning("Subnet limit is too large, ignored");
+        if (fairCapacity > 0)
+            factory->rateTracker.setFairCapacity(fairCapacity);
+        if (!priorityReserved.empty()) {
+            PriorityCapacity::Reservations reserved = { 0, 0, 0 };
+            std::istringstream fields(priorityReserved);
+            std::string field;
+            for (size_t i = 0; i < reserved.size() && std::getline(fields, field, ','); i++)
+                reserved[i] = std::atoll(field.c_str());
+            if (!factory->rateTracker.setPriorityCapacity(reserved, priorityPeriod))
+                this->logger().warning("Invalid priority capacity, ignored: " + priorityReserved);
+            factory->criticalClients.addList(criticalClients);
+            factory->bulkClients.addList(bulkClients);
+        }
+        if (calendarQuotas.daily > 0 || calendarQuotas.monthly > 0) {
+            auto quotas = std::make_unique<CalendarQuotas>(calendarQuotas,
+                std::chrono::minutes(quotaUtcOffset));
+            if (quotaJournal.empty())
+                this->logger().warning("No quota journal, quotas are reset on restart");
+            else if (!quotas->openJournal(quotaJournal,
+                std::chrono::milliseconds(quotaCommitInterval)))
+            {
+                this->logger().error("Cannot open quota journal " + quotaJournal);
+            }
+            factory->rateTracker.setCalendarQuotas(std::move(quotas));
+        }
+        if (fixedCapacity > 0) {
+            factory->rateTracker.setFixedCapacity((size_t)fixedCapacity, hugePages);
+            static const char* pageKinds[] = { "default", "transparent huge", "huge" };
+            this->logger().information("Fixed capacity=" + std::to_string(fixedCapacity)
+                + " pages=" + pageKinds[(int)factory->rateTracker.pageKind()]
+                + " bytesPerClient=" + std::to_string(factory->rateTracker.bytesPerClient()));
+        }
+
+        if (!exemptClients.empty())
+            setExemptClients(factory->rateTracker, exemptClients);
+        if (!shadowLimits.empty()
+            && !factory->rateTracker.setShadowLimits(parseShadowLimits(shadowLimits,
+                factory->rateTracker.getWindowAlignment())))
+        {
+            this->logger().warning("Too many shadow limits, ignored: " + shadowLimits);
+        }
+
+        // Lists are loaded before the server starts, then reloaded by the timer
+        AutoPtr<ClientListReloader> listReloader(new ClientListReloader(*factory,
+            trackedClientsFile, blockedClientsFile, priorityTiersFile));
+        listReloader->run();
+
+        // Nodes of a cluster are listed in the same order on every node
+        std::vector<std::string> nodes;
+        std::istringstream nodeFields(clusterNodes);
+        std::string node;
+        while (std::getline(nodeFields, node, ',')) {
+            node.erase(0, node.find_first_not_of(" \t"));
+            node.erase(node.find_last_not_of(" \t") + 1);
+            if (!node.empty())
+                nodes.push_back(node);
+        }
+        std::unique_ptr<StoreTransport> storeTransport;
+        std::unique_ptr<RespClient> storeClient;
+        std::unique_ptr<RespRateLimitStore> sharedStore;
+        std::unique_ptr<StoreRateLimiter> storeLimiter;
+        if (!storeAddress.empty()) {
+            storeTransport = std::make_unique<StoreTransport>(storeAddress,
+                std::chrono::milliseconds(storeTimeout));
+            storeClient = std::make_unique<RespClient>(*storeTransport);
+            sharedStore = std::make_unique<RespRateLimitStore>(*storeClient, storeKeyPrefix);
+            storeLimiter = std::make_unique<StoreRateLimiter>(factory->rateTracker, *sharedStore,
+                (uint32_t)std::max(storeBatch, 1), std::chrono::milliseconds(storeTimeout),
+                std::chrono::steady_clock::now, breakerSettings);
+            factory->store = storeLimiter.get();
+            this->logger().information("Store=" + storeAddress + " keyPrefix=" + storeKeyPrefix);
+            if (!clusterNodes.empty())
+                this->logger().warning("Cluster is ignored with a store: " + clusterNodes);
+        }
+        std::unique_ptr<CoordinatorChannel> coordinatorChannel;
+        std::unique_ptr<LeaseRateLimiter> leaseLimiter;
+        if (!storeLimiter && !coordinatorAddress.empty()) {
+            coordinatorChannel = std::make_unique<CoordinatorChannel>(coordinatorAddress,
+                std::chrono::milliseconds(coordinatorTimeout));
+            leaseLimiter = std::make_unique<LeaseRateLimiter>(factory->rateTracker,
+                *coordinatorChannel, (uint32_t)std::max(leaseSize, 1),
+                std::chrono::seconds(std::max(leaseTime, 1)),
+                std::chrono::steady_clock::now, breakerSettings);
+            factory->lease = leaseLimiter.get();
+            this->logger().information("Coordinator=" + coordinatorAddress
+                + " leaseSize=" + std::to_string(leaseSize)
+                + " leaseTime=" + std::to_string(leaseTime));
+            if (!clusterNodes.empty())
+                this->logger().warning("Cluster is ignored with a coordinator: " + clusterNodes);
+        }
+        // The coordinator counts leases with the same limit as the nodes
+        std::unique_ptr<QuotaCoordinator> coordinator;
+        std::unique_ptr<ThreadPool> leaseThreads;
+        std::unique_ptr<TCPServer> leaseServer;
+        if (!coordinatorListen.empty()) {
+            // Every node keeps one connection, and a thread, to the coordinator
+            const int maxNodes = 64;
+            coordinator = std::make_unique<QuotaCoordinator>(rateLimit);
+            QuotaCoordinator* quotas = coordinator.get();
+            FrameHandler grant = [quotas](const uint8_t* frame, uint8_t* response) {
+                QuotaCoordinator::encodeGrant(
+                    quotas->lease(QuotaCoordinator::decodeRequest(frame)), response);
+            };
+            leaseThreads = std::make_unique<ThreadPool>(1, maxNodes);
+            TCPServerParams* leaseParams = new TCPServerParams;
+            leaseParams->setMaxThreads(maxNodes);
+            leaseServer = std::make_unique<TCPServer>(new FrameConnectionFactory(grant,
+                QuotaCoordinator::requestSize, QuotaCoordinator::grantSize, "Coordinator"),
+                *leaseThreads, ServerSocket(SocketAddress(coordinatorListen)), leaseParams);
+            leaseServer->start();
+            this->logger().information("Coordinating leases on " + coordinatorListen);
+        }
+        std::unique_ptr<HashRing> ring;
+        std::unique_ptr<PeerChannel> peers;
+        std::unique_ptr<ClusterRateLimiter> cluster;
+        std::unique_ptr<ThreadPool> decisionThreads;
+        std::unique_ptr<TCPServer> decisionServer;
+        if (!storeLimiter && !leaseLimiter && nodes.size() > 1
+            && clusterNode >= 0 && (size_t)clusterNode < nodes.size())
+        {
+            ring = std::make_unique<HashRing>(std::strtoull(clusterSeed.c_str(), nullptr, 0));
+            for (const std::string& name : nodes)
+                ring->addNode(name);
+            peers = std::make_unique<PeerChannel>(nodes, std::chrono::milliseconds(clusterTimeout));
+            cluster = std::make_unique<ClusterRateLimiter>(factory->rateTracker, *ring,
+                (size_t)clusterNode, *peers, std::chrono::steady_clock::now, breakerSettings);
+            factory->cluster = cluster.get();
+
+            decisionThreads = std::make_unique<ThreadPool>(1, (int)nodes.size());
+            TCPServerParams* decisionParams = new TCPServerParams;
+            decisionParams->setMaxThreads((int)nodes.size());
+            ClusterRateLimiter* owner = cluster.get();
+            FrameHandler decide = [owner](const uint8_t* frame, uint8_t* response) {
+                ClusterRateLimiter::DecisionRequest request = ClusterRateLimiter::decodeRequest(frame);
+                RequestRate::Seconds waitTime = owner->decideOwned(request.client, request.priority);
+                ClusterRateLimiter::encodeResponse({ request.sequence, (uint32_t)waitTime }, response);
+            };
+            decisionServer = std::make_unique<TCPServer>(new FrameConnectionFactory(decide,
+                ClusterRateLimiter::requestSize, ClusterRateLimiter::responseSize, "Cluster"),
+                *decisionThreads, ServerSocket(SocketAddress(nodes[clusterNode])), decisionParams);
+            decisionServer->start();
+            this->logger().information("Cluster node " + nodes[clusterNode] + " of "
+                + std::to_string(nodes.size()));
+        }
+        else if (!storeLimiter && !leaseLimiter && !clusterNodes.empty()) {
+            this->logger().warning("Invalid cluster, ignored: " + clusterNodes);
+        }
+
+        // State left by a server drained before this one started
+        if (!handoffFile.empty())
+            importHandoffFile(factory->rateTracker, handoffFile);
+        std::unique_ptr<ThreadPool> handoffThreads;
+        std::unique_ptr<TCPServer> handoffServer;
+        if (!handoffListen.empty()) {
+            handoffThreads = std::make_unique<ThreadPool>(1, 4);
+            TCPServerParams* handoffParams = new TCPServerParams;
+            handoffParams->setMaxThreads(4);
+            handoffServer = std::make_unique<TCPServer>(
+                new HandoffConnectionFactory(factory->rateTracker), *handoffThreads,
+                ServerSocket(SocketAddress(handoffListen)), handoffParams);
+            handoffServer->start();
+            this->logger().information("Accepting handoffs on " + handoffListen);
+        }
 
         HTTPServer server(factory, socket, params);
         server.start();
+
+        Timer reloadTimer;
+        if (exemptReloadInterval > 0) {
+            long interval = exemptReloadInterval * 1000L;
+            reloadTimer.schedule(new ExemptClientsReloader(factory->rateTracker,
+                configFiles, exemptClients), interval, interval);
+        }
+        if (listReloadInterval > 0) {
+            long interval = listReloadInterval * 1000L;
+            reloadTimer.schedule(listReloader, interval, interval);
+        }
+        if (leaseLimiter) {
+            long interval = std::max(leaseTime, 1) * 1000L;
+            reloadTimer.schedule(new LeaseReturner(*leaseLimiter), interval, interval);
+        }
+        if (fairCapacity > 0 && fairUpdateInterval > 0) {
+            reloadTimer.schedule(new FairShareUpdater(factory->rateTracker),
+                fairUpdateInterval, fairUpdateInterval);
+        }
         this->logger().information("Port=" + std::to_string(port) + " rate=" 
-            + std::to_string(rateLimit.num) + "/" + std::to_string(rateLimit.period));
+            + std::to_string(rateLimit.num) + "/" + std::to_string(rateLimit.period)
+            + " windowAlignment=" + alignment
+            + " retryJitter=" + std::to_string(retryJitter));
 
         // wait for CTRL-C or kill
         waitForTerminationRequest();
+        reloadTimer.cancel(true);
         server.stop();
+        if (handoffServer)
+            handoffServer->stop();
+        // Drained: clients moving to other servers keep their budgets. The
+        // file is the fallback when the peer cannot take the state.
+        bool handedOff = !handoffPeer.empty() && handOffToPeer(factory->rateTracker, handoffPeer);
+        if (!handedOff && !handoffFile.empty())
+            handOffToFile(factory->rateTracker, handoffFile);
+        if (decisionServer)
+            decisionServer->stop();
+        if (leaseServer)
+            leaseServer->stop();
+
+        if (shardsPerNode > 0) {
+            this->logger().information("NUMA local requests="
+                + std::to_string(factory->rateTracker.localRequests())
+                + " cross-node requests="
+                + std::to_string(factory->rateTracker.crossNodeRequests()));
+        }
+        if (CalendarQuotas* quotas = factory->rateTracker.getCalendarQuotas()) {
+            this->logger().information("Quota journal commits="
+                + std::to_string(quotas->commits())
+                + " failed=" + std::to_string(quotas->failedCommits()));
+        }
+        if (cluster) {
+            this->logger().information("Cluster forwarded requests="
+                + std::to_string(cluster->forwardedRequests())
+                + " cached denials=" + std::to_string(cluster->cachedDenials())
+                + " unreachable=" + std::to_string(cluster->unreachableRequests()));
+            for (size_t node = 0; node < nodes.size(); node++) {
+                if (cluster->circuitBreaker(node).trips() > 0) {
+                    this->logger().information("Cluster node " + nodes[node] + " breaker trips="
+                        + std::to_string(cluster->circuitBreaker(node).trips()));
+                }
+            }
+        }
+        if (storeLimiter) {
+            this->logger().information("Store local decisions="
+                + std::to_string(storeLimiter->localDecisions())
+                + " claims=" + std::to_string(storeLimiter->storeRequests())
+                + " failures=" + std::to_string(storeLimiter->storeFailures())
+                + " fallbacks=" + std::to_string(storeLimiter->fallbackDecisions())
+                + " reconciled=" + std::to_string(storeLimiter->reconciledRequests())
+                + " breaker trips=" + std::to_string(storeLimiter->circuitBreaker().trips()));
+        }
+        if (leaseLimiter) {
+            this->logger().information("Lease local decisions="
+                + std::to_string(leaseLimiter->localDecisions())
+                + " leases=" + std::to_string(leaseLimiter->leaseRequests())
+                + " failures=" + std::to_string(leaseLimiter->coordinatorFailures())
+                + " fallbacks=" + std::to_string(leaseLimiter->fallbackDecisions())
+                + " returned=" + std::to_string(leaseLimiter->returnedRequests())
+                + " breaker trips=" + std::to_string(leaseLimiter->circuitBreaker().trips()));
+        }
+        if (coordinator) {
+            this->logger().information("Coordinator leases="
+                + std::to_string(coordinator->leases())
+                + " leased requests=" + std::to_string(coordinator->leasedRequests())
+                + " returned=" + std::to_string(coordinator->returnedRequests()));
+        }
+        for (const auto& report : factory->rateTracker.shadowReports()) {
+            this->logger().information("Shadow limit "
+                + std::to_string(report.limit.rateLimit.num) + "/"
+                + std::to_string(report.limit.rateLimit.period)
+                + " would deny " + std::to_string(report.wouldDeny)
+                + " of " + std::to_string(report.requests) + " requests of "
+                + std::to_string(report.affectedClients) + " clients");
+        }
 
 
         return Application::EXIT_OK;
     }
+
+private:
+    std::vector<std::string> configFiles;
+        /// Files the configuration was loaded from, in the order of their
+        /// priority: those given with --config-file, then the default one.
 };
 
 int main(int argc, char** argv)
@@ -0,0 +1,11 @@
+#ifndef ALLOCATION_COUNT_H
+#define ALLOCATION_COUNT_H
+
+#include <cstdint>
+
+uint64_t allocationCount();
+    /// Returns the number of calls of the global operator new so far. The
+    /// operator is replaced in AllocationCount.cpp, a translation unit of
+    /// its own so that compilers do not inline it into callers.
+
+#endif // ALLOCATION_COUNT_H
@@ -0,0 +1,547 @@
+//
+// Benchmarks of the rate-limiting module. Run with the names of scenarios
+// to run, or without arguments to run all of them:
+//
+//   pages     addRequest() of random clients with growable tables and with
+//             fixed-capacity tables on default and on huge pages. Data TLB
+//             misses are counted where the platform exposes them.
+//   hash      Counter tables fed client IDs chosen to collide: multiples of
+//             the bucket count, which all fall into one bucket under the
+//             identity std::hash, and the same IDs under KeyedClientHash.
+//   probe     Lookups of stored clients in a FixedClientTable and in
+//             std::unordered_map, for tables from 1k to 10M clients.
+//   failover  Latency of StoreRateLimiter requests over a MockRespServer
+//             while the store is healthy, while its injected latency trips
+//             the circuit breaker, and while the breaker is open.
+//   ffi       addRequest() called directly and through rrt_check() and
+//             rrt_check_batch() of the C interface, with the allocations
+//             made by the calls, which must be none with fixed capacity.
+//   load      ClientListLoader::load() of a generated file of 1M addresses
+//             and prefixes into a ClientAllowlist and into tiers.
+//   global    Throughput of addRequest() on 1 to 8 threads without a global
+//             limit and with one which is never reached, kept in slices and
+//             in a single slice.
+//   keepalive Requests of keep-alive connections: the client ID parsed from
+//             the address string for every request, as before handles were
+//             kept, against a ClientHandle resolved once per connection.
+//   memory    bytesPerClient() of growable tables and of fixed-capacity
+//             tables, whose slots hold packed counters up to some limits.
+//
+// The exit code is 1 if a check of a scenario fails.
+//
+// Build the Release configuration; timings of Debug builds are meaningless.
+//
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "AllocationCount.h"
+#include "ClientListLoader.h"
+#include "FixedClientTable.h"
+#include "KeyedClientHash.h"
+#include "MockRespServer.h"
+#include "NumaTopology.h"
+#include "RateLimiterApi.h"
+#include "RequestRateTracker.h"
+#include "RespRateLimitStore.h"
+#include "StoreRateLimiter.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+class DtlbMissCounter
+    /// Counts data TLB load misses of the calling thread with a hardware
+    /// performance counter. Only available on Linux, and only where the
+    /// processor and kernel expose the counter to user processes.
+{
+public:
+    DtlbMissCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~DtlbMissCounter()
+    {
+#if defined(__linux__)
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    DtlbMissCounter(const DtlbMissCounter&) = delete;
+    DtlbMissCounter& operator=(const DtlbMissCounter&) = delete;
+
+    void start()
+    {
+#if defined(__linux__)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    long long stop()
+        /// Returns the misses since start(), or -1 if they are not counted.
+    {
+        long long misses = -1;
+#if defined(__linux__)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+                misses = -1;
+        }
+#endif
+        return misses;
+    }
+
+private:
+    int fd = -1;
+};
+
+template <class Run>
+double nanosecondsPer(size_t operations, const Run& run)
+    /// Takes the callable as it is rather than as a std::function, which
+    /// may allocate and would show up in allocation counts.
+{
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double)operations;
+}
+
+std::vector<uint32_t> randomClients(size_t count, uint32_t clients)
+    /// Client IDs 1 to 'clients' in a fixed pseudo-random order.
+{
+    std::vector<uint32_t> ids(count);
+    uint32_t x = 12345;
+    for (uint32_t& id : ids) {
+        x = x * 1664525u + 1013904223u;
+        id = 1 + (x >> 4) % clients;
+    }
+    return ids;
+}
+
+const char* pageKindName(PageRegion::PageKind kind)
+{
+    switch (kind) {
+    case PageRegion::PageKind::Huge: return "huge pages";
+    case PageRegion::PageKind::TransparentHuge: return "transparent huge pages";
+    default: return "default pages";
+    }
+}
+
+void benchPages()
+{
+    const uint32_t clients = 4000000;
+    const std::vector<uint32_t> ids = randomClients(8000000, clients);
+    std::printf("pages: %zu random addRequest() over %u clients\n", ids.size(), clients);
+
+    for (int table = 0; table < 3; table++) {
+        // No request is ever denied, so every one updates its client
+        RequestRateTracker tracker(RequestRate{ 1000000, 3600 });
+        if (table > 0)
+            tracker.setFixedCapacity(2 * (size_t)clients, table == 2);
+        for (uint32_t id = 1; id <= clients; id++)
+            tracker.addRequest(id);
+
+        DtlbMissCounter misses;
+        misses.start();
+        double ns = nanosecondsPer(ids.size(), [&] {
+            for (uint32_t id : ids)
+                tracker.addRequest(id);
+        });
+        long long dtlbMisses = misses.stop();
+
+        std::string name = (table == 0) ? "unordered_map"
+            : std::string("fixed, ") + pageKindName(tracker.pageKind());
+        if (dtlbMisses >= 0) {
+            std::printf("  %-36s %8.1f ns  %6.3f dTLB misses per request\n", name.c_str(), ns,
+                (double)dtlbMisses / (double)ids.size());
+        }
+        else
+            std::printf("  %-36s %8.1f ns  dTLB misses n/a\n", name.c_str(), ns);
+    }
+}
+
+template <class Hash>
+void benchCollidingClients(const char* hashName, size_t clients)
+{
+    std::unordered_map<uint32_t, uint32_t, Hash> counts;
+    counts.reserve(clients);
+    const uint32_t buckets = (uint32_t)counts.bucket_count();
+    std::vector<uint32_t> ids;
+    for (uint32_t i = 1; i <= clients; i++)
+        ids.push_back(i * buckets);
+
+    const int rounds = 5;
+    double ns = nanosecondsPer(rounds * ids.size(), [&] {
+        for (int round = 0; round < rounds; round++) {
+            for (uint32_t id : ids)
+                counts[id]++;
+        }
+    });
+    size_t longestChain = 0;
+    for (size_t bucket = 0; bucket < counts.bucket_count(); bucket++)
+        longestChain = std::max(longestChain, counts.bucket_size(bucket));
+    std::printf("  %-16s %6zu clients %10.1f ns  longest chain %zu\n",
+        hashName, clients, ns, longestChain);
+}
+
+void benchHash()
+{
+    std::printf("hash: counter updates of clients which collide under std::hash\n");
+    for (size_t clients : { 1024, 16384 }) {
+        benchCollidingClients<std::hash<uint32_t>>("std::hash", clients);
+        benchCollidingClients<KeyedClientHash>("KeyedClientHash", clients);
+    }
+}
+
+int exitCode = 0;
+    /// Set to 1 by scenarios whose checks fail.
+
+volatile uint64_t lookupSink;
+    /// Keeps lookups from being optimized away.
+
+void benchProbeSize(uint32_t clients)
+{
+    const std::vector<uint32_t> ids = randomClients(std::max<size_t>(clients, 4000000), clients);
+    uint64_t sum = 0;
+
+    std::unordered_map<uint32_t, uint32_t, KeyedClientHash> map;
+    map.reserve(clients);
+    for (uint32_t id = 1; id <= clients; id++)
+        map[id] = id;
+    double mapNs = nanosecondsPer(ids.size(), [&] {
+        for (uint32_t id : ids)
+            sum += map[id];
+    });
+    map = {};
+
+    FixedClientTable<uint32_t> table(clients, false);
+    for (uint32_t id = 1; id <= clients; id++)
+        *table.findOrInsert(id) = id;
+    double tableNs = nanosecondsPer(ids.size(), [&] {
+        for (uint32_t id : ids)
+            sum += *table.findOrInsert(id);
+    });
+
+    lookupSink = sum;
+    std::printf("  %9u clients  unordered_map %7.1f ns  FixedClientTable %7.1f ns\n",
+        clients, mapNs, tableNs);
+}
+
+void benchProbe()
+{
+    std::printf("probe: lookups of stored clients\n");
+    for (uint32_t clients : { 1000, 100000, 10000000 })
+        benchProbeSize(clients);
+}
+
+void printLatencies(const char* phase, std::vector<double>& microseconds)
+{
+    std::sort(microseconds.begin(), microseconds.end());
+    auto percentile = [&](double p) {
+        return microseconds[std::min(microseconds.size() - 1,
+            (size_t)(p * (double)microseconds.size()))];
+    };
+    std::printf("  %-14s %6zu requests  p50 %9.1f us  p99 %9.1f us  max %9.1f us\n", phase,
+        microseconds.size(), percentile(0.5), percentile(0.99), microseconds.back());
+}
+
+void benchFailover()
+{
+    const std::chrono::milliseconds deadline(20);
+    const std::chrono::milliseconds storeLatency(100);
+    std::printf("failover: StoreRateLimiter over a mock store, %lld ms deadline, "
+        "%lld ms injected latency\n", (long long)deadline.count(), (long long)storeLatency.count());
+
+    MockRespServer server(std::chrono::steady_clock::now);
+    auto connection = server.connect();
+    RespClient client(*connection);
+    RespRateLimitStore store(client);
+    RequestRateTracker tracker(RequestRate{ 1000000, 3600 });
+    // Batches of one request: every request claims from the store
+    StoreRateLimiter limiter(tracker, store, 1, deadline);
+
+    auto timeRequest = [&](uint32_t id, std::vector<double>& microseconds) {
+        auto start = std::chrono::steady_clock::now();
+        limiter.addRequest(id);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        microseconds.push_back(elapsed.count());
+    };
+
+    const uint32_t requests = 20000;
+    std::vector<double> healthy;
+    for (uint32_t i = 0; i < requests; i++)
+        timeRequest(1 + i % 1000, healthy);
+    printLatencies("healthy", healthy);
+
+    server.setLatency(storeLatency);
+    std::vector<double> tripping;
+    for (uint32_t id = 1; limiter.circuitBreaker().state() != CircuitBreaker::State::Open; id++)
+        timeRequest(id, tripping);
+    printLatencies("tripping", tripping);
+
+    std::vector<double> open;
+    for (uint32_t i = 0; i < requests; i++)
+        timeRequest(1 + i % 1000, open);
+    printLatencies("breaker open", open);
+    std::printf("  %llu of %llu requests decided locally\n",
+        (unsigned long long)limiter.fallbackDecisions(),
+        (unsigned long long)(healthy.size() + tripping.size() + open.size()));
+}
+
+void benchFfi()
+{
+    const uint32_t clients = 100000;
+    const std::vector<uint32_t> ids = randomClients(1000000, clients);
+    std::printf("ffi: %zu random requests over %u clients, fixed capacity\n", ids.size(), clients);
+
+    RequestRateTracker tracker(RequestRate{ 1000000, 3600 });
+    tracker.setFixedCapacity(2 * (size_t)clients, false);
+    rrt_config config;
+    config.struct_size = sizeof(config);
+    rrt_config_init(&config);
+    config.limit_requests = 1000000;
+    config.limit_period = 3600;
+    config.fixed_capacity = 2 * (uint64_t)clients;
+    rrt_tracker* handle = nullptr;
+    if (rrt_create(&config, &handle) != RRT_OK) {
+        std::printf("  rrt_create failed\n");
+        return;
+    }
+    for (uint32_t id = 1; id <= clients; id++) {
+        tracker.addRequest(id);
+        rrt_check(handle, id);
+    }
+
+    // Calls must not allocate with a fixed capacity
+    auto report = [](const char* name, double ns, uint64_t allocated) {
+        std::printf("  %-20s %7.1f ns  %llu allocations%s\n", name, ns,
+            (unsigned long long)allocated, allocated > 0 ? "  FAILED" : "");
+        if (allocated > 0)
+            exitCode = 1;
+    };
+    uint64_t before = allocationCount();
+    double ns = nanosecondsPer(ids.size(), [&] {
+        for (uint32_t id : ids)
+            tracker.addRequest(id);
+    });
+    report("direct addRequest", ns, allocationCount() - before);
+
+    before = allocationCount();
+    ns = nanosecondsPer(ids.size(), [&] {
+        for (uint32_t id : ids)
+            rrt_check(handle, id);
+    });
+    report("rrt_check", ns, allocationCount() - before);
+
+    const size_t batch = 64;
+    std::vector<int64_t> waitTimes(batch);
+    before = allocationCount();
+    ns = nanosecondsPer(ids.size(), [&] {
+        for (size_t i = 0; i < ids.size(); i += batch) {
+            rrt_check_batch(handle, ids.data() + i, waitTimes.data(),
+                std::min(batch, ids.size() - i));
+        }
+    });
+    report("rrt_check_batch(64)", ns, allocationCount() - before);
+    rrt_destroy(handle);
+}
+
+void benchLoad()
+{
+    const uint32_t entries = 1000000;
+    const std::string path = (std::filesystem::temp_directory_path()
+        / "RateLimiterBench.list").string();
+    {
+        // Random addresses with a tier each, every tenth a /24 prefix
+        std::ofstream file(path, std::ios::binary);
+        uint32_t address = 12345;
+        for (uint32_t i = 0; i < entries; i++) {
+            address = address * 1664525u + 1013904223u;
+            file << (address >> 24) << '.' << ((address >> 16) & 255) << '.'
+                << ((address >> 8) & 255) << '.' << ((i % 10 == 0) ? 0 : (address & 255));
+            if (i % 10 == 0)
+                file << "/24";
+            file << ' ' << (i % 3) << '\n';
+        }
+    }
+    std::printf("load: %u entries, every tenth a /24 prefix\n", entries);
+
+    // Nanoseconds per entry are milliseconds per million entries
+    auto report = [](const char* target, const ClientListLoader::Result& result, double ns) {
+        std::printf("  %-16s %8zu entries %6zu invalid %8.1f ms per million\n", target,
+            result.entries, result.invalid, ns);
+    };
+    ClientListLoader::Result result{};
+    ClientAllowlist list;
+    double ns = nanosecondsPer(entries, [&] {
+        result = ClientListLoader::load(path, list);
+    });
+    report("ClientAllowlist", result, ns);
+    std::vector<ClientAllowlist> tiers(3);
+    ns = nanosecondsPer(entries, [&] {
+        result = ClientListLoader::load(path, tiers);
+    });
+    report("tiers", result, ns);
+    std::filesystem::remove(path);
+}
+
+void benchGlobal()
+{
+    const size_t requestsPerThread = 400000;
+    const uint32_t clients = 100000;
+    std::printf("global: %zu addRequest() per thread over %u clients, 16 shards, "
+        "fixed capacity; Mreq/s\n", requestsPerThread, clients);
+    const unsigned threadCounts[] = { 1, 2, 4, 8 };
+    std::printf("  %-18s", "threads");
+    for (unsigned threads : threadCounts)
+        std::printf(" %6u", threads);
+    std::printf("\n");
+
+    const char* names[] = { "no global limit", "sliced budget", "one slice" };
+    for (int mode = 0; mode < 3; mode++) {
+        std::printf("  %-18s", names[mode]);
+        for (unsigned threads : threadCounts) {
+            RequestRateTracker tracker(RequestRate{ 1000000, 3600 },
+                NumaTopology::singleNode(), 16);
+            tracker.setFixedCapacity(2 * (size_t)clients, false);
+            // Never reached, so every request is checked against it
+            if (mode > 0)
+                tracker.setGlobalLimit(RequestRate{ 1000000000, 3600 }, (mode == 2) ? 1 : 0);
+            std::vector<std::vector<uint32_t>> ids;
+            for (unsigned t = 0; t < threads; t++) {
+                ids.push_back(randomClients(requestsPerThread, clients));
+                for (uint32_t& id : ids.back())
+                    id = 1 + (id + t * 7919) % clients;
+            }
+            double ns = nanosecondsPer(threads * requestsPerThread, [&] {
+                std::vector<std::thread> workers;
+                for (unsigned t = 0; t < threads; t++) {
+                    workers.emplace_back([&tracker, &ids, t] {
+                        for (uint32_t id : ids[t])
+                            tracker.addRequest(id);
+                    });
+                }
+                for (std::thread& worker : workers)
+                    worker.join();
+            });
+            std::printf(" %6.2f", 1e3 / ns);
+        }
+        std::printf("\n");
+    }
+    std::printf("  (%u hardware threads)\n", std::thread::hardware_concurrency());
+}
+
+void benchKeepAlive()
+{
+    const size_t connections = 10000;
+    const size_t requestsPerConnection = 100;
+    const size_t requests = connections * requestsPerConnection;
+    std::printf("keepalive: %zu connections of %zu requests\n", connections,
+        requestsPerConnection);
+    std::vector<uint32_t> ids = randomClients(connections, 100000);
+    // What SocketAddress::toString() returns: the address with the port
+    auto addressString = [](uint32_t id, size_t connection) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%u.%u.%u.%u:%u", (id >> 24) & 255,
+            (id >> 16) & 255, (id >> 8) & 255, id & 255, 1024 + (unsigned)connection % 60000);
+        return std::string(text);
+    };
+
+    RequestRateTracker perRequest(RequestRate{ 1000000, 3600 });
+    double ns = nanosecondsPer(requests, [&] {
+        for (size_t c = 0; c < connections; c++) {
+            for (size_t r = 0; r < requestsPerConnection; r++)
+                perRequest.addRequest(RequestRateTracker::getClientId(addressString(ids[c], c)));
+        }
+    });
+    std::printf("  %-28s %8.1f ns per request\n", "getClientId(toString())", ns);
+
+    RequestRateTracker kept(RequestRate{ 1000000, 3600 });
+    ns = nanosecondsPer(requests, [&] {
+        for (size_t c = 0; c < connections; c++) {
+            RequestRateTracker::ClientHandle client = kept.resolveClient(
+                RequestRateTracker::getClientId(addressString(ids[c], c)));
+            for (size_t r = 0; r < requestsPerConnection; r++)
+                kept.addRequest(client);
+        }
+    });
+    std::printf("  %-28s %8.1f ns per request\n", "ClientHandle per connection", ns);
+}
+
+void benchMemory()
+{
+    std::printf("memory: bytes per client for limits of N requests per 60 s\n");
+    std::printf("  %12s %12s %12s %16s\n", "N", "growable", "fixed", "fixed reserved");
+    const int limits[] = { 10, 1000, 100000, 10000000, 100000000 };
+    for (int limit : limits) {
+        RequestRateTracker growable(RequestRate{ limit, 60 });
+        RequestRateTracker fixed(RequestRate{ limit, 60 });
+        fixed.setFixedCapacity(1000, false);
+        // Shards get 1/8 headroom and tables stay under 7/8 full
+        size_t slot = fixed.bytesPerClient();
+        std::printf("  %12d %12zu %12zu %16.1f\n", limit, growable.bytesPerClient(),
+            slot, slot * 9.0 / 7.0);
+    }
+}
+
+struct Scenario
+{
+    const char* name;
+    void (*run)();
+};
+
+const Scenario scenarios[] = {
+    { "pages", benchPages },
+    { "hash", benchHash },
+    { "probe", benchProbe },
+    { "failover", benchFailover },
+    { "ffi", benchFfi },
+    { "load", benchLoad },
+    { "global", benchGlobal },
+    { "keepalive", benchKeepAlive },
+    { "memory", benchMemory },
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    for (const Scenario& scenario : scenarios) {
+        bool selected = (argc == 1);
+        for (int i = 1; i < argc; i++)
+            selected = selected || (scenario.name == std::string(argv[i]));
+        if (selected)
+            scenario.run();
+    }
+    return exitCode;
+}
@@ -0,0 +1,275 @@
+//
+// Daily and monthly quotas kept in a journal. See CalendarQuotas class
+// header for details.
+//
+#include "CalendarQuotas.h"
+#include <algorithm>
+
+namespace {
+
+const CalendarQuotas::Seconds secondsPerDay = 24 * 60 * 60;
+
+const size_t minCompactedClients = 4096;
+    // Journals are not compacted below 4 times as many records.
+
+int64_t floorDivide(int64_t value, int64_t divisor)
+{
+    int64_t quotient = value / divisor;
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+} // namespace
+
+CalendarQuotas::CalendarQuotas(const Quotas& quotas, std::chrono::seconds utcOffset,
+    WallClockFunction* wallClock)
+    : dailyQuota(quotas.daily)
+    , monthlyQuota(quotas.monthly)
+    , offset((Seconds)utcOffset.count())
+    , wallClock(wallClock)
+    , rewriteNeeded(false)
+    , compactedClients(0)
+    , commitCount(0)
+    , failedCommitCount(0)
+    , stopping(false)
+    , commitInterval(0)
+{
+    for (Shard& shard : shards)
+        shard.calendar = Calendar{ 0, 0, 0, 0, 0 };
+}
+
+CalendarQuotas::~CalendarQuotas()
+{
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCondition.notify_all();
+    if (committer.joinable())
+        committer.join();
+    commit();
+}
+
+bool CalendarQuotas::openJournal(const std::string& path,
+    std::chrono::milliseconds interval)
+{
+    std::lock_guard<std::mutex> lock(commitMutex);
+    std::vector<QuotaJournal::Record> records;
+    if (journal.isOpen() || !journal.open(path, records))
+        return false;
+
+    // Later records of a client replace earlier ones. Records of past
+    // months are dropped by the compaction below.
+    const Calendar calendar = calendarOf(localTime());
+    for (const QuotaJournal::Record& record : records) {
+        if (record.month < calendar.month)
+            continue;
+        Shard& shard = shardOf(record.client);
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        shard.clients[record.client] = ClientUsage{ record.day, record.month,
+            record.dailyCount, record.monthlyCount, false };
+    }
+    rewriteNeeded = !compact();
+
+    commitInterval = std::max(interval, std::chrono::milliseconds(1));
+    committer = std::thread(&CalendarQuotas::commitLoop, this);
+    return true;
+}
+
+CalendarQuotas::Seconds CalendarQuotas::tryAcquire(ClientID client)
+{
+    const Seconds now = localTime();
+    Shard& shard = shardOf(client);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (now < shard.calendar.dayStart || now >= shard.calendar.dayEnd)
+        shard.calendar = calendarOf(now);
+    const Calendar& calendar = shard.calendar;
+
+    ClientUsage& usage = shard.clients.try_emplace(client,
+        ClientUsage{ calendar.day, calendar.month, 0, 0, false }).first->second;
+    // A clock which has gone back keeps counting in the later period
+    if (usage.month < calendar.month) {
+        usage.month = calendar.month;
+        usage.monthly = 0;
+    }
+    if (usage.day < calendar.day) {
+        usage.day = calendar.day;
+        usage.daily = 0;
+    }
+
+    const uint32_t monthly = monthlyQuota.load(std::memory_order_relaxed);
+    if (monthly > 0 && usage.monthly >= monthly)
+        return calendar.monthEnd - now;
+    const uint32_t daily = dailyQuota.load(std::memory_order_relaxed);
+    if (daily > 0 && usage.daily >= daily)
+        return calendar.dayEnd - now;
+
+    usage.daily++;
+    usage.monthly++;
+    markChanged(shard, client, usage);
+    return 0;
+}
+
+void CalendarQuotas::release(ClientID client)
+{
+    Shard& shard = shardOf(client);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.clients.find(client);
+    if (found == shard.clients.end())
+        return;
+    ClientUsage& usage = found->second;
+    if (usage.day != shard.calendar.day || usage.daily == 0)
+        return;
+    usage.daily--;
+    if (usage.monthly > 0)
+        usage.monthly--;
+    markChanged(shard, client, usage);
+}
+
+CalendarQuotas::Usage CalendarQuotas::usage(ClientID client) const
+{
+    const Calendar calendar = calendarOf(localTime());
+    Shard& shard = shardOf(client);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.clients.find(client);
+    if (found == shard.clients.end())
+        return Usage{ 0, 0 };
+    const ClientUsage& usage = found->second;
+    return Usage{ (usage.day >= calendar.day) ? usage.daily : 0,
+        (usage.month >= calendar.month) ? usage.monthly : 0 };
+}
+
+void CalendarQuotas::setQuotas(const Quotas& quotas)
+{
+    dailyQuota.store(quotas.daily, std::memory_order_relaxed);
+    monthlyQuota.store(quotas.monthly, std::memory_order_relaxed);
+}
+
+CalendarQuotas::Quotas CalendarQuotas::getQuotas() const
+{
+    return Quotas{ dailyQuota.load(std::memory_order_relaxed),
+        monthlyQuota.load(std::memory_order_relaxed) };
+}
+
+bool CalendarQuotas::commit()
+{
+    std::lock_guard<std::mutex> lock(commitMutex);
+    if (!journal.isOpen())
+        return false;
+
+    std::vector<QuotaJournal::Record> records;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        for (ClientID client : shard.changedClients) {
+            auto found = shard.clients.find(client);
+            if (found == shard.clients.end())
+                continue;
+            found->second.changed = false;
+            records.push_back(recordOf(client, found->second));
+        }
+        shard.changedClients.clear();
+    }
+    if (records.empty() && !rewriteNeeded)
+        return true;
+
+    // A failed append may leave a torn record behind, so anything which
+    // was not written is written with all other usage by a rewrite
+    bool written = !rewriteNeeded && journal.append(records);
+    if (!written)
+        written = compact();
+    rewriteNeeded = !written;
+    if (!written) {
+        failedCommitCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    commitCount.fetch_add(1, std::memory_order_relaxed);
+
+    if (journal.size() >= 4 * std::max(compactedClients, minCompactedClients))
+        rewriteNeeded = !compact();
+    return true;
+}
+
+uint64_t CalendarQuotas::commits() const
+{
+    return commitCount.load(std::memory_order_relaxed);
+}
+
+uint64_t CalendarQuotas::failedCommits() const
+{
+    return failedCommitCount.load(std::memory_order_relaxed);
+}
+
+CalendarQuotas::Calendar CalendarQuotas::calendarOf(Seconds localTime)
+{
+    using namespace std::chrono;
+    const int64_t day = floorDivide(localTime, secondsPerDay);
+    const year_month_day date{ sys_days{ days{ day } } };
+    const year_month nextMonth = date.year() / date.month() + months{ 1 };
+
+    Calendar calendar;
+    calendar.day = (int32_t)day;
+    calendar.month = (int32_t)(((int)date.year() - 1970) * 12
+        + (int)(unsigned)date.month() - 1);
+    calendar.dayStart = day * secondsPerDay;
+    calendar.dayEnd = calendar.dayStart + secondsPerDay;
+    calendar.monthEnd = (Seconds)sys_days{ nextMonth / 1 }.time_since_epoch().count()
+        * secondsPerDay;
+    return calendar;
+}
+
+CalendarQuotas::Seconds CalendarQuotas::localTime() const
+{
+    auto sinceEpoch = std::chrono::floor<std::chrono::seconds>(
+        wallClock().time_since_epoch());
+    return (Seconds)sinceEpoch.count() + offset;
+}
+
+CalendarQuotas::Shard& CalendarQuotas::shardOf(ClientID client) const
+{
+    return shards[clientHash.shardOf(client, shardCount)];
+}
+
+void CalendarQuotas::markChanged(Shard& shard, ClientID client, ClientUsage& usage) const
+{
+    if (!usage.changed) {
+        usage.changed = true;
+        shard.changedClients.push_back(client);
+    }
+}
+
+QuotaJournal::Record CalendarQuotas::recordOf(ClientID client, const ClientUsage& usage)
+{
+    return QuotaJournal::Record{ client, usage.day, usage.daily,
+        usage.month, usage.monthly, 0 };
+}
+
+bool CalendarQuotas::compact()
+{
+    const Calendar calendar = calendarOf(localTime());
+    std::vector<QuotaJournal::Record> records;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        for (auto entry = shard.clients.begin(); entry != shard.clients.end();) {
+            if (entry->second.month < calendar.month && !entry->second.changed) {
+                entry = shard.clients.erase(entry);
+                continue;
+            }
+            records.push_back(recordOf(entry->first, entry->second));
+            ++entry;
+        }
+    }
+    if (!journal.rewrite(records))
+        return false;
+    compactedClients = records.size();
+    return true;
+}
+
+void CalendarQuotas::commitLoop()
+{
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while (!stopping) {
+        stopCondition.wait_for(lock, commitInterval, [this] { return stopping; });
+        lock.unlock();
+        commit();
+        lock.lock();
+    }
+}
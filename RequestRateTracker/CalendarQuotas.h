@@ -0,0 +1,198 @@
+#ifndef CALENDAR_QUOTAS_H
+#define CALENDAR_QUOTAS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "KeyedClientHash.h"
+#include "QuotaJournal.h"
+
+class CalendarQuotas
+    /// Responsible for daily and monthly request quotas of clients, which
+    /// are reset at midnight and on the first day of a month by the wall
+    /// clock of a time zone, and which survive restarts of the process.
+    ///
+    /// Usage of the quotas is counted in memory, in shards of clients each
+    /// with its own lock. Once a journal is opened (see openJournal()),
+    /// a commit thread writes the usage of the clients which have changed
+    /// since the previous commit to the journal every commit interval,
+    /// in a single write followed by a single sync (group commit).
+    /// Requests only mark their client as changed, so they never wait for
+    /// the disk, and a crash loses at most the requests of the last commit
+    /// interval and of the sync in progress.
+    ///
+    /// Records hold the absolute usage of a client, so replaying the journal
+    /// when it is opened restores the usage as of the last commit, and the
+    /// journal grows with the number of clients active in each interval
+    /// rather than with the number of requests. When the journal holds
+    /// many more records than there are clients, it is compacted to a
+    /// single record per client of the current month.
+    ///
+    /// A time zone is given by its offset from UTC. Daylight saving time
+    /// is not applied: zones which observe it should use their standard
+    /// offset, which moves resets by an hour for part of the year.
+{
+public:
+    using ClientID = uint32_t;
+    using Seconds = int64_t;
+
+    typedef std::chrono::system_clock::time_point WallClockFunction();
+
+    struct Quotas
+    {
+        uint32_t    daily;
+            /// Requests per client and day. 0 means no daily quota.
+        uint32_t    monthly;
+            /// Requests per client and month. 0 means no monthly quota.
+    };
+
+    struct Usage
+    {
+        uint32_t    daily;
+        uint32_t    monthly;
+    };
+
+    CalendarQuotas(const Quotas& quotas, std::chrono::seconds utcOffset,
+        WallClockFunction* wallClock = std::chrono::system_clock::now);
+
+    ~CalendarQuotas();
+        /// Stops the commit thread and commits the usage which has changed.
+
+    CalendarQuotas(const CalendarQuotas&) = delete;
+    CalendarQuotas& operator=(const CalendarQuotas&) = delete;
+
+    bool        openJournal(const std::string& path,
+                    std::chrono::milliseconds commitInterval);
+        /// Restores usage of the current periods from the journal at path,
+        /// creating it if it does not exist, and starts committing to it
+        /// every commitInterval. Must be called before the quotas are used.
+        /// The return is false if the journal cannot be opened or a journal
+        /// is already open; usage is then only kept in memory.
+
+    Seconds     tryAcquire(ClientID client);
+        /// Counts a request of the client if both of its quotas allow it
+        /// and returns 0. Otherwise the request is not counted and the
+        /// return is the number of seconds until the exhausted quota is
+        /// reset.
+
+    void        release(ClientID client);
+        /// Takes back a request counted by tryAcquire() in the current day.
+
+    Usage       usage(ClientID client) const;
+        /// Requests of the client counted in the current day and month.
+
+    void        setQuotas(const Quotas& quotas);
+        /// Changes the quotas of all clients. Usage counted so far is kept.
+
+    Quotas      getQuotas() const;
+
+    bool        commit();
+        /// Writes the usage which has changed to the journal and waits until
+        /// it is synced. The return is false if no journal is open or the
+        /// write failed; the usage which was not written is then written by
+        /// the next commit.
+
+    uint64_t    commits() const;
+        /// Number of successful commits which have written records.
+
+    uint64_t    failedCommits() const;
+
+private:
+    struct Calendar
+        /// Day and month which include a local time, and their bounds in
+        /// seconds of local time since 1970-01-01.
+    {
+        int32_t     day;
+        int32_t     month;
+        Seconds     dayStart;
+        Seconds     dayEnd;
+        Seconds     monthEnd;
+    };
+
+    static Calendar calendarOf(Seconds localTime);
+
+    Seconds     localTime() const;
+
+    struct ClientUsage
+    {
+        int32_t     day;
+        int32_t     month;
+        uint32_t    daily;
+            /// Requests counted in day.
+        uint32_t    monthly;
+            /// Requests counted in month.
+        bool        changed;
+            /// Set if the usage has not been committed yet.
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::mutex      mutex;
+            /// This mutex must be locked to access the members below.
+        std::unordered_map<ClientID, ClientUsage, KeyedClientHash>
+                                clients;
+        std::vector<ClientID>   changedClients;
+            /// Clients whose usage has changed since the last commit.
+        Calendar                calendar;
+            /// Calendar of the latest request of the shard.
+    };
+
+    static constexpr size_t shardCount = 16;
+
+    Shard&      shardOf(ClientID client) const;
+
+    void        markChanged(Shard& shard, ClientID client, ClientUsage& usage) const;
+
+    static QuotaJournal::Record recordOf(ClientID client, const ClientUsage& usage);
+
+    bool        compact();
+        /// Rewrites the journal with the usage of clients in the current
+        /// month and forgets clients of past months. commitMutex must be
+        /// locked.
+
+    void        commitLoop();
+
+    std::atomic<uint32_t>   dailyQuota;
+    std::atomic<uint32_t>   monthlyQuota;
+
+    Seconds                 offset;
+        /// Offset of the time zone from UTC in seconds.
+
+    WallClockFunction*      wallClock;
+
+    KeyedClientHash         clientHash;
+        /// Assigns clients to shards and hashes them within a shard, so
+        /// clients cannot choose IDs which collide.
+    mutable Shard           shards[shardCount];
+
+    std::mutex              commitMutex;
+        /// This mutex must be locked to access the members below.
+    QuotaJournal            journal;
+    bool                    rewriteNeeded;
+        /// Set if a commit has failed. The journal may end with a torn
+        /// record then, so the next commit rewrites it instead of
+        /// appending to it.
+    size_t                  compactedClients;
+        /// Number of clients in the journal after it was last compacted.
+
+    std::atomic<uint64_t>   commitCount;
+    std::atomic<uint64_t>   failedCommitCount;
+
+    std::mutex              stopMutex;
+    std::condition_variable stopCondition;
+    bool                    stopping;
+        /// Set when the commit thread must stop. stopMutex must be locked
+        /// to access it.
+    std::chrono::milliseconds
+                            commitInterval;
+    std::thread             committer;
+};
+
+#endif // CALENDAR_QUOTAS_H
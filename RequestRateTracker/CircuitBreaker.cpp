@@ -0,0 +1,99 @@
+//
+// Circuit breaker for calls to backends. See CircuitBreaker class header
+// for details.
+//
+#include "CircuitBreaker.h"
+#include <algorithm>
+
+CircuitBreaker::CircuitBreaker() : CircuitBreaker(Settings())
+{
+}
+
+CircuitBreaker::CircuitBreaker(const Settings& settings)
+    : settings(settings)
+    , currentState(State::Closed)
+    , failures(0)
+    , probing(false)
+    , openTime(settings.openTime)
+    , tripCount(0)
+{
+    this->settings.failureThreshold = std::max(settings.failureThreshold, 1u);
+}
+
+bool CircuitBreaker::allowCall(Clock::time_point now)
+{
+    if (currentState.load(std::memory_order_acquire) == State::Closed)
+        return true;
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (currentState.load(std::memory_order_relaxed)) {
+    case State::Closed:
+        return true;
+    case State::Open:
+        if (now < openUntil)
+            return false;
+        currentState.store(State::HalfOpen, std::memory_order_release);
+        probing = true;
+        return true;
+    default:
+        // One probe at a time
+        if (probing)
+            return false;
+        probing = true;
+        return true;
+    }
+}
+
+bool CircuitBreaker::recordSuccess()
+{
+    if (currentState.load(std::memory_order_acquire) == State::Closed) {
+        // Written only when needed, so successes do not share a cache line
+        if (failures.load(std::memory_order_relaxed) != 0)
+            failures.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (currentState.load(std::memory_order_relaxed) == State::Closed)
+        return false;
+    // Calls let through before the breaker opened may succeed late; only
+    // the probe closes it
+    if (currentState.load(std::memory_order_relaxed) == State::Open || !probing)
+        return false;
+    probing = false;
+    failures.store(0, std::memory_order_relaxed);
+    openTime = settings.openTime;
+    currentState.store(State::Closed, std::memory_order_release);
+    return true;
+}
+
+void CircuitBreaker::recordFailure(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (currentState.load(std::memory_order_relaxed)) {
+    case State::Closed:
+        if (failures.fetch_add(1, std::memory_order_relaxed) + 1 < settings.failureThreshold)
+            return;
+        tripCount++;
+        break;
+    case State::Open:
+        return;
+    default:
+        // The probe failed: the backend gets longer to recover
+        probing = false;
+        openTime = std::min(openTime * 2, settings.maxOpenTime);
+        break;
+    }
+    failures.store(0, std::memory_order_relaxed);
+    openUntil = now + openTime;
+    currentState.store(State::Open, std::memory_order_release);
+}
+
+CircuitBreaker::State CircuitBreaker::state() const
+{
+    return currentState.load(std::memory_order_acquire);
+}
+
+uint64_t CircuitBreaker::trips() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return tripCount;
+}
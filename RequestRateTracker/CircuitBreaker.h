@@ -0,0 +1,80 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+class CircuitBreaker
+    /// Responsible for keeping calls away from a backend which fails or is
+    /// too slow, so that callers do not wait for it on every request.
+    ///
+    /// The breaker is closed while calls succeed. After failureThreshold
+    /// consecutive failures (a call which misses its deadline is a failure)
+    /// it opens, and allowCall() is false, so callers decide without the
+    /// backend at once. When openTime has passed, a single call is let
+    /// through as a probe (half-open). If the probe succeeds the breaker
+    /// closes; otherwise it opens again for twice as long, up to
+    /// maxOpenTime.
+    ///
+    /// allowCall() costs one atomic load while the breaker is closed.
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class State
+    {
+        Closed,
+        Open,
+        HalfOpen
+    };
+
+    struct Settings
+    {
+        unsigned                    failureThreshold = 3;
+        std::chrono::milliseconds   openTime{ 1000 };
+        std::chrono::milliseconds   maxOpenTime{ 30000 };
+    };
+
+    CircuitBreaker();
+
+    explicit CircuitBreaker(const Settings& settings);
+
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    bool        allowCall(Clock::time_point now);
+        /// True if the caller may call the backend; the caller must then
+        /// report the outcome with recordSuccess() or recordFailure().
+
+    bool        recordSuccess();
+        /// Returns true if the call closed the breaker, i.e. the backend
+        /// has recovered.
+
+    void        recordFailure(Clock::time_point now);
+
+    State       state() const;
+
+    uint64_t    trips() const;
+        /// Times the breaker has opened after being closed.
+
+private:
+    Settings                settings;
+
+    std::atomic<State>      currentState;
+    std::atomic<unsigned>   failures;
+        /// Consecutive failures while closed.
+
+    mutable std::mutex      mutex;
+        /// This mutex must be locked to change the state and to access the
+        /// members below.
+    bool                    probing;
+        /// Set while the probe of the half-open breaker is in flight.
+    std::chrono::milliseconds
+                            openTime;
+    Clock::time_point       openUntil;
+    uint64_t                tripCount;
+};
+
+#endif // CIRCUIT_BREAKER_H
@@ -0,0 +1,95 @@
+//
+// Allowlist of IPv4 prefixes exempt from rate limiting. See ClientAllowlist
+// class header for details.
+//
+#include "ClientAllowlist.h"
+#include <algorithm>
+#include <regex>
+
+bool ClientAllowlist::add(Address prefix, unsigned prefixLength)
+{
+    if (prefixLength > 32)
+        return false;
+
+    const uint64_t size = (uint64_t)1 << (32 - prefixLength);
+    Range range;
+    range.first = (Address)(prefix & ~(size - 1));
+    range.last = (Address)(range.first + (size - 1));
+
+    // Merge with all ranges which overlap or touch the new one
+    auto first = std::lower_bound(ranges.begin(), ranges.end(), range,
+        [](const Range& r, const Range& value) {
+            return (uint64_t)r.last + 1 < value.first;
+        });
+    auto last = first;
+    while (last != ranges.end() && last->first <= (uint64_t)range.last + 1) {
+        range.first = std::min(range.first, last->first);
+        range.last = std::max(range.last, last->last);
+        ++last;
+    }
+    first = ranges.erase(first, last);
+    ranges.insert(first, range);
+    return true;
+}
+
+bool ClientAllowlist::add(const std::string& prefix)
+{
+    static const std::regex
+        expr("([0-9]{1,3})\\.([0-9]{1,3})\\.([0-9]{1,3})\\.([0-9]{1,3})(/([0-9]{1,2}))?");
+    std::smatch results;
+    if (!std::regex_match(prefix, results, expr))
+        return false;
+
+    Address address = 0;
+    for (size_t i = 1; i <= 4; i++) {
+        unsigned long octet = std::stoul(results[i]);
+        if (octet > 255)
+            return false;
+        address = (address << 8) | (Address)octet;
+    }
+    unsigned prefixLength = results[6].matched ? (unsigned)std::stoul(results[6]) : 32;
+    return add(address, prefixLength);
+}
+
+size_t ClientAllowlist::addList(const std::string& prefixes)
+{
+    size_t invalid = 0;
+    size_t pos = 0;
+    while (pos < prefixes.size()) {
+        size_t end = prefixes.find_first_of(", \t", pos);
+        if (end == std::string::npos)
+            end = prefixes.size();
+        if (end > pos && !add(prefixes.substr(pos, end - pos)))
+            invalid++;
+        pos = end + 1;
+    }
+    return invalid;
+}
+
+void ClientAllowlist::addRanges(std::vector<Range> added)
+{
+    added.erase(std::remove_if(added.begin(), added.end(),
+        [](const Range& r) { return r.first > r.last; }), added.end());
+    added.insert(added.end(), ranges.begin(), ranges.end());
+    std::sort(added.begin(), added.end(),
+        [](const Range& a, const Range& b) { return a.first < b.first; });
+
+    // Merge ranges which overlap or touch in place
+    size_t merged = 0;
+    for (size_t i = 0; i < added.size(); i++) {
+        if (merged > 0 && added[i].first <= (uint64_t)added[merged - 1].last + 1)
+            added[merged - 1].last = std::max(added[merged - 1].last, added[i].last);
+        else
+            added[merged++] = added[i];
+    }
+    added.resize(merged);
+    added.shrink_to_fit();
+    ranges.swap(added);
+}
+
+bool ClientAllowlist::contains(Address client) const
+{
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), client,
+        [](Address value, const Range& r) { return value < r.first; });
+    return next != ranges.begin() && client <= (next - 1)->last;
+}
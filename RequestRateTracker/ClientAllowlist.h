@@ -0,0 +1,59 @@
+#ifndef CLIENT_ALLOWLIST_H
+#define CLIENT_ALLOWLIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ClientAllowlist
+    /// Responsible for a set of IPv4 prefixes (e.g. health checkers or
+    /// internal services) whose clients are exempt from rate limiting.
+    /// The same set serves as a list of tracked or blocked clients (see
+    /// RequestRateTracker::setTrackedClients() and setBlockedClients()).
+    ///
+    /// Prefixes of any length are merged into sorted, non-overlapping
+    /// address ranges, so contains() is a binary search over a compact
+    /// array. The list is built once and then only read: to change it,
+    /// build a new list and pass it to RequestRateTracker::setExemptClients().
+{
+public:
+    using Address = uint32_t;
+
+    struct Range
+    {
+        Address first;
+        Address last;
+    };
+
+    bool        add(Address prefix, unsigned prefixLength);
+        /// Adds prefix/prefixLength. Bits of the prefix beyond prefixLength
+        /// are ignored. The return is false if prefixLength is longer
+        /// than 32.
+
+    bool        add(const std::string& prefix);
+        /// Adds a prefix written as "a.b.c.d/n", or an address "a.b.c.d".
+        /// The return is false if the prefix cannot be parsed.
+
+    size_t      addList(const std::string& prefixes);
+        /// Adds comma or space separated prefixes. The return is the number
+        /// of prefixes which cannot be parsed; they are skipped.
+
+    void        addRanges(std::vector<Range> added);
+        /// Adds many ranges at once, which need not be sorted. It takes
+        /// O(n log n) for n ranges in total, whereas adding them one by one
+        /// takes O(n^2). Ranges with first > last are skipped.
+
+    bool        contains(Address client) const;
+
+    bool        empty() const { return ranges.empty(); }
+
+    size_t      size() const { return ranges.size(); }
+        /// Number of disjoint ranges the prefixes were merged into.
+
+private:
+    std::vector<Range>  ranges;
+        /// Sorted by first address. Adjacent ranges neither overlap nor touch.
+};
+
+#endif // CLIENT_ALLOWLIST_H
@@ -0,0 +1,145 @@
+//
+// Loader of large lists of IPv4 prefixes. See ClientListLoader class
+// header for details.
+//
+#include "ClientListLoader.h"
+#include <cstring>
+#include "MappedFile.h"
+
+namespace {
+
+const char* skipBlanks(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+bool isDigit(char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
+
+bool parseNumber(const char*& p, const char* end, uint32_t maxValue, uint32_t& value)
+    /// Parses decimal digits at p up to maxValue and moves p past them.
+{
+    const char* start = p;
+    uint64_t number = 0;
+    while (p < end && isDigit(*p) && number <= maxValue) {
+        number = number * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+    if (p == start || number > maxValue || (p < end && isDigit(*p)))
+        return false;
+    value = (uint32_t)number;
+    return true;
+}
+
+} // namespace
+
+ClientListLoader::Result ClientListLoader::parse(const char* data, size_t size,
+    std::vector<Entry>& entries)
+{
+    Result result = { true, 0, 0, size };
+    const char* end = data + size;
+    for (const char* line = data; line < end;) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if (lineEnd == nullptr)
+            lineEnd = end;
+        Entry entry;
+        switch (parseLine(line, lineEnd, entry)) {
+        case Line::Entry:
+            entries.push_back(entry);
+            result.entries++;
+            break;
+        case Line::Invalid:
+            result.invalid++;
+            break;
+        default:
+            break;
+        }
+        line = lineEnd + 1;
+    }
+    return result;
+}
+
+ClientListLoader::Result ClientListLoader::load(const std::string& path,
+    ClientAllowlist& list)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+        return Result{ false, 0, 0, 0 };
+    std::vector<Entry> entries;
+    Result result = parse(file.data(), file.size(), entries);
+
+    std::vector<ClientAllowlist::Range> ranges;
+    ranges.reserve(entries.size());
+    for (const Entry& entry : entries)
+        ranges.push_back(ClientAllowlist::Range{ entry.first, entry.last });
+    list.addRanges(std::move(ranges));
+    return result;
+}
+
+ClientListLoader::Result ClientListLoader::load(const std::string& path,
+    std::vector<ClientAllowlist>& tiers)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+        return Result{ false, 0, 0, 0 };
+    std::vector<Entry> entries;
+    Result result = parse(file.data(), file.size(), entries);
+
+    std::vector<std::vector<ClientAllowlist::Range>> ranges(tiers.size());
+    for (const Entry& entry : entries) {
+        if (entry.value >= tiers.size()) {
+            result.entries--;
+            result.invalid++;
+            continue;
+        }
+        ranges[entry.value].push_back(ClientAllowlist::Range{ entry.first, entry.last });
+    }
+    for (size_t i = 0; i < tiers.size(); i++)
+        tiers[i].addRanges(std::move(ranges[i]));
+    return result;
+}
+
+ClientListLoader::Line ClientListLoader::parseLine(const char* line, const char* end,
+    Entry& entry)
+{
+    const char* p = skipBlanks(line, end);
+    if (p == end || *p == '#')
+        return Line::Empty;
+
+    Address address = 0;
+    for (int i = 0; i < 4; i++) {
+        uint32_t octet = 0;
+        if (!parseNumber(p, end, 255, octet))
+            return Line::Invalid;
+        address = (address << 8) | octet;
+        if (i < 3 && (p == end || *p++ != '.'))
+            return Line::Invalid;
+    }
+    uint32_t prefixLength = 32;
+    if (p < end && *p == '/' && !parseNumber(++p, end, 32, prefixLength))
+        return Line::Invalid;
+
+    // Optional value, separated by blanks or a comma
+    entry.value = noValue;
+    const char* field = skipBlanks(p, end);
+    if (field < end && *field == ',')
+        field = skipBlanks(field + 1, end);
+    else if (field == p && field < end)
+        return Line::Invalid;
+    if (field < end && *field != '#') {
+        if (!parseNumber(field, end, noValue - 1, entry.value))
+            return Line::Invalid;
+        field = skipBlanks(field, end);
+        if (field < end && *field != '#')
+            return Line::Invalid;
+    }
+
+    const uint64_t size = (uint64_t)1 << (32 - prefixLength);
+    entry.first = (Address)(address & ~(size - 1));
+    entry.last = (Address)(entry.first + (size - 1));
+    return Line::Entry;
+}
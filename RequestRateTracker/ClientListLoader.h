@@ -0,0 +1,74 @@
+#ifndef CLIENT_LIST_LOADER_H
+#define CLIENT_LIST_LOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ClientAllowlist.h"
+
+class ClientListLoader
+    /// Responsible for loading lists of IPv4 clients and prefixes with
+    /// millions of entries, such as blocklists or maps of clients to
+    /// tiers, from text files.
+    ///
+    /// A file has one entry per line: an address "a.b.c.d" or a prefix
+    /// "a.b.c.d/n", optionally followed by whitespace or a comma and
+    /// a value, e.g. the index of a tier. Empty lines and lines starting
+    /// with '#' are skipped.
+    ///
+    /// The file is mapped into memory and parsed in a single pass as it is
+    /// streamed in: line ends are found with memchr, which runtime
+    /// libraries vectorize, and fields are parsed in place without regular
+    /// expressions or allocations. Entries are collected into a new list
+    /// which is built with one sort, so the list in use is not touched
+    /// until the caller installs the new one, e.g. with
+    /// RequestRateTracker::setBlockedClients(), in a single atomic swap.
+{
+public:
+    using Address = ClientAllowlist::Address;
+
+    static constexpr uint32_t noValue = UINT32_MAX;
+
+    struct Entry
+    {
+        Address     first;
+        Address     last;
+        uint32_t    value;
+            /// noValue if the line has no value.
+    };
+
+    struct Result
+    {
+        bool        opened;
+            /// False if the file cannot be read. Nothing is loaded then.
+        size_t      entries;
+            /// Lines which were loaded.
+        size_t      invalid;
+            /// Lines which cannot be parsed; they are skipped.
+        size_t      bytes;
+            /// Size of the file.
+    };
+
+    static Result   parse(const char* data, size_t size, std::vector<Entry>& entries);
+        /// Appends entries of the text to entries.
+
+    static Result   load(const std::string& path, ClientAllowlist& list);
+        /// Adds prefixes of the file to list. Values are ignored.
+
+    static Result   load(const std::string& path, std::vector<ClientAllowlist>& tiers);
+        /// Adds each prefix of the file to tiers[value]. Lines without
+        /// a value or with a value >= tiers.size() are invalid.
+
+private:
+    enum class Line
+    {
+        Empty,
+        Entry,
+        Invalid
+    };
+
+    static Line     parseLine(const char* line, const char* end, Entry& entry);
+};
+
+#endif // CLIENT_LIST_LOADER_H
@@ -0,0 +1,165 @@
+//
+// Rate limiting with consistent-hash ownership of clients. See
+// ClusterRateLimiter class header for details.
+//
+#include "ClusterRateLimiter.h"
+
+namespace {
+
+void storeUint32(uint8_t* bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (uint8_t)(value >> (8 * i));
+}
+
+uint32_t loadUint32(const uint8_t* bytes)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t)bytes[i] << (8 * i);
+    return value;
+}
+
+} // namespace
+
+ClusterRateLimiter::ClusterRateLimiter(RequestRateTracker& tracker, const HashRing& ring,
+    size_t self, Channel& channel, NowFunction* nowFunction,
+    const CircuitBreaker::Settings& breakerSettings)
+    : tracker(tracker)
+    , ring(ring)
+    , self(self)
+    , channel(channel)
+    , forwarded(0)
+    , cacheHits(0)
+    , unreachable(0)
+    , nowFunction(nowFunction)
+{
+    startTime = nowFunction();
+    for (size_t node = 0; node < ring.size(); node++)
+        breakers.emplace_back(new CircuitBreaker(breakerSettings));
+}
+
+RequestRate::Seconds ClusterRateLimiter::addRequest(HTTPClientID client, Priority priority)
+{
+    const size_t owner = ring.ownerOf(client);
+    if (owner == self)
+        return tracker.addRequest(client, priority);
+
+    const Seconds now = secondsSinceStart();
+    Seconds waitTime = cachedWaitTime(client, now);
+    if (waitTime > 0) {
+        cacheHits.fetch_add(1, std::memory_order_relaxed);
+        return waitTime;
+    }
+
+    CircuitBreaker& breaker = *breakers[owner];
+    if (!breaker.allowCall(nowFunction())) {
+        unreachable.fetch_add(1, std::memory_order_relaxed);
+        return tracker.addRequest(client, priority);
+    }
+    forwarded.fetch_add(1, std::memory_order_relaxed);
+    waitTime = channel.forward(owner, client, priority);
+    if (waitTime < 0) {
+        breaker.recordFailure(nowFunction());
+        unreachable.fetch_add(1, std::memory_order_relaxed);
+        return tracker.addRequest(client, priority);
+    }
+    breaker.recordSuccess();
+    // Clocks of the nodes are not in step within a second, so the denial
+    // is cached one second shorter than it lasts: near its end requests
+    // are forwarded again rather than denied when the owner would allow them.
+    if (waitTime > 1)
+        cacheDenial(client, now + waitTime - 1);
+    return waitTime;
+}
+
+RequestRate::Seconds ClusterRateLimiter::decideOwned(HTTPClientID client, Priority priority)
+{
+    return tracker.addRequest(client, priority);
+}
+
+bool ClusterRateLimiter::owns(HTTPClientID client) const
+{
+    return ring.ownerOf(client) == self;
+}
+
+uint64_t ClusterRateLimiter::forwardedRequests() const
+{
+    return forwarded.load(std::memory_order_relaxed);
+}
+
+uint64_t ClusterRateLimiter::cachedDenials() const
+{
+    return cacheHits.load(std::memory_order_relaxed);
+}
+
+uint64_t ClusterRateLimiter::unreachableRequests() const
+{
+    return unreachable.load(std::memory_order_relaxed);
+}
+
+void ClusterRateLimiter::encodeRequest(const DecisionRequest& request, uint8_t* frame)
+{
+    storeUint32(frame, request.sequence);
+    storeUint32(frame + 4, request.client);
+    frame[8] = (uint8_t)request.priority;
+    frame[9] = frame[10] = frame[11] = 0;
+}
+
+ClusterRateLimiter::DecisionRequest ClusterRateLimiter::decodeRequest(const uint8_t* frame)
+{
+    // Unknown classes are taken as normal ones
+    Priority priority = (frame[8] <= (uint8_t)Priority::Bulk)
+        ? (Priority)frame[8] : Priority::Normal;
+    return DecisionRequest{ loadUint32(frame), loadUint32(frame + 4), priority };
+}
+
+void ClusterRateLimiter::encodeResponse(const DecisionResponse& response, uint8_t* frame)
+{
+    storeUint32(frame, response.sequence);
+    storeUint32(frame + 4, response.waitTime);
+}
+
+ClusterRateLimiter::DecisionResponse ClusterRateLimiter::decodeResponse(const uint8_t* frame)
+{
+    return DecisionResponse{ loadUint32(frame), loadUint32(frame + 4) };
+}
+
+RequestRate::Seconds ClusterRateLimiter::secondsSinceStart() const
+{
+    auto sinceStart = std::chrono::duration_cast<std::chrono::seconds>(
+        nowFunction() - startTime);
+    return (Seconds)sinceStart.count();
+}
+
+RequestRate::Seconds ClusterRateLimiter::cachedWaitTime(HTTPClientID client, Seconds now)
+{
+    DenialShard& shard = denials[clientHash.shardOf(client, shardCount)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.deniedUntil.find(client);
+    if (found == shard.deniedUntil.end())
+        return 0;
+    if (found->second <= now) {
+        shard.deniedUntil.erase(found);
+        return 0;
+    }
+    return found->second - now + 1;
+}
+
+void ClusterRateLimiter::cacheDenial(HTTPClientID client, Seconds deniedUntil)
+{
+    DenialShard& shard = denials[clientHash.shardOf(client, shardCount)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.deniedUntil.size() >= maxCachedDenials) {
+        const Seconds now = secondsSinceStart();
+        for (auto entry = shard.deniedUntil.begin(); entry != shard.deniedUntil.end();) {
+            if (entry->second <= now)
+                entry = shard.deniedUntil.erase(entry);
+            else
+                ++entry;
+        }
+        if (shard.deniedUntil.size() >= maxCachedDenials)
+            return;
+    }
+    shard.deniedUntil[client] = deniedUntil;
+}
@@ -0,0 +1,165 @@
+#ifndef CLUSTER_RATE_LIMITER_H
+#define CLUSTER_RATE_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include "CircuitBreaker.h"
+#include "HashRing.h"
+#include "KeyedClientHash.h"
+#include "RequestRateTracker.h"
+
+class ClusterRateLimiter
+    /// Responsible for exact rate limiting of clients across the nodes of
+    /// a cluster: each client is owned by one node of a HashRing, and only
+    /// the owner's tracker counts its requests.
+    ///
+    /// addRequest() decides requests of clients owned by this node with the
+    /// local tracker. Requests of other clients are forwarded to their
+    /// owner through a Channel, which is expected to pipeline requests of
+    /// many threads over one connection per node. The owner answers with
+    /// the wait time of its tracker, so every node gets the same decision
+    /// as if all requests were made to the owner.
+    ///
+    /// A denial is valid until its wait time has passed, so denials from
+    /// owners are cached per client and later requests of the client are
+    /// denied locally until then, without being forwarded. Since denied
+    /// requests are not counted by the owner either, caching does not
+    /// change any decision.
+    ///
+    /// If the owner cannot be reached, the request is decided by the local
+    /// tracker and counted by unreachableRequests(). Each node has
+    /// a CircuitBreaker: once a node has failed several times in a row,
+    /// requests of its clients are decided locally at once, without
+    /// waiting for the channel's timeout, until a probe gets through.
+    ///
+    /// Decisions are exchanged as fixed-size little-endian frames (see
+    /// encodeRequest() and encodeResponse()), matched by a sequence number
+    /// chosen by the sender, so responses may be read in any order.
+{
+public:
+    using HTTPClientID = RequestRateTracker::HTTPClientID;
+    using Priority = RequestRateTracker::Priority;
+    using NowFunction = RequestRateTracker::NowFunction;
+
+    class Channel
+        /// Transport of decisions to other nodes.
+    {
+    public:
+        virtual ~Channel() = default;
+
+        virtual RequestRate::Seconds forward(size_t node, HTTPClientID client,
+                                        Priority priority) = 0;
+            /// Asks the node to decide a request of the client with
+            /// decideOwned() and returns its wait time, or -1 if the node
+            /// cannot be reached. Called concurrently by request threads.
+    };
+
+    struct DecisionRequest
+    {
+        uint32_t        sequence;
+        HTTPClientID    client;
+        Priority        priority;
+    };
+
+    struct DecisionResponse
+    {
+        uint32_t        sequence;
+        uint32_t        waitTime;
+    };
+
+    static constexpr size_t requestSize = 12;
+    static constexpr size_t responseSize = 8;
+
+    static constexpr size_t maxCachedDenials = 1 << 16;
+        /// Per shard of the cache; expired denials are dropped when a shard
+        /// is full.
+
+    ClusterRateLimiter(RequestRateTracker& tracker, const HashRing& ring, size_t self,
+        Channel& channel, NowFunction* nowFunction = std::chrono::steady_clock::now,
+        const CircuitBreaker::Settings& breakerSettings = CircuitBreaker::Settings());
+        /// self is the index of this node in ring, which must have all its
+        /// nodes. The tracker, ring and channel must outlive the limiter.
+
+    ClusterRateLimiter(const ClusterRateLimiter&) = delete;
+    ClusterRateLimiter& operator=(const ClusterRateLimiter&) = delete;
+
+    RequestRate::Seconds addRequest(HTTPClientID client, Priority priority = Priority::Normal);
+        /// Same as RequestRateTracker::addRequest() for the whole cluster.
+
+    RequestRate::Seconds decideOwned(HTTPClientID client, Priority priority);
+        /// Decides a request forwarded by another node with the local
+        /// tracker.
+
+    bool                owns(HTTPClientID client) const;
+
+    uint64_t            forwardedRequests() const;
+
+    uint64_t            cachedDenials() const;
+        /// Requests denied from the cache without being forwarded.
+
+    uint64_t            unreachableRequests() const;
+        /// Requests of other nodes' clients decided locally.
+
+    const CircuitBreaker& circuitBreaker(size_t node) const { return *breakers[node]; }
+
+    static void         encodeRequest(const DecisionRequest& request, uint8_t* frame);
+        /// Writes requestSize bytes to frame.
+
+    static DecisionRequest decodeRequest(const uint8_t* frame);
+
+    static void         encodeResponse(const DecisionResponse& response, uint8_t* frame);
+        /// Writes responseSize bytes to frame.
+
+    static DecisionResponse decodeResponse(const uint8_t* frame);
+
+private:
+    using Seconds = RequestRate::Seconds;
+
+    Seconds             secondsSinceStart() const;
+
+    Seconds             cachedWaitTime(HTTPClientID client, Seconds now);
+        /// Remaining wait time of a cached denial, or 0.
+
+    void                cacheDenial(HTTPClientID client, Seconds deniedUntil);
+
+    static constexpr size_t shardCount = 16;
+
+    struct alignas(64) DenialShard
+    {
+        std::mutex          mutex;
+            /// This mutex must be locked to access the member below.
+        std::unordered_map<HTTPClientID, Seconds, KeyedClientHash>
+                            deniedUntil;
+    };
+
+    RequestRateTracker&     tracker;
+    const HashRing&         ring;
+    size_t                  self;
+    Channel&                channel;
+
+    KeyedClientHash         clientHash;
+        /// Assigns clients to denial shards and hashes them within a shard,
+        /// with a seed of this process rather than the ring's shared one.
+    DenialShard             denials[shardCount];
+
+    std::vector<std::unique_ptr<CircuitBreaker>>
+                            breakers;
+        /// One per node of the ring.
+
+    std::atomic<uint64_t>   forwarded;
+    std::atomic<uint64_t>   cacheHits;
+    std::atomic<uint64_t>   unreachable;
+
+    std::chrono::time_point<std::chrono::steady_clock>
+                            startTime;
+
+    NowFunction*            nowFunction;
+};
+
+#endif // CLUSTER_RATE_LIMITER_H
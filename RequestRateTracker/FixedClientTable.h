@@ -0,0 +1,317 @@
+#ifndef FIXED_CLIENT_TABLE_H
+#define FIXED_CLIENT_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "PageRegion.h"
+#include "KeyedClientHash.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FIXED_CLIENT_TABLE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FIXED_CLIENT_TABLE_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+template <class Value>
+class FixedClientTable
+    /// Responsible for storing values of a fixed number of clients in one
+    /// preallocated PageRegion, so lookups do not chase heap nodes and touch
+    /// as few pages (and TLB entries) as possible.
+    ///
+    /// The table is laid out like a Swiss table: an array of control bytes,
+    /// one per slot, is followed by an array of keys and an array of values.
+    /// A control byte is 0 for an empty slot, or the high bit set and 7 bits
+    /// of the client's hash for an occupied slot. Slots are probed in groups
+    /// of 16 (SSE2) or 32 (AVX2) control bytes, which are compared with
+    /// the hash bits in one vector instruction; keys are only read for
+    /// matching slots. Most lookups touch one cache line of control bytes
+    /// and one key. Without SSE2 the groups are compared byte by byte.
+    ///
+    /// Clients are placed by KeyedClientHash, so they cannot make their probe
+    /// sequences collide. The table never grows: findOrInsert() returns
+    /// nullptr when 'capacity' clients are stored.
+    ///
+    /// Value must be trivially copyable and zero-filled memory must be
+    /// a valid Value. The table is not thread-safe.
+{
+public:
+    using Key = uint32_t;
+
+    FixedClientTable(size_t capacity, bool hugePages, int preferredNode = -1,
+        const KeyedClientHash& hash = KeyedClientHash())
+        : hash(hash)
+        , region(slotCountFor(capacity) * slotSize(), hugePages, preferredNode)
+        , controls(static_cast<uint8_t*>(region.data()))
+        , keys(reinterpret_cast<Key*>(controls + slotCountFor(capacity)))
+        , values(reinterpret_cast<Value*>(keys + slotCountFor(capacity)))
+        , groupMask(slotCountFor(capacity) / Group::width - 1)
+        , maxCount(capacity)
+        , count(0)
+    {
+    }
+
+    Value* find(Key key)
+    {
+        const uint64_t h = hash.hash64(key);
+        for (size_t g = homeGroupOf(h), step = 1;; g = (g + step++) & groupMask) {
+            const size_t base = g * Group::width;
+            Group group(controls + base);
+            for (uint32_t match = group.match(controlOf(h)); match != 0; match &= match - 1) {
+                size_t i = base + lowestBit(match);
+                if (keys[i] == key)
+                    return &values[i];
+            }
+            if (group.matchEmpty() != 0)
+                return nullptr;
+        }
+    }
+
+    Value* findOrInsert(Key key)
+        /// Returns value of the client, which is zero-filled for a new client,
+        /// or nullptr if the client is new and the table is full.
+    {
+        return findOrInsert(key, hash.hash64(key));
+    }
+
+    Value* findOrInsert(Key key, uint64_t h)
+        /// Same as findOrInsert(key) for callers which have already hashed
+        /// the key: h must be hash64(key) of the hash the table was
+        /// constructed with.
+    {
+        for (size_t g = homeGroupOf(h), step = 1;; g = (g + step++) & groupMask) {
+            const size_t base = g * Group::width;
+            Group group(controls + base);
+            for (uint32_t match = group.match(controlOf(h)); match != 0; match &= match - 1) {
+                size_t i = base + lowestBit(match);
+                if (keys[i] == key)
+                    return &values[i];
+            }
+            // Slots are never freed between clear() and eraseIf(), so the
+            // first empty slot of the probe sequence is where a client goes
+            uint32_t empty = group.matchEmpty();
+            if (empty != 0) {
+                if (count == maxCount)
+                    return nullptr;
+                size_t i = base + lowestBit(empty);
+                controls[i] = controlOf(h);
+                keys[i] = key;
+                values[i] = Value();
+                count++;
+                return &values[i];
+            }
+        }
+    }
+
+    template <class Predicate>
+    void eraseIf(Predicate shouldErase)
+        /// Removes all clients whose value satisfies shouldErase(const Value&).
+        /// Surviving clients are then rehashed in place, so probe sequences
+        /// stay short without tombstones.
+    {
+        const size_t slotCount = (groupMask + 1) * Group::width;
+        for (size_t i = 0; i < slotCount; i++) {
+            if (controls[i] == emptyControl)
+                continue;
+            if (shouldErase(static_cast<const Value&>(values[i]))) {
+                controls[i] = emptyControl;
+                count--;
+            }
+            else {
+                controls[i] = pendingControl;
+            }
+        }
+
+        // Place each pending client into the first free slot of its probe
+        // sequence. Groups before that slot are full and stay full, so the
+        // client is found there. A pending client which occupies the slot
+        // is swapped out and placed next.
+        for (size_t i = 0; i < slotCount; i++) {
+            if (controls[i] != pendingControl)
+                continue;
+            const uint64_t h = hash.hash64(keys[i]);
+            size_t target = 0;
+            for (size_t g = homeGroupOf(h), step = 1;; g = (g + step++) & groupMask) {
+                uint32_t nonFull = Group(controls + g * Group::width).matchNonFull();
+                if (nonFull != 0) {
+                    target = g * Group::width + lowestBit(nonFull);
+                    break;
+                }
+            }
+            if (target / Group::width == i / Group::width) {
+                controls[i] = controlOf(h);
+            }
+            else if (controls[target] == emptyControl) {
+                controls[target] = controlOf(h);
+                keys[target] = keys[i];
+                values[target] = values[i];
+                controls[i] = emptyControl;
+            }
+            else {
+                Key key = keys[i];
+                Value value = values[i];
+                keys[i] = keys[target];
+                values[i] = values[target];
+                keys[target] = key;
+                values[target] = value;
+                controls[target] = controlOf(h);
+                i--;
+            }
+        }
+    }
+
+    template <class Visitor>
+    void forEach(Visitor visit) const
+        /// Calls visit(Key, const Value&) for every client in slot order.
+    {
+        const size_t slotCount = (groupMask + 1) * Group::width;
+        for (size_t i = 0; i < slotCount; i++) {
+            if (controls[i] != emptyControl)
+                visit(keys[i], static_cast<const Value&>(values[i]));
+        }
+    }
+
+    void clear()
+    {
+        std::memset(controls, emptyControl, (groupMask + 1) * Group::width);
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    static constexpr size_t slotSize() { return sizeof(uint8_t) + sizeof(Key) + sizeof(Value); }
+        /// Control byte, key and value.
+
+    size_t capacity() const { return maxCount; }
+
+    PageRegion::PageKind pageKind() const { return region.pageKind(); }
+
+private:
+    static_assert(std::is_trivially_copyable<Value>::value,
+        "FixedClientTable requires trivially copyable values");
+
+    static constexpr uint8_t emptyControl = 0x00;
+    static constexpr uint8_t pendingControl = 0x01;
+        /// Marks surviving clients while eraseIf() rehashes them.
+    static constexpr uint8_t fullControl = 0x80;
+
+    struct Group
+        /// Control bytes of a group of slots. Each match returns a bit mask
+        /// with bit i set for the i-th slot of the group.
+    {
+#if defined(FIXED_CLIENT_TABLE_AVX2)
+        static constexpr size_t width = 32;
+
+        explicit Group(const uint8_t* group)
+            : bytes(_mm256_load_si256(reinterpret_cast<const __m256i*>(group)))
+        {
+        }
+
+        uint32_t match(uint8_t control) const
+        {
+            return (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8((char)control)));
+        }
+
+        uint32_t matchNonFull() const
+        {
+            return ~(uint32_t)_mm256_movemask_epi8(bytes);
+        }
+
+        __m256i bytes;
+#elif defined(FIXED_CLIENT_TABLE_SSE2)
+        static constexpr size_t width = 16;
+
+        explicit Group(const uint8_t* group)
+            : bytes(_mm_load_si128(reinterpret_cast<const __m128i*>(group)))
+        {
+        }
+
+        uint32_t match(uint8_t control) const
+        {
+            return (uint32_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)control)));
+        }
+
+        uint32_t matchNonFull() const
+        {
+            return ~(uint32_t)_mm_movemask_epi8(bytes) & 0xFFFFu;
+        }
+
+        __m128i bytes;
+#else
+        static constexpr size_t width = 16;
+
+        explicit Group(const uint8_t* group) : bytes(group) {}
+
+        uint32_t match(uint8_t control) const
+        {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < width; i++)
+                mask |= (uint32_t)(bytes[i] == control) << i;
+            return mask;
+        }
+
+        uint32_t matchNonFull() const
+        {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < width; i++)
+                mask |= (uint32_t)((bytes[i] & fullControl) == 0) << i;
+            return mask;
+        }
+
+        const uint8_t* bytes;
+#endif
+
+        uint32_t matchEmpty() const { return match(emptyControl); }
+    };
+
+    static size_t slotCountFor(size_t capacity)
+        /// Power of two number of slots, at least one 32-byte group, which
+        /// keeps load factor under 7/8.
+    {
+        size_t slotCount = 32;
+        while (slotCount * 7 < capacity * 8 + 8)
+            slotCount *= 2;
+        return slotCount;
+    }
+
+    static uint32_t lowestBit(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (uint32_t)index;
+#else
+        return (uint32_t)__builtin_ctz(mask);
+#endif
+    }
+
+    size_t homeGroupOf(uint64_t h) const
+    {
+        return (size_t)(h >> 7) & groupMask;
+    }
+
+    static uint8_t controlOf(uint64_t h)
+    {
+        return (uint8_t)(fullControl | (h & 0x7F));
+    }
+
+    KeyedClientHash hash;
+    PageRegion  region;
+    uint8_t*    controls;
+    Key*        keys;
+    Value*      values;
+    size_t      groupMask;
+    size_t      maxCount;
+    size_t      count;
+};
+
+#endif // FIXED_CLIENT_TABLE_H
@@ -0,0 +1,109 @@
+//
+// Sliced limit on the total number of requests. See GlobalRequestBudget
+// class header for details.
+//
+#include "GlobalRequestBudget.h"
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+int64_t windowIndex(GlobalRequestBudget::Seconds now, GlobalRequestBudget::Seconds period)
+{
+    int64_t index = now / period;
+    return (now % period < 0) ? index - 1 : index;
+}
+
+size_t nextThreadIndex()
+{
+    static std::atomic<size_t> threads(0);
+    return threads.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace
+
+GlobalRequestBudget::GlobalRequestBudget(int64_t limit, Seconds period, unsigned slices)
+    : maxRequests(std::max<int64_t>(limit, 0))
+    , periodLength(std::max<Seconds>(period, 1))
+    , sliceCount(slices > 0 ? slices : std::max(std::thread::hardware_concurrency(), 1u))
+    , maxBatch(std::max<int64_t>(maxRequests / (32 * (int64_t)sliceCount), 1))
+    , slices(new Slice[sliceCount])
+    , total(0)
+{
+    for (size_t i = 0; i < sliceCount; i++) {
+        this->slices[i].window = 0;
+        this->slices[i].available = 0;
+    }
+}
+
+bool GlobalRequestBudget::tryAcquire(Seconds now)
+{
+    const int64_t window = windowIndex(now, periodLength);
+    Slice& slice = currentSlice();
+    std::lock_guard<std::mutex> lock(slice.mutex);
+    if (slice.window != window) {
+        // The rest of the previous batch expires with its period
+        slice.window = window;
+        slice.available = 0;
+    }
+    if (slice.available == 0 && !claimBatch(slice))
+        return false;
+    slice.available--;
+    return true;
+}
+
+void GlobalRequestBudget::release(Seconds now)
+{
+    Slice& slice = currentSlice();
+    std::lock_guard<std::mutex> lock(slice.mutex);
+    if (slice.window == windowIndex(now, periodLength))
+        slice.available++;
+}
+
+GlobalRequestBudget::Seconds GlobalRequestBudget::periodEnd(Seconds now) const
+{
+    return (windowIndex(now, periodLength) + 1) * periodLength;
+}
+
+int64_t GlobalRequestBudget::claimed(Seconds now) const
+{
+    const uint64_t word = total.load(std::memory_order_relaxed);
+    const uint64_t tag = (uint64_t)windowIndex(now, periodLength) & windowMask;
+    return ((word >> countBits) == tag) ? (int64_t)(word & countMask) : 0;
+}
+
+GlobalRequestBudget::Slice& GlobalRequestBudget::currentSlice()
+{
+    thread_local const size_t threadIndex = nextThreadIndex();
+    return slices[threadIndex % sliceCount];
+}
+
+bool GlobalRequestBudget::claimBatch(Slice& slice)
+{
+    const uint64_t tag = (uint64_t)slice.window & windowMask;
+    uint64_t word = total.load(std::memory_order_relaxed);
+    for (;;) {
+        const uint64_t wordTag = word >> countBits;
+        int64_t count = (int64_t)(word & countMask);
+        if (wordTag != tag) {
+            // Windows are compared modulo 2^(64 - countBits): a tag behind
+            // the total means the caller's clock reading is late for a
+            // window which has already rolled over.
+            if (((tag - wordTag) & windowMask) > (windowMask >> 1))
+                return false;
+            count = 0;
+        }
+        const int64_t remaining = maxRequests - count;
+        if (remaining <= 0)
+            return false;
+        // Shrink batches near the limit, so that fewer requests are
+        // stranded in the batches of idle slices
+        const int64_t batch = std::clamp<int64_t>(
+            remaining / (2 * (int64_t)sliceCount), 1, maxBatch);
+        const uint64_t claimedWord = (tag << countBits) | (uint64_t)(count + batch);
+        if (total.compare_exchange_weak(word, claimedWord, std::memory_order_relaxed)) {
+            slice.available = batch;
+            return true;
+        }
+    }
+}
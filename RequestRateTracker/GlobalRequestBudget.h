@@ -0,0 +1,101 @@
+#ifndef GLOBAL_REQUEST_BUDGET_H
+#define GLOBAL_REQUEST_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class GlobalRequestBudget
+    /// Responsible for a limit on the total number of requests admitted per
+    /// period, over all clients, without a single counter which every
+    /// request has to update.
+    ///
+    /// Requests are counted in slices, one per hardware thread by default;
+    /// a thread always uses the same slice, so slices are rarely shared.
+    /// A slice claims a batch of requests from the global total and admits
+    /// requests from its batch without touching shared memory. Only when
+    /// the batch is used up does the slice reconcile with the total and
+    /// claim the next one, which is the only shared write.
+    ///
+    /// Since requests are claimed before they are admitted, the limit is
+    /// never exceeded. The cost is that requests may be denied while other
+    /// slices still hold unused parts of their batches. Batches shrink as
+    /// the total approaches the limit, and their size never exceeds 1/32
+    /// of the limit divided between slices, so less than maxUnused()
+    /// requests of a period can be lost this way. Small limits get
+    /// batches of a single request and are exact.
+    ///
+    /// Periods are aligned to multiples of the period, as with the global
+    /// window alignment of RequestRateTracker.
+{
+public:
+    using Seconds = int64_t;
+
+    GlobalRequestBudget(int64_t limit, Seconds period, unsigned slices = 0);
+        /// limit and period must be positive. 0 slices means one per
+        /// hardware thread.
+
+    GlobalRequestBudget(const GlobalRequestBudget&) = delete;
+    GlobalRequestBudget& operator=(const GlobalRequestBudget&) = delete;
+
+    bool        tryAcquire(Seconds now);
+        /// Counts a request at now (seconds on the caller's clock) if the
+        /// limit of its period allows it. The return is false if the
+        /// request is denied; it is not counted then.
+
+    void        release(Seconds now);
+        /// Takes back a request counted by tryAcquire() at now on the same
+        /// thread. The request goes back to the batch of the thread's slice.
+
+    Seconds     periodEnd(Seconds now) const;
+        /// End of the period which includes now.
+
+    int64_t     claimed(Seconds now) const;
+        /// Requests of the period including now which slices have claimed
+        /// so far. Admitted requests never exceed it.
+
+    int64_t     limit() const { return maxRequests; }
+
+    Seconds     period() const { return periodLength; }
+
+    int64_t     maxUnused() const { return (int64_t)sliceCount * maxBatch; }
+
+private:
+    struct alignas(64) Slice
+    {
+        std::mutex  mutex;
+            /// This mutex must be locked to access the members below.
+        int64_t     window;
+            /// Index of the period the slice's batch belongs to.
+        int64_t     available;
+            /// Requests left in the slice's batch.
+    };
+
+    Slice&      currentSlice();
+
+    bool        claimBatch(Slice& slice);
+        /// Claims the next batch for the slice's window from the total.
+        /// The return is false if the limit is reached. Slice's mutex
+        /// must be locked.
+
+    static const unsigned countBits = 40;
+    static const uint64_t countMask = ((uint64_t)1 << countBits) - 1;
+    static const uint64_t windowMask = ~(uint64_t)0 >> countBits;
+
+    int64_t     maxRequests;
+    Seconds     periodLength;
+    size_t      sliceCount;
+    int64_t     maxBatch;
+
+    std::unique_ptr<Slice[]>
+                slices;
+
+    std::atomic<uint64_t>
+                total;
+        /// Low countBits hold the claimed count, high bits the index of
+        /// its window modulo 2^(64 - countBits).
+};
+
+#endif // GLOBAL_REQUEST_BUDGET_H
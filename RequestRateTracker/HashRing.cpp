@@ -0,0 +1,59 @@
+//
+// Consistent hash ring of cluster nodes. See HashRing class header for
+// details.
+//
+#include "HashRing.h"
+#include <algorithm>
+
+namespace {
+
+uint64_t mix64(uint64_t z)
+    /// Finalizer of SplitMix64, which spreads every input bit over the
+    /// whole result.
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+uint64_t hashName(const std::string& name, uint64_t seed)
+{
+    // FNV-1a, so names hash the same on every platform
+    uint64_t hash = 14695981039346656037ull ^ seed;
+    for (unsigned char c : name)
+        hash = (hash ^ c) * 1099511628211ull;
+    return hash;
+}
+
+} // namespace
+
+HashRing::HashRing(uint64_t seed, unsigned pointsPerNode)
+    : clientHash(seed)
+    , seed(seed)
+    , pointsPerNode(std::max(pointsPerNode, 1u))
+{
+}
+
+size_t HashRing::addNode(const std::string& name)
+{
+    const size_t node = names.size();
+    names.push_back(name);
+    const uint64_t nameHash = hashName(name, seed);
+    for (unsigned i = 0; i < pointsPerNode; i++)
+        points.push_back(Point{ mix64(nameHash + 0x9E3779B97F4A7C15ull * (i + 1)), node });
+    // Ties are broken by name, so that the order of addNode() calls does
+    // not matter
+    std::sort(points.begin(), points.end(), [this](const Point& a, const Point& b) {
+        return a.position < b.position
+            || (a.position == b.position && names[a.node] < names[b.node]);
+    });
+    return node;
+}
+
+size_t HashRing::ownerOf(ClientID client) const
+{
+    const uint64_t position = mix64(clientHash.hash64(client));
+    auto next = std::lower_bound(points.begin(), points.end(), position,
+        [](const Point& p, uint64_t value) { return p.position < value; });
+    return (next == points.end()) ? points.front().node : next->node;
+}
@@ -0,0 +1,58 @@
+#ifndef HASH_RING_H
+#define HASH_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "KeyedClientHash.h"
+
+class HashRing
+    /// Responsible for assigning each client to one node of a cluster by
+    /// consistent hashing, so that every node agrees on the owner of a
+    /// client without coordination.
+    ///
+    /// Each node is placed on the ring at several points derived from its
+    /// name, and a client is owned by the node of the first point at or
+    /// after the client's hash. When a node joins or leaves, only clients
+    /// between its points and their predecessors change owners. Points are
+    /// kept in a sorted array, so ownerOf() is a binary search.
+    ///
+    /// Clients are hashed with a KeyedClientHash of a seed shared by the
+    /// cluster: all nodes must be built with the same seed, names and
+    /// points per node, while clients cannot aim at one node without
+    /// knowing the seed.
+{
+public:
+    using ClientID = uint32_t;
+
+    explicit HashRing(uint64_t seed, unsigned pointsPerNode = 128);
+
+    size_t      addNode(const std::string& name);
+        /// Adds a node, e.g. "10.0.0.1:9990", and returns its index. Names
+        /// must be unique.
+
+    size_t      ownerOf(ClientID client) const;
+        /// Index of the node which owns the client. There must be at least
+        /// one node.
+
+    size_t      size() const { return names.size(); }
+
+    const std::string& nameOf(size_t node) const { return names[node]; }
+
+private:
+    struct Point
+    {
+        uint64_t    position;
+        size_t      node;
+    };
+
+    KeyedClientHash         clientHash;
+    uint64_t                seed;
+    unsigned                pointsPerNode;
+    std::vector<std::string> names;
+    std::vector<Point>      points;
+        /// Sorted by position.
+};
+
+#endif // HASH_RING_H
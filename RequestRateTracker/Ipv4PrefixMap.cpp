@@ -0,0 +1,55 @@
+//
+// Direct-indexed state of IPv4 /24 prefixes. See Ipv4PrefixMap class
+// header for details.
+//
+#include "Ipv4PrefixMap.h"
+
+namespace {
+
+const size_t prefixCount = (size_t)1 << 24;
+
+} // namespace
+
+Ipv4PrefixMap::Ipv4PrefixMap(bool hugePages)
+    : region(prefixCount / 4, hugePages)
+    , words(static_cast<uint64_t*>(region.data()))
+{
+}
+
+bool Ipv4PrefixMap::setState(Address prefix, unsigned prefixLength, State state)
+{
+    if (prefixLength > 24)
+        return false;
+
+    const uint64_t hostBits = 32 - prefixLength;
+    const Address first = (hostBits >= 32) ? 0 : (prefix >> hostBits) << hostBits;
+    const size_t entries = (size_t)1 << (24 - prefixLength);
+    const uint64_t entry = (uint64_t)state & entryMask;
+
+    if (entries >= entriesPerWord) {
+        // Whole words are covered
+        uint64_t pattern = 0;
+        for (unsigned i = 0; i < entriesPerWord; i++)
+            pattern |= entry << (i * 2);
+        const size_t firstWord = first >> 13;
+        for (size_t i = 0; i < entries / entriesPerWord; i++)
+            std::atomic_ref<uint64_t>(words[firstWord + i])
+                .store(pattern, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::atomic_ref<uint64_t> word(words[first >> 13]);
+    uint64_t mask = 0;
+    uint64_t bits = 0;
+    for (size_t i = 0; i < entries; i++) {
+        unsigned shift = shiftOf(first + (Address)(i << 8));
+        mask |= entryMask << shift;
+        bits |= entry << shift;
+    }
+    uint64_t expected = word.load(std::memory_order_relaxed);
+    while (!word.compare_exchange_weak(expected, (expected & ~mask) | bits,
+        std::memory_order_relaxed))
+    {
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef IPV4_PREFIX_MAP_H
+#define IPV4_PREFIX_MAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "PageRegion.h"
+
+class Ipv4PrefixMap
+    /// Responsible for the state of every IPv4 /24 prefix: whether clients
+    /// of the subnet are tracked, exempt from the rate limit or blocked.
+    ///
+    /// States are kept in a directly indexed array of 2-bit entries, one per
+    /// /24 prefix (4 MiB for all 2^24 prefixes), so a lookup is one memory
+    /// access without hashing. The array is preallocated zero-filled, which
+    /// means all prefixes are tracked; pages of the array are only backed by
+    /// memory once a prefix in them is changed.
+    ///
+    /// stateOf() and setState() may be called concurrently: entries are
+    /// read and updated with relaxed atomic operations.
+{
+public:
+    using Address = uint32_t;
+
+    enum class State : uint8_t
+    {
+        Tracked = 0,
+        Exempt = 1,
+        Blocked = 2
+    };
+
+    explicit Ipv4PrefixMap(bool hugePages = false);
+
+    Ipv4PrefixMap(const Ipv4PrefixMap&) = delete;
+    Ipv4PrefixMap& operator=(const Ipv4PrefixMap&) = delete;
+
+    State       stateOf(Address address) const
+        /// Returns state of the /24 prefix of the address.
+    {
+        uint64_t word = std::atomic_ref<uint64_t>(words[address >> 13])
+            .load(std::memory_order_relaxed);
+        return (State)((word >> shiftOf(address)) & entryMask);
+    }
+
+    bool        setState(Address prefix, unsigned prefixLength, State state);
+        /// Sets state of all /24 prefixes covered by prefix/prefixLength.
+        /// Bits of the prefix beyond prefixLength are ignored.
+        /// The return is false if prefixLength is longer than 24, which
+        /// cannot be represented.
+
+private:
+    static constexpr unsigned   entriesPerWord = 32;
+    static constexpr uint64_t   entryMask = 3;
+
+    static unsigned shiftOf(Address address)
+    {
+        return ((address >> 8) & (entriesPerWord - 1)) * 2;
+    }
+
+    PageRegion              region;
+    uint64_t*               words;
+        /// Accessed through std::atomic_ref, so zero-filled pages are
+        /// used as they are.
+};
+
+#endif // IPV4_PREFIX_MAP_H
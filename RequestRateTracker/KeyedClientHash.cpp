@@ -0,0 +1,38 @@
+//
+// Keyed hash of client IDs. See KeyedClientHash class header for details.
+//
+#include "KeyedClientHash.h"
+#include <random>
+
+namespace {
+
+uint64_t splitMix64(uint64_t& state)
+    /// Expands a seed into a sequence of well mixed keys.
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+} // namespace
+
+KeyedClientHash::KeyedClientHash() : KeyedClientHash(processSeed())
+{
+}
+
+KeyedClientHash::KeyedClientHash(uint64_t seed)
+{
+    uint64_t state = seed;
+    offset = splitMix64(state);
+    multiplier = splitMix64(state) | 1;
+}
+
+uint64_t KeyedClientHash::processSeed()
+{
+    static const uint64_t seed = []() {
+        std::random_device random;
+        return ((uint64_t)random() << 32) ^ (uint64_t)random();
+    }();
+    return seed;
+}
@@ -0,0 +1,66 @@
+#ifndef KEYED_CLIENT_HASH_H
+#define KEYED_CLIENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+class KeyedClientHash
+    /// Responsible for hashing client IDs with a secret per-process seed, so
+    /// that clients cannot choose IDs (e.g. addresses in a subnet) which
+    /// collide in the tracker's tables.
+    ///
+    /// Seeded multiply-shift hash is used: the ID is offset and multiplied
+    /// by random 64-bit keys, then the high half is folded into the low
+    /// half, so both low and high bits of the result depend on every bit
+    /// of the ID. It costs one multiplication.
+    ///
+    /// Default-constructed instances use the process seed, which is drawn
+    /// from std::random_device on first use.
+{
+public:
+    KeyedClientHash();
+
+    explicit KeyedClientHash(uint64_t seed);
+        /// Uses a fixed seed instead of the process seed (for tests).
+
+    size_t operator()(uint32_t client) const noexcept
+    {
+        return (size_t)hash64(client);
+    }
+
+    uint64_t hash64(uint32_t client) const noexcept
+    {
+        uint64_t h = ((uint64_t)client + offset) * multiplier;
+        return h ^ (h >> 32);
+    }
+
+    size_t shardOf(uint32_t client, size_t shardCount) const noexcept
+        /// Returns the shard of the client among shardCount shards.
+    {
+        return shardOfHash(hash64(client), shardCount);
+    }
+
+    static size_t shardOfHash(uint64_t hash, size_t shardCount) noexcept
+        /// Returns the shard of a hash64() among shardCount shards. High
+        /// bits are used, so tables of a shard keyed with the same hash
+        /// still spread its clients over their buckets. High bits of a
+        /// multiply-shift hash advance in equal steps over consecutive IDs,
+        /// so for some keys a subnet would fall into few shards; they are
+        /// mixed with the low bits first.
+    {
+        uint64_t h = hash;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return (size_t)(((h >> 32) * shardCount) >> 32);
+    }
+
+    static uint64_t processSeed();
+
+private:
+    uint64_t    offset;
+    uint64_t    multiplier;
+        /// Always odd.
+};
+
+#endif // KEYED_CLIENT_HASH_H
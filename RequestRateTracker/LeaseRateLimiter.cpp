@@ -0,0 +1,180 @@
+//
+// Rate limiting with quotas leased from a coordinator. See
+// LeaseRateLimiter class header for details.
+//
+#include "LeaseRateLimiter.h"
+#include <algorithm>
+#include <vector>
+
+LeaseRateLimiter::LeaseRateLimiter(RequestRateTracker& tracker, Coordinator& coordinator,
+    uint32_t maxLease, std::chrono::seconds leaseTime, NowFunction* nowFunction,
+    const CircuitBreaker::Settings& breakerSettings)
+    : tracker(tracker)
+    , coordinator(coordinator)
+    , maxLease(std::max<uint32_t>(maxLease, 1))
+    , leaseTime(std::max<Seconds>((Seconds)leaseTime.count(), 1))
+    , breaker(breakerSettings)
+    , localCount(0)
+    , leaseCount(0)
+    , failureCount(0)
+    , fallbackCount(0)
+    , returnedCount(0)
+    , nowFunction(nowFunction)
+{
+    startTime = nowFunction();
+}
+
+RequestRate::Seconds LeaseRateLimiter::addRequest(HTTPClientID client, Priority priority)
+{
+    switch (tracker.admissionOf(client)) {
+    case RequestRateTracker::Admission::Allowed:
+        return 0;
+    case RequestRateTracker::Admission::Denied:
+        return tracker.getRateLimit().period;
+    default:
+        break;
+    }
+
+    const Seconds now = secondsSinceStart();
+    Shard& shard = shards[clientHash.shardOf(client, shardCount)];
+    QuotaCoordinator::LeaseRequest request{ 0, client, maxLease, 0, 0 };
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.clients.size() >= maxClients)
+            reclaimExpired(shard, now);
+        ClientLease& lease = shard.clients[client];
+        if (lease.left > 0 && lease.leaseEnd > now) {
+            localCount.fetch_add(1, std::memory_order_relaxed);
+            return admitLeased(lease, client, priority);
+        }
+        if (lease.deniedUntil > now) {
+            localCount.fetch_add(1, std::memory_order_relaxed);
+            return lease.windowEnd - now;
+        }
+        // The lease has ended or is used up; what is left of it goes back
+        // with the next one
+        request.returned = lease.left;
+        request.returnedWindow = lease.window;
+        lease.left = 0;
+    }
+    return renew(shard, request, priority);
+}
+
+void LeaseRateLimiter::returnUnused()
+{
+    const Seconds now = secondsSinceStart();
+    std::vector<QuotaCoordinator::LeaseRequest> returns;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.clients) {
+            ClientLease& lease = entry.second;
+            if (lease.left > 0 && lease.leaseEnd <= now) {
+                returns.push_back({ 0, entry.first, 0, lease.left, lease.window });
+                lease.left = 0;
+            }
+        }
+    }
+    for (const QuotaCoordinator::LeaseRequest& request : returns) {
+        if (!breaker.allowCall(nowFunction()))
+            break;
+        QuotaCoordinator::LeaseGrant grant;
+        if (!coordinator.lease(request, grant)) {
+            failureCount.fetch_add(1, std::memory_order_relaxed);
+            breaker.recordFailure(nowFunction());
+            continue;
+        }
+        breaker.recordSuccess();
+        returnedCount.fetch_add(request.returned, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LeaseRateLimiter::localDecisions() const
+{
+    return localCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LeaseRateLimiter::leaseRequests() const
+{
+    return leaseCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LeaseRateLimiter::coordinatorFailures() const
+{
+    return failureCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LeaseRateLimiter::fallbackDecisions() const
+{
+    return fallbackCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LeaseRateLimiter::returnedRequests() const
+{
+    return returnedCount.load(std::memory_order_relaxed);
+}
+
+RequestRate::Seconds LeaseRateLimiter::secondsSinceStart() const
+{
+    auto sinceStart = std::chrono::duration_cast<std::chrono::seconds>(
+        nowFunction() - startTime);
+    return (Seconds)sinceStart.count();
+}
+
+RequestRate::Seconds LeaseRateLimiter::renew(Shard& shard,
+    const QuotaCoordinator::LeaseRequest& request, Priority priority)
+{
+    if (!breaker.allowCall(nowFunction()))
+        return decideLocally(request.client, priority);
+    leaseCount.fetch_add(1, std::memory_order_relaxed);
+    QuotaCoordinator::LeaseGrant grant;
+    if (!coordinator.lease(request, grant)) {
+        failureCount.fetch_add(1, std::memory_order_relaxed);
+        breaker.recordFailure(nowFunction());
+        return decideLocally(request.client, priority);
+    }
+    breaker.recordSuccess();
+    returnedCount.fetch_add(request.returned, std::memory_order_relaxed);
+
+    const Seconds now = secondsSinceStart();
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ClientLease& lease = shard.clients[request.client];
+    // Leases of other threads in the same window are added up
+    if (lease.window != grant.window || lease.windowEnd <= now)
+        lease.left = 0;
+    lease.window = grant.window;
+    lease.windowEnd = now + std::max<Seconds>(grant.remaining, 1);
+    if (grant.granted == 0) {
+        lease.deniedUntil = std::min(lease.windowEnd, now + leaseTime);
+        return lease.windowEnd - now;
+    }
+    lease.deniedUntil = 0;
+    lease.left += grant.granted;
+    lease.leaseEnd = std::min(lease.windowEnd, now + leaseTime);
+    return admitLeased(lease, request.client, priority);
+}
+
+RequestRate::Seconds LeaseRateLimiter::admitLeased(ClientLease& lease, HTTPClientID client,
+    Priority priority)
+{
+    const Seconds waitTime = tracker.debitSharedLimits(client, priority);
+    if (waitTime == 0)
+        lease.left--;
+    return waitTime;
+}
+
+RequestRate::Seconds LeaseRateLimiter::decideLocally(HTTPClientID client, Priority priority)
+{
+    fallbackCount.fetch_add(1, std::memory_order_relaxed);
+    return tracker.addRequest(client, priority);
+}
+
+void LeaseRateLimiter::reclaimExpired(Shard& shard, Seconds now)
+{
+    for (auto entry = shard.clients.begin(); entry != shard.clients.end();) {
+        const ClientLease& lease = entry->second;
+        if (lease.windowEnd <= now && lease.deniedUntil <= now)
+            entry = shard.clients.erase(entry);
+        else
+            ++entry;
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef LEASE_RATE_LIMITER_H
+#define LEASE_RATE_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include "CircuitBreaker.h"
+#include "KeyedClientHash.h"
+#include "QuotaCoordinator.h"
+#include "RequestRateTracker.h"
+
+class LeaseRateLimiter
+    /// Responsible for rate limiting clients with quotas leased from a
+    /// QuotaCoordinator shared with other nodes, so that nodes only talk to
+    /// the coordinator once per lease rather than once per request.
+    ///
+    /// When a client has no lease, the request asks the coordinator for a
+    /// lease of up to maxLease requests and is admitted from it; the next
+    /// requests of the client are admitted from the lease locally until it
+    /// is used up. If the coordinator has no quota left, the denial is
+    /// cached and later requests of the client are denied locally too.
+    ///
+    /// A lease lasts leaseTime, and at most until the window of the
+    /// coordinator rolls over. The unused requests of an ended lease are
+    /// returned to the coordinator with the next lease of the client, or by
+    /// returnUnused() for clients with no more requests, so that quota
+    /// held by idle nodes can be leased by busy ones. Denials are cached
+    /// for leaseTime as well, since returned requests may be leased again
+    /// before the window ends.
+    ///
+    /// The request which asks for a lease waits for the coordinator; the
+    /// Coordinator is expected to give up after a timeout. If the
+    /// coordinator cannot be reached, the request is decided by the local
+    /// tracker alone and counted by coordinatorFailures(). Failures trip a
+    /// CircuitBreaker, as in StoreRateLimiter. Requests returned with a
+    /// lease which fails are lost, which only makes the limit stricter for
+    /// the rest of the window.
+    ///
+    /// As in StoreRateLimiter, exempt, blocked and untracked clients are
+    /// decided by the tracker first, and requests admitted from a lease are
+    /// also counted in the tracker's shared limits. A request denied by
+    /// one of them is left in the lease.
+{
+public:
+    using HTTPClientID = RequestRateTracker::HTTPClientID;
+    using Priority = RequestRateTracker::Priority;
+    using NowFunction = RequestRateTracker::NowFunction;
+
+    class Coordinator
+        /// Transport of leases to the coordinator.
+    {
+    public:
+        virtual ~Coordinator() = default;
+
+        virtual bool    lease(const QuotaCoordinator::LeaseRequest& request,
+                            QuotaCoordinator::LeaseGrant& grant) = 0;
+            /// Passes the request to QuotaCoordinator::lease() and sets
+            /// grant to its result. Returns false if the coordinator cannot
+            /// be reached. Called concurrently by request threads.
+    };
+
+    static constexpr size_t maxClients = 1 << 16;
+        /// Per shard; clients whose windows have ended are dropped when a
+        /// shard is full.
+
+    LeaseRateLimiter(RequestRateTracker& tracker, Coordinator& coordinator,
+        uint32_t maxLease, std::chrono::seconds leaseTime,
+        NowFunction* nowFunction = std::chrono::steady_clock::now,
+        const CircuitBreaker::Settings& breakerSettings = CircuitBreaker::Settings());
+        /// The tracker decides requests when the coordinator cannot be
+        /// reached. The tracker and coordinator must outlive the limiter.
+
+    LeaseRateLimiter(const LeaseRateLimiter&) = delete;
+    LeaseRateLimiter& operator=(const LeaseRateLimiter&) = delete;
+
+    RequestRate::Seconds addRequest(HTTPClientID client, Priority priority = Priority::Normal);
+        /// Same as RequestRateTracker::addRequest() for all nodes sharing
+        /// the coordinator.
+
+    void                returnUnused();
+        /// Returns the unused requests of all ended leases to the
+        /// coordinator. Called periodically, e.g. every leaseTime.
+
+    uint64_t            localDecisions() const;
+        /// Requests admitted from a lease or denied from the cache, without
+        /// the coordinator.
+
+    uint64_t            leaseRequests() const;
+        /// Leases asked from the coordinator.
+
+    uint64_t            coordinatorFailures() const;
+
+    uint64_t            fallbackDecisions() const;
+        /// Requests decided by the local tracker.
+
+    uint64_t            returnedRequests() const;
+        /// Unused requests of ended leases sent back to the coordinator.
+
+    const CircuitBreaker& circuitBreaker() const { return breaker; }
+
+private:
+    using Seconds = RequestRate::Seconds;
+
+    struct ClientLease
+    {
+        uint32_t    window = 0;
+            /// Window of the coordinator in which the lease was granted.
+        Seconds     windowEnd = 0;
+            /// In seconds since start; 0 if unknown.
+        uint32_t    left = 0;
+            /// Leased requests not admitted yet.
+        Seconds     leaseEnd = 0;
+        Seconds     deniedUntil = 0;
+            /// Set when the coordinator had no quota left.
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex      mutex;
+            /// This mutex must be locked to access the member below.
+        std::unordered_map<HTTPClientID, ClientLease, KeyedClientHash>
+                        clients;
+    };
+
+    static constexpr size_t shardCount = 16;
+
+    Seconds             secondsSinceStart() const;
+
+    Seconds             renew(Shard& shard, const QuotaCoordinator::LeaseRequest& request,
+                            Priority priority);
+        /// Asks for a new lease and admits the request from it.
+
+    Seconds             admitLeased(ClientLease& lease, HTTPClientID client,
+                            Priority priority);
+        /// Admits the request from the lease if the tracker's shared
+        /// limits allow it.
+
+    Seconds             decideLocally(HTTPClientID client, Priority priority);
+
+    static void         reclaimExpired(Shard& shard, Seconds now);
+
+    RequestRateTracker& tracker;
+    Coordinator&        coordinator;
+    uint32_t            maxLease;
+    Seconds             leaseTime;
+
+    KeyedClientHash     clientHash;
+        /// Assigns clients to shards and hashes them within a shard, so
+        /// clients cannot choose IDs which collide.
+    Shard               shards[shardCount];
+
+    CircuitBreaker      breaker;
+
+    std::atomic<uint64_t> localCount;
+    std::atomic<uint64_t> leaseCount;
+    std::atomic<uint64_t> failureCount;
+    std::atomic<uint64_t> fallbackCount;
+    std::atomic<uint64_t> returnedCount;
+
+    std::chrono::time_point<std::chrono::steady_clock>
+                        startTime;
+
+    NowFunction*        nowFunction;
+};
+
+#endif // LEASE_RATE_LIMITER_H
@@ -0,0 +1,90 @@
+//
+// Read-only mapping of a file. See MappedFile class header for details.
+//
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string& path)
+    : ptr(nullptr), length(0), opened(false)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return;
+    }
+    if (fileSize.QuadPart == 0) {
+        opened = true;
+    }
+    else {
+        // The view keeps the mapping alive after the handles are closed
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+        if (ptr != nullptr) {
+            length = (size_t)fileSize.QuadPart;
+            opened = true;
+        }
+    }
+    CloseHandle(file);
+}
+
+MappedFile::~MappedFile()
+{
+    if (ptr != nullptr)
+        UnmapViewOfFile(ptr);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+    : ptr(nullptr), length(0), opened(false)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        return;
+    }
+    if (status.st_size == 0) {
+        opened = true;
+    }
+    else {
+        void* mapped = ::mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            ::madvise(mapped, (size_t)status.st_size, MADV_SEQUENTIAL);
+            ptr = static_cast<const char*>(mapped);
+            length = (size_t)status.st_size;
+            opened = true;
+        }
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (ptr != nullptr)
+        ::munmap(const_cast<char*>(ptr), length);
+}
+
+#endif
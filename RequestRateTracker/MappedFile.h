@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+    /// Responsible for mapping a whole file into memory for reading.
+    ///
+    /// The file is mapped read-only and the kernel is told it is read
+    /// sequentially, so large files are streamed through the page cache
+    /// without being copied into the process's heap. Pages of the file
+    /// which were read may be dropped again under memory pressure.
+{
+public:
+    explicit MappedFile(const std::string& path);
+        /// Maps the file at path. isOpen() is false if the file cannot be
+        /// opened or mapped. An empty file is open with size() 0.
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return ptr; }
+
+    size_t      size() const { return length; }
+
+    bool        isOpen() const { return opened; }
+
+private:
+    const char* ptr;
+    size_t      length;
+    bool        opened;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,217 @@
+//
+// NUMA topology of the host for the rate-limiting module. See NumaTopology
+// class header for details.
+//
+#include "NumaTopology.h"
+#include <new>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <string>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+void* NumaTopology::allocate(size_t size, size_t alignment, unsigned) const
+{
+    return ::operator new(size, std::align_val_t(alignment));
+}
+
+void NumaTopology::deallocate(void* ptr, size_t, size_t alignment, unsigned) const
+{
+    ::operator delete(ptr, std::align_val_t(alignment));
+}
+
+namespace {
+
+#if defined(_WIN32)
+
+class SystemNumaTopology : public NumaTopology
+    /// NUMA topology reported by Windows.
+{
+public:
+    SystemNumaTopology()
+    {
+        ULONG highestNode = 0;
+        nodes = GetNumaHighestNodeNumber(&highestNode) ? highestNode + 1 : 1;
+    }
+
+    unsigned nodeCount() const override { return nodes; }
+
+    unsigned currentNode() const override
+    {
+        PROCESSOR_NUMBER processor;
+        USHORT node = 0;
+        GetCurrentProcessorNumberEx(&processor);
+        if (!GetNumaProcessorNodeEx(&processor, &node) || node >= nodes)
+            return 0;
+        return node;
+    }
+
+    bool pinCurrentThread(unsigned node) const override
+    {
+        GROUP_AFFINITY affinity = {};
+        if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity))
+            return false;
+        return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+    }
+
+    void* allocate(size_t size, size_t, unsigned node) const override
+    {
+        // Pages are aligned far beyond any alignment of a type
+        void* ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+        if (ptr == nullptr)
+            ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    void deallocate(void* ptr, size_t, size_t, unsigned) const override
+    {
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+
+private:
+    unsigned nodes;
+};
+
+#elif defined(__linux__)
+
+class SystemNumaTopology : public NumaTopology
+    /// NUMA topology reported by Linux sysfs. Does not depend on libnuma.
+{
+public:
+    SystemNumaTopology() : nodes(1)
+    {
+        // Format of the file is a list of ranges, e.g. "0-1" or "0"
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string ranges;
+        if (online >> ranges) {
+            auto last = ranges.find_last_of("-,");
+            unsigned highestNode = (unsigned)std::stoul(
+                last == std::string::npos ? ranges : ranges.substr(last + 1));
+            nodes = highestNode + 1;
+        }
+    }
+
+    unsigned nodeCount() const override { return nodes; }
+
+    unsigned currentNode() const override
+    {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || node >= nodes)
+            return 0;
+        return node;
+    }
+
+    bool pinCurrentThread(unsigned node) const override
+    {
+        std::ifstream cpuList("/sys/devices/system/node/node"
+            + std::to_string(node) + "/cpulist");
+        std::string ranges;
+        if (!(cpuList >> ranges))
+            return false;
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        size_t pos = 0;
+        while (pos < ranges.size()) {
+            size_t end = ranges.find(',', pos);
+            if (end == std::string::npos)
+                end = ranges.size();
+            std::string range = ranges.substr(pos, end - pos);
+            size_t dash = range.find('-');
+            unsigned first = (unsigned)std::stoul(range.substr(0, dash));
+            unsigned last = (dash == std::string::npos)
+                ? first : (unsigned)std::stoul(range.substr(dash + 1));
+            for (unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+                CPU_SET(cpu, &cpus);
+            pos = end + 1;
+        }
+        return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+    }
+
+    void* allocate(size_t size, size_t, unsigned node) const override
+    {
+        // Pages are aligned far beyond any alignment of a type
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            throw std::bad_alloc();
+        if (node < sizeof(unsigned long) * 8) {
+            // Prefer the node, but do not fail if binding is not permitted
+            const long mpolPreferred = 1;
+            unsigned long nodeMask = 1UL << node;
+            syscall(SYS_mbind, ptr, size, mpolPreferred, &nodeMask,
+                sizeof(nodeMask) * 8, 0);
+        }
+        return ptr;
+    }
+
+    void deallocate(void* ptr, size_t size, size_t, unsigned) const override
+    {
+        munmap(ptr, size);
+    }
+
+private:
+    unsigned nodes;
+};
+
+#else
+
+class SystemNumaTopology : public NumaTopology
+    /// Single node topology for platforms without NUMA support.
+{
+public:
+    unsigned nodeCount() const override { return 1; }
+
+    unsigned currentNode() const override { return 0; }
+
+    bool pinCurrentThread(unsigned node) const override { return node == 0; }
+};
+
+#endif
+
+thread_local unsigned simulatedCurrentNode = 0;
+
+} // namespace
+
+const NumaTopology& NumaTopology::system()
+{
+    static const SystemNumaTopology topology;
+    return topology;
+}
+
+const NumaTopology& NumaTopology::singleNode()
+{
+    static const SimulatedNumaTopology topology(1);
+    return topology;
+}
+
+SimulatedNumaTopology::SimulatedNumaTopology(unsigned nodes)
+    : nodes(nodes > 0 ? nodes : 1)
+{
+}
+
+unsigned SimulatedNumaTopology::currentNode() const
+{
+    return simulatedCurrentNode < nodes ? simulatedCurrentNode : 0;
+}
+
+bool SimulatedNumaTopology::pinCurrentThread(unsigned node) const
+{
+    if (node >= nodes)
+        return false;
+    simulatedCurrentNode = node;
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <cstddef>
+#include <memory_resource>
+
+class NumaTopology
+    /// Responsible for describing NUMA nodes of the host to the rate-limiting
+    /// module: how many nodes there are, which node the calling thread runs
+    /// on, how to allocate memory bound to a node and how to pin a thread
+    /// to a node.
+    ///
+    /// Use NumaTopology::system() for the topology of the current host. On
+    /// hosts (or platforms) without NUMA support it reports a single node
+    /// and allocates memory from the default heap.
+    ///
+    /// SimulatedNumaTopology allows to exercise multi-node code paths on a
+    /// single-node machine.
+{
+public:
+    virtual ~NumaTopology() = default;
+
+    virtual unsigned    nodeCount() const = 0;
+        /// Number of NUMA nodes. Always at least 1.
+
+    virtual unsigned    currentNode() const = 0;
+        /// Node of the processor the calling thread is running on.
+
+    virtual bool        pinCurrentThread(unsigned node) const = 0;
+        /// Restricts the calling thread to processors of the node.
+        /// The return is false if the thread could not be pinned.
+
+    virtual void*       allocate(size_t size, size_t alignment, unsigned node) const;
+        /// Allocates memory aligned to alignment (a power of 2), preferably
+        /// bound to the node. Falls back to memory which is not bound to
+        /// any node if binding is not available.
+
+    virtual void        deallocate(void* ptr, size_t size, size_t alignment,
+                            unsigned node) const;
+        /// Frees memory returned by allocate() with the same size and
+        /// alignment.
+
+    static const NumaTopology& system();
+
+    static const NumaTopology& singleNode();
+        /// Topology with one node, which does not query the host.
+};
+
+class SimulatedNumaTopology : public NumaTopology
+    /// NUMA topology with the given number of nodes on top of ordinary memory.
+    /// The current node of a thread is the node it was last pinned to (0 for
+    /// threads which were never pinned). Pinning does not change real thread
+    /// affinity.
+{
+public:
+    explicit SimulatedNumaTopology(unsigned nodes);
+
+    unsigned    nodeCount() const override { return nodes; }
+
+    unsigned    currentNode() const override;
+
+    bool        pinCurrentThread(unsigned node) const override;
+
+private:
+    unsigned    nodes;
+};
+
+class NodeMemoryResource : public std::pmr::memory_resource
+    /// Memory resource which takes memory of a NUMA node from NumaTopology.
+    /// Intended as the upstream of arenas and pools, which request memory
+    /// in large chunks.
+{
+public:
+    NodeMemoryResource(const NumaTopology& topology, unsigned node)
+        : topology(topology), node(node)
+    {
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        return topology.allocate(bytes, alignment, node);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+    {
+        topology.deallocate(ptr, bytes, alignment, node);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    const NumaTopology& topology;
+    unsigned            node;
+};
+
+#endif // NUMA_TOPOLOGY_H
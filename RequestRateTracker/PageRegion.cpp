@@ -0,0 +1,110 @@
+//
+// Preallocated memory region backed by huge pages. See PageRegion class
+// header for details.
+//
+#include "PageRegion.h"
+#include <new>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <cstring>
+#endif
+
+namespace {
+
+size_t roundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+#if defined(_WIN32)
+
+PageRegion::PageRegion(size_t size, bool hugePages, int preferredNode)
+    : ptr(nullptr), length(size), kind(PageKind::Default)
+{
+    const DWORD node = (preferredNode >= 0) ? (DWORD)preferredNode : NUMA_NO_PREFERRED_NODE;
+    size_t largePage = GetLargePageMinimum();
+    if (hugePages && largePage > 0) {
+        length = roundUp(size, largePage);
+        ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, length,
+            MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+        if (ptr != nullptr)
+            kind = PageKind::Huge;
+    }
+    if (ptr == nullptr) {
+        length = size;
+        ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, length,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    }
+    if (ptr == nullptr)
+        ptr = VirtualAlloc(nullptr, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+}
+
+PageRegion::~PageRegion()
+{
+    VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+#elif defined(__linux__)
+
+PageRegion::PageRegion(size_t size, bool hugePages, int preferredNode)
+    : ptr(MAP_FAILED), length(size), kind(PageKind::Default)
+{
+    const size_t hugePageSize = 2 * 1024 * 1024;
+    if (hugePages) {
+        length = roundUp(size, hugePageSize);
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+            kind = PageKind::Huge;
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            throw std::bad_alloc();
+        if (hugePages && madvise(ptr, length, MADV_HUGEPAGE) == 0)
+            kind = PageKind::TransparentHuge;
+    }
+    if (preferredNode >= 0 && preferredNode < (int)(sizeof(unsigned long) * 8)) {
+        // Prefer the node, but do not fail if binding is not permitted
+        const long mpolPreferred = 1;
+        unsigned long nodeMask = 1UL << preferredNode;
+        syscall(SYS_mbind, ptr, length, mpolPreferred, &nodeMask,
+            sizeof(nodeMask) * 8, 0);
+    }
+}
+
+PageRegion::~PageRegion()
+{
+    munmap(ptr, length);
+}
+
+#else
+
+PageRegion::PageRegion(size_t size, bool, int)
+    : ptr(::operator new(size, std::align_val_t(64))), length(size), kind(PageKind::Default)
+{
+    // Aligned to cache lines like the pages of other platforms, so that
+    // slots of tables do not straddle them
+    std::memset(ptr, 0, size);
+}
+
+PageRegion::~PageRegion()
+{
+    ::operator delete(ptr, std::align_val_t(64));
+}
+
+#endif
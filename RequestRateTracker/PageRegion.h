@@ -0,0 +1,46 @@
+#ifndef PAGE_REGION_H
+#define PAGE_REGION_H
+
+#include <cstddef>
+
+class PageRegion
+    /// Responsible for a single preallocated, zero-filled memory region
+    /// which is backed by huge pages when they are requested and available.
+    ///
+    /// Explicit huge pages are tried first (MEM_LARGE_PAGES on Windows, which
+    /// requires SeLockMemoryPrivilege, or MAP_HUGETLB on Linux, which requires
+    /// reserved huge pages). On Linux the region falls back to transparent
+    /// huge pages, otherwise to default pages. pageKind() tells which pages
+    /// back the region.
+{
+public:
+    enum class PageKind
+    {
+        Default,
+        TransparentHuge,
+        Huge
+    };
+
+    PageRegion(size_t size, bool hugePages, int preferredNode = -1);
+        /// Allocates at least 'size' bytes. If preferredNode is not negative,
+        /// the region is preferably placed on that NUMA node.
+        /// Throws std::bad_alloc if memory cannot be allocated.
+
+    ~PageRegion();
+
+    PageRegion(const PageRegion&) = delete;
+    PageRegion& operator=(const PageRegion&) = delete;
+
+    void*       data() const { return ptr; }
+
+    size_t      size() const { return length; }
+
+    PageKind    pageKind() const { return kind; }
+
+private:
+    void*       ptr;
+    size_t      length;
+    PageKind    kind;
+};
+
+#endif // PAGE_REGION_H
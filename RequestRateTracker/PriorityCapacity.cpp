@@ -0,0 +1,113 @@
+//
+// Capacity shared by priority classes. See PriorityCapacity class header
+// for details.
+//
+#include "PriorityCapacity.h"
+#include <algorithm>
+
+namespace {
+
+int64_t windowIndex(PriorityCapacity::Seconds now, PriorityCapacity::Seconds period)
+{
+    int64_t index = now / period;
+    return (now % period < 0) ? index - 1 : index;
+}
+
+} // namespace
+
+PriorityCapacity::PriorityCapacity(const Reservations& reservations, Seconds period)
+    : periodLength(std::max<Seconds>(period, 1))
+    , counts(0)
+{
+    for (size_t i = 0; i < classCount; i++)
+        reserved[i] = std::max<int64_t>(reservations[i], 0);
+    setCapacity(maxCapacity);
+}
+
+bool PriorityCapacity::tryAcquire(Priority priority, Seconds now)
+{
+    const size_t level = (size_t)priority;
+    const uint64_t tag = tagOf(now);
+    uint64_t expected = counts.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t current = ((expected >> tagShift) == tag) ? expected : (tag << tagShift);
+        // The request counts for its class and every higher class, whose
+        // counts include all lower classes
+        uint64_t increment = 0;
+        for (size_t k = 0; k <= level; k++) {
+            int64_t count = (int64_t)((current >> (k * countBits)) & countMask);
+            if (count >= quotas[k].load(std::memory_order_relaxed))
+                return false;
+            increment += (uint64_t)1 << (k * countBits);
+        }
+        if (counts.compare_exchange_weak(expected, current + increment,
+            std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+void PriorityCapacity::release(Priority priority, Seconds now)
+{
+    const size_t level = (size_t)priority;
+    const uint64_t tag = tagOf(now);
+    uint64_t decrement = 0;
+    for (size_t k = 0; k <= level; k++)
+        decrement += (uint64_t)1 << (k * countBits);
+    uint64_t expected = counts.load(std::memory_order_relaxed);
+    // Counts of another period have nothing to take back
+    while ((expected >> tagShift) == tag
+        && ((expected >> (level * countBits)) & countMask) > 0)
+    {
+        if (counts.compare_exchange_weak(expected, expected - decrement,
+            std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+}
+
+void PriorityCapacity::setCapacity(int64_t capacity)
+{
+    int64_t total = 0;
+    for (int64_t r : reserved)
+        total += r;
+    int64_t shed = total - std::clamp<int64_t>(capacity, 0, total);
+
+    // Reservations left after shedding, bulk first
+    Reservations left = reserved;
+    for (size_t i = classCount; i-- > 0 && shed > 0;) {
+        int64_t taken = std::min(left[i], shed);
+        left[i] -= taken;
+        shed -= taken;
+    }
+    int64_t quota = 0;
+    for (size_t i = classCount; i-- > 0;) {
+        quota += left[i];
+        quotas[i].store(std::min(quota, maxCapacity), std::memory_order_relaxed);
+    }
+}
+
+int64_t PriorityCapacity::capacity() const
+{
+    return quotas[0].load(std::memory_order_relaxed);
+}
+
+int64_t PriorityCapacity::used(Priority priority, Seconds now) const
+{
+    uint64_t word = counts.load(std::memory_order_relaxed);
+    if ((word >> tagShift) != tagOf(now))
+        return 0;
+    return (int64_t)((word >> ((size_t)priority * countBits)) & countMask);
+}
+
+PriorityCapacity::Seconds PriorityCapacity::periodEnd(Seconds now) const
+{
+    return (windowIndex(now, periodLength) + 1) * periodLength;
+}
+
+uint64_t PriorityCapacity::tagOf(Seconds now) const
+{
+    return (uint64_t)windowIndex(now, periodLength) & tagMask;
+}
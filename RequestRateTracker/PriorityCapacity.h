@@ -0,0 +1,106 @@
+#ifndef PRIORITY_CAPACITY_H
+#define PRIORITY_CAPACITY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class PriorityCapacity
+    /// Responsible for capacity shared by priority classes of requests,
+    /// each with a reserved part of the capacity.
+    ///
+    /// A class may use its own reservation and borrow the unused part of
+    /// the reservations of all lower classes, but never the reservations
+    /// of higher classes. That is, for every class the requests of the
+    /// class and all lower classes together may not exceed their
+    /// reservations together. Bulk requests are therefore limited to the
+    /// bulk reservation, while critical requests may use the whole
+    /// capacity which is left.
+    ///
+    /// The counts of requests of each class and all lower classes are
+    /// packed into a single atomic word together with the index of their
+    /// period, so admission is a constant-time compare-and-swap on one
+    /// cache line. Periods are aligned to multiples of the period.
+    ///
+    /// Counts take 16 bits each, which leaves 16 bits for the period index.
+    /// The index wraps, so after exactly a multiple of 2^16 periods without
+    /// requests (over 18 hours with a period of one second) the counts left
+    /// are found again for one period.
+    ///
+    /// When the capacity is lowered (see setCapacity()), it is taken from
+    /// the reservation of the bulk class first, then of the normal class,
+    /// and of the critical class last.
+{
+public:
+    using Seconds = int64_t;
+
+    enum class Priority : uint8_t
+    {
+        Critical = 0,
+        Normal = 1,
+        Bulk = 2
+    };
+
+    static constexpr size_t classCount = 3;
+
+    using Reservations = std::array<int64_t, classCount>;
+        /// Requests per period reserved for each class, indexed by Priority.
+
+    static constexpr int64_t maxCapacity = ((int64_t)1 << 16) - 1;
+
+    PriorityCapacity(const Reservations& reserved, Seconds period);
+        /// The capacity is the sum of the reservations, which must not
+        /// exceed maxCapacity. Negative reservations are taken as 0.
+
+    PriorityCapacity(const PriorityCapacity&) = delete;
+    PriorityCapacity& operator=(const PriorityCapacity&) = delete;
+
+    bool        tryAcquire(Priority priority, Seconds now);
+        /// Counts a request of the class at now (seconds on the caller's
+        /// clock) if the capacity available to the class allows it. The
+        /// return is false if the request is denied; it is not counted then.
+
+    void        release(Priority priority, Seconds now);
+        /// Takes back a request counted by tryAcquire() at now.
+
+    void        setCapacity(int64_t capacity);
+        /// Lowers (or restores) the capacity to shed load, lower classes
+        /// first. It is clamped to the sum of the reservations. Requests
+        /// already counted in the current period are kept.
+
+    int64_t     capacity() const;
+
+    int64_t     used(Priority priority, Seconds now) const;
+        /// Requests of the class and all lower classes counted in the
+        /// period including now.
+
+    Seconds     periodEnd(Seconds now) const;
+
+    Seconds     period() const { return periodLength; }
+
+    const Reservations& reservations() const { return reserved; }
+
+private:
+    static constexpr unsigned   countBits = 16;
+    static constexpr uint64_t   countMask = ((uint64_t)1 << countBits) - 1;
+    static constexpr unsigned   tagShift = countBits * classCount;
+    static constexpr uint64_t   tagMask = ~(uint64_t)0 >> tagShift;
+
+    uint64_t    tagOf(Seconds now) const;
+
+    Reservations    reserved;
+    Seconds         periodLength;
+
+    std::atomic<int64_t>
+                    quotas[classCount];
+        /// Requests of each class and all lower classes allowed per period.
+
+    std::atomic<uint64_t>
+                    counts;
+        /// The count of class i and all lower classes in bits
+        /// [i * countBits, (i + 1) * countBits), the index of the period
+        /// modulo 2^(64 - tagShift) in the highest bits.
+};
+
+#endif // PRIORITY_CAPACITY_H
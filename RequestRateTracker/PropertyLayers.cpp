@@ -0,0 +1,122 @@
+//
+// Layered property files reread by a running server. See PropertyLayers
+// class header for details.
+//
+#include "PropertyLayers.h"
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+std::string trim(const std::string& text)
+{
+    size_t first = 0;
+    size_t last = text.size();
+    while (first < last && isSpace(text[first]))
+        first++;
+    while (last > first && isSpace(text[last - 1]))
+        last--;
+    return text.substr(first, last - first);
+}
+
+int readValueChar(const std::string& text, size_t& pos)
+    /// Returns the next character of a value, with escapes resolved and
+    /// continued lines joined, 0 at the end of the line or -1 at the end
+    /// of the text.
+{
+    for (;;) {
+        if (pos >= text.size())
+            return -1;
+        char c = text[pos++];
+        if (c == '\n' || c == '\r')
+            return 0;
+        if (c != '\\')
+            return (unsigned char)c;
+        if (pos >= text.size())
+            return -1;
+        c = text[pos++];
+        switch (c) {
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'n': return '\n';
+        case 'f': return '\f';
+        case '\r':
+            if (pos < text.size() && text[pos] == '\n')
+                pos++;
+            continue;
+        case '\n':
+            continue;
+        default:
+            return (unsigned char)c;
+        }
+    }
+}
+
+} // namespace
+
+PropertyLayers::PropertyLayers(const std::vector<std::string>& paths)
+    : paths(paths)
+{
+}
+
+bool PropertyLayers::load()
+{
+    properties.clear();
+    unreadable.clear();
+    // Files of lower priority are read first, so higher ones replace their keys
+    std::map<std::string, std::string> loaded;
+    for (auto path = paths.rbegin(); path != paths.rend(); ++path) {
+        std::ifstream in(*path, std::ios::binary);
+        if (!in) {
+            unreadable = *path;
+            return false;
+        }
+        std::ostringstream text;
+        text << in.rdbuf();
+        std::map<std::string, std::string> file;
+        parse(text.str(), file);
+        for (auto& property : file)
+            loaded[property.first] = std::move(property.second);
+    }
+    properties = std::move(loaded);
+    return true;
+}
+
+std::string PropertyLayers::getString(const std::string& key,
+    const std::string& defaultValue) const
+{
+    auto property = properties.find(key);
+    return (property != properties.end()) ? property->second : defaultValue;
+}
+
+void PropertyLayers::parse(const std::string& text, std::map<std::string, std::string>& properties)
+{
+    size_t pos = 0;
+    while (pos < text.size()) {
+        while (pos < text.size() && isSpace(text[pos]))
+            pos++;
+        if (pos >= text.size())
+            break;
+        if (text[pos] == '#' || text[pos] == '!') {
+            while (pos < text.size() && text[pos] != '\n' && text[pos] != '\r')
+                pos++;
+            continue;
+        }
+        std::string key;
+        while (pos < text.size() && text[pos] != '=' && text[pos] != ':'
+            && text[pos] != '\n' && text[pos] != '\r')
+            key += text[pos++];
+        std::string value;
+        if (pos < text.size() && (text[pos] == '=' || text[pos] == ':')) {
+            pos++;
+            for (int c = readValueChar(text, pos); c > 0; c = readValueChar(text, pos))
+                value += (char)c;
+        }
+        properties[trim(key)] = trim(value);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef PROPERTY_LAYERS_H
+#define PROPERTY_LAYERS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+class PropertyLayers
+    /// Responsible for rereading settings of a running server from the
+    /// property files it was started with.
+    ///
+    /// Files are layered like the configuration of the server: a key is
+    /// looked up in the first file which defines it, so a file given on
+    /// the command line can override some keys of the default file and
+    /// inherit the others. A key which no file defines takes its default,
+    /// as it did at startup.
+    ///
+    /// Files have the format of Poco's PropertyFileConfiguration: lines
+    /// "key = value" or "key: value", comments starting with '#' or '!',
+    /// the escapes \t, \r, \n and \f, and lines continued with a trailing
+    /// backslash.
+{
+public:
+    explicit PropertyLayers(const std::vector<std::string>& paths);
+        /// Files in the order of their priority, highest first.
+
+    bool        load();
+        /// Rereads all files. Returns false if one of them cannot be read;
+        /// unreadablePath() names it then and no keys are loaded.
+
+    const std::string& unreadablePath() const { return unreadable; }
+
+    std::string getString(const std::string& key, const std::string& defaultValue) const;
+        /// Returns the value of the key in the first file which defines it.
+
+    static void parse(const std::string& text, std::map<std::string, std::string>& properties);
+        /// Sets properties of the text. A key defined more than once takes
+        /// its last value, as in PropertyFileConfiguration.
+
+private:
+    std::vector<std::string>            paths;
+    std::map<std::string, std::string>  properties;
+    std::string                         unreadable;
+};
+
+#endif // PROPERTY_LAYERS_H
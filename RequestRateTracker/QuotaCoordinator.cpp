@@ -0,0 +1,127 @@
+//
+// Leasing of client quotas to the nodes sharing a limit. See
+// QuotaCoordinator class header for details.
+//
+#include "QuotaCoordinator.h"
+#include <algorithm>
+
+namespace {
+
+void storeUint32(uint8_t* bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (uint8_t)(value >> (8 * i));
+}
+
+uint32_t loadUint32(const uint8_t* bytes)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t)bytes[i] << (8 * i);
+    return value;
+}
+
+} // namespace
+
+QuotaCoordinator::QuotaCoordinator(RequestRate rateLimit, NowFunction* nowFunction)
+    : rateLimit(rateLimit)
+    , leaseCount(0)
+    , leasedCount(0)
+    , returnedCount(0)
+    , nowFunction(nowFunction)
+{
+    this->rateLimit.num = std::max(rateLimit.num, 0);
+    this->rateLimit.period = std::max<Seconds>(rateLimit.period, 1);
+    startTime = nowFunction();
+}
+
+QuotaCoordinator::LeaseGrant QuotaCoordinator::lease(const LeaseRequest& request)
+{
+    const Seconds now = secondsSinceStart();
+    const uint32_t window = (uint32_t)(now / rateLimit.period);
+    const uint32_t remaining = (uint32_t)((Seconds)(window + 1) * rateLimit.period - now);
+
+    Shard& shard = shards[clientHash.shardOf(request.client, shardCount)];
+    uint32_t granted = 0;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.clients.size() >= maxClients) {
+            for (auto entry = shard.clients.begin(); entry != shard.clients.end();) {
+                if (entry->second.window != window)
+                    entry = shard.clients.erase(entry);
+                else
+                    ++entry;
+            }
+        }
+        ClientQuota& quota = shard.clients[request.client];
+        if (quota.window != window) {
+            quota.window = window;
+            quota.leased = 0;
+        }
+        if (request.returned > 0 && request.returnedWindow == window) {
+            uint32_t taken = std::min(request.returned, quota.leased);
+            quota.leased -= taken;
+            returnedCount.fetch_add(taken, std::memory_order_relaxed);
+        }
+        uint32_t left = (uint32_t)rateLimit.num - std::min((uint32_t)rateLimit.num, quota.leased);
+        if (left > 0)
+            granted = std::min(request.wanted, std::max<uint32_t>(left / 4, 1));
+        quota.leased += granted;
+    }
+    if (granted > 0) {
+        leaseCount.fetch_add(1, std::memory_order_relaxed);
+        leasedCount.fetch_add(granted, std::memory_order_relaxed);
+    }
+    return LeaseGrant{ request.sequence, granted, window, remaining };
+}
+
+uint64_t QuotaCoordinator::leases() const
+{
+    return leaseCount.load(std::memory_order_relaxed);
+}
+
+uint64_t QuotaCoordinator::leasedRequests() const
+{
+    return leasedCount.load(std::memory_order_relaxed);
+}
+
+uint64_t QuotaCoordinator::returnedRequests() const
+{
+    return returnedCount.load(std::memory_order_relaxed);
+}
+
+void QuotaCoordinator::encodeRequest(const LeaseRequest& request, uint8_t* frame)
+{
+    storeUint32(frame, request.sequence);
+    storeUint32(frame + 4, request.client);
+    storeUint32(frame + 8, request.wanted);
+    storeUint32(frame + 12, request.returned);
+    storeUint32(frame + 16, request.returnedWindow);
+}
+
+QuotaCoordinator::LeaseRequest QuotaCoordinator::decodeRequest(const uint8_t* frame)
+{
+    return LeaseRequest{ loadUint32(frame), loadUint32(frame + 4), loadUint32(frame + 8),
+        loadUint32(frame + 12), loadUint32(frame + 16) };
+}
+
+void QuotaCoordinator::encodeGrant(const LeaseGrant& grant, uint8_t* frame)
+{
+    storeUint32(frame, grant.sequence);
+    storeUint32(frame + 4, grant.granted);
+    storeUint32(frame + 8, grant.window);
+    storeUint32(frame + 12, grant.remaining);
+}
+
+QuotaCoordinator::LeaseGrant QuotaCoordinator::decodeGrant(const uint8_t* frame)
+{
+    return LeaseGrant{ loadUint32(frame), loadUint32(frame + 4), loadUint32(frame + 8),
+        loadUint32(frame + 12) };
+}
+
+RequestRate::Seconds QuotaCoordinator::secondsSinceStart() const
+{
+    auto sinceStart = std::chrono::duration_cast<std::chrono::seconds>(
+        nowFunction() - startTime);
+    return (Seconds)sinceStart.count();
+}
@@ -0,0 +1,137 @@
+#ifndef QUOTA_COORDINATOR_H
+#define QUOTA_COORDINATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include "KeyedClientHash.h"
+#include "RequestRateTracker.h"
+
+class QuotaCoordinator
+    /// Responsible for handing out the quota of each client to the nodes
+    /// which share a rate limit, in leases of several requests, so that
+    /// nodes decide most requests without asking the coordinator (see
+    /// LeaseRateLimiter).
+    ///
+    /// The coordinator counts the requests leased in each client's window;
+    /// windows are aligned to the coordinator's clock, so all nodes lease
+    /// from the same window. A lease is never larger than a quarter of the
+    /// quota left in the window, so leases get smaller as the quota runs
+    /// out, and the last requests of a window are leased one at a time.
+    /// Since nodes only admit leased requests, the limit is never exceeded
+    /// over all nodes.
+    ///
+    /// A node returns the unused part of a lease when the lease ends. The
+    /// returned requests can be leased again if the window of the lease has
+    /// not ended yet; otherwise they are ignored, since the next window
+    /// starts with the whole quota anyway.
+    ///
+    /// Leases are exchanged as fixed-size little-endian frames (see
+    /// encodeRequest() and encodeGrant()), which start with a sequence
+    /// number chosen by the node, as the frames of ClusterRateLimiter.
+{
+public:
+    using HTTPClientID = RequestRateTracker::HTTPClientID;
+    using NowFunction = RequestRateTracker::NowFunction;
+
+    struct LeaseRequest
+    {
+        uint32_t        sequence;
+        HTTPClientID    client;
+        uint32_t        wanted;
+            /// Requests the node wants to lease; 0 to return requests only.
+        uint32_t        returned;
+            /// Unused requests of an ended lease.
+        uint32_t        returnedWindow;
+            /// Window of the returned requests.
+    };
+
+    struct LeaseGrant
+    {
+        uint32_t        sequence;
+        uint32_t        granted;
+            /// 0 if the quota of the window is used up.
+        uint32_t        window;
+        uint32_t        remaining;
+            /// Seconds until the window ends.
+    };
+
+    static constexpr size_t requestSize = 20;
+    static constexpr size_t grantSize = 16;
+
+    static constexpr size_t maxClients = 1 << 16;
+        /// Per shard; clients whose windows have ended are dropped when a
+        /// shard is full.
+
+    explicit QuotaCoordinator(RequestRate rateLimit,
+        NowFunction* nowFunction = std::chrono::steady_clock::now);
+
+    QuotaCoordinator(const QuotaCoordinator&) = delete;
+    QuotaCoordinator& operator=(const QuotaCoordinator&) = delete;
+
+    LeaseGrant          lease(const LeaseRequest& request);
+        /// Takes back the returned requests, then leases at most wanted
+        /// requests of the client's current window. Called concurrently by
+        /// the connections of the nodes.
+
+    uint64_t            leases() const;
+        /// Lease requests which granted requests.
+
+    uint64_t            leasedRequests() const;
+
+    uint64_t            returnedRequests() const;
+        /// Returned requests taken back into their window.
+
+    static void         encodeRequest(const LeaseRequest& request, uint8_t* frame);
+        /// Writes requestSize bytes to frame.
+
+    static LeaseRequest decodeRequest(const uint8_t* frame);
+
+    static void         encodeGrant(const LeaseGrant& grant, uint8_t* frame);
+        /// Writes grantSize bytes to frame.
+
+    static LeaseGrant   decodeGrant(const uint8_t* frame);
+
+private:
+    using Seconds = RequestRate::Seconds;
+
+    struct ClientQuota
+    {
+        uint32_t    window = 0;
+        uint32_t    leased = 0;
+            /// Requests leased in the window and not returned.
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex      mutex;
+            /// This mutex must be locked to access the member below.
+        std::unordered_map<HTTPClientID, ClientQuota, KeyedClientHash>
+                        clients;
+    };
+
+    static constexpr size_t shardCount = 16;
+
+    Seconds             secondsSinceStart() const;
+
+    RequestRate         rateLimit;
+
+    KeyedClientHash     clientHash;
+        /// Assigns clients to shards and hashes them within a shard, so
+        /// clients cannot choose IDs which collide.
+    Shard               shards[shardCount];
+
+    std::atomic<uint64_t> leaseCount;
+    std::atomic<uint64_t> leasedCount;
+    std::atomic<uint64_t> returnedCount;
+
+    std::chrono::time_point<std::chrono::steady_clock>
+                        startTime;
+
+    NowFunction*        nowFunction;
+};
+
+#endif // QUOTA_COORDINATOR_H
@@ -0,0 +1,202 @@
+//
+// Append-only journal of quota usage. See QuotaJournal class header for
+// details.
+//
+#include "QuotaJournal.h"
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+static_assert(sizeof(QuotaJournal::Record) == 24, "Journal records must not be padded");
+
+#if defined(_WIN32)
+
+intptr_t openFile(const std::string& path, bool truncate)
+{
+    // Sharing delete access lets rewrite() rename a new journal over
+    // the open one
+    HANDLE handle = CreateFileA(path.c_str(),
+        truncate ? GENERIC_WRITE : FILE_APPEND_DATA,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+        truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return (handle == INVALID_HANDLE_VALUE) ? -1 : (intptr_t)handle;
+}
+
+bool writeFile(intptr_t file, const char* data, size_t size)
+{
+    while (size > 0) {
+        DWORD chunk = (DWORD)std::min<size_t>(size, 1 << 30);
+        DWORD written = 0;
+        if (!WriteFile((HANDLE)file, data, chunk, &written, nullptr) || written == 0)
+            return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool syncFile(intptr_t file)
+{
+    return FlushFileBuffers((HANDLE)file) != 0;
+}
+
+void closeFile(intptr_t file)
+{
+    CloseHandle((HANDLE)file);
+}
+
+void syncDirectoryOf(const std::string&)
+{
+    // Directories cannot be synced; NTFS journals the rename itself
+}
+
+#else
+
+intptr_t openFile(const std::string& path, bool truncate)
+{
+    return ::open(path.c_str(),
+        O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND), 0644);
+}
+
+bool writeFile(intptr_t file, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = ::write((int)file, data, size);
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+bool syncFile(intptr_t file)
+{
+    return ::fsync((int)file) == 0;
+}
+
+void closeFile(intptr_t file)
+{
+    ::close((int)file);
+}
+
+void syncDirectoryOf(const std::string& path)
+{
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+#endif
+
+} // namespace
+
+QuotaJournal::QuotaJournal()
+    : file(noFile), recordCount(0)
+{
+}
+
+QuotaJournal::~QuotaJournal()
+{
+    if (file != noFile)
+        closeFile(file);
+}
+
+bool QuotaJournal::open(const std::string& journalPath, std::vector<Record>& records)
+{
+    if (file != noFile)
+        return false;
+
+    records.clear();
+    uintmax_t fileSize = 0;
+    {
+        std::ifstream in(journalPath, std::ios::binary);
+        Record record;
+        while (in.read((char*)&record, sizeof(record)) && record.check == checkOf(record))
+            records.push_back(record);
+        std::error_code error;
+        fileSize = std::filesystem::file_size(journalPath, error);
+        if (error)
+            fileSize = 0;
+    }
+
+    path = journalPath;
+    if (fileSize > records.size() * sizeof(Record)) {
+        // Drop the torn tail, or records appended after it would be lost
+        // on the next open
+        return rewrite(records);
+    }
+    file = openFile(path, false);
+    recordCount = records.size();
+    return file != noFile;
+}
+
+bool QuotaJournal::append(const std::vector<Record>& records)
+{
+    if (file == noFile)
+        return false;
+    if (!writeRecords(file, records))
+        return false;
+    recordCount += records.size();
+    return true;
+}
+
+bool QuotaJournal::rewrite(const std::vector<Record>& records)
+{
+    const std::string temporaryPath = path + ".tmp";
+    NativeFile temporary = openFile(temporaryPath, true);
+    if (temporary == noFile)
+        return false;
+    bool written = writeRecords(temporary, records);
+    closeFile(temporary);
+
+    std::error_code error;
+    if (written)
+        std::filesystem::rename(temporaryPath, path, error);
+    if (!written || error) {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    syncDirectoryOf(path);
+
+    if (file != noFile)
+        closeFile(file);
+    file = openFile(path, false);
+    recordCount = records.size();
+    return file != noFile;
+}
+
+uint32_t QuotaJournal::checkOf(const Record& record)
+{
+    // FNV-1a over the fields before the checksum
+    const unsigned char* bytes = (const unsigned char*)&record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(Record, check); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+bool QuotaJournal::writeRecords(NativeFile file, const std::vector<Record>& records)
+{
+    std::vector<Record> checked(records);
+    for (Record& record : checked)
+        record.check = checkOf(record);
+    return writeFile(file, (const char*)checked.data(), checked.size() * sizeof(Record))
+        && syncFile(file);
+}
@@ -0,0 +1,83 @@
+#ifndef QUOTA_JOURNAL_H
+#define QUOTA_JOURNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class QuotaJournal
+    /// Responsible for an append-only file of quota usage records which
+    /// survives restarts of the process.
+    ///
+    /// Records are of fixed size and carry a checksum, so a record torn
+    /// by a crash in the middle of a write is recognised when the journal
+    /// is read and it is dropped together with anything after it. Each
+    /// append() is a single write of all its records followed by a single
+    /// sync, so callers are expected to batch records (group commit).
+    ///
+    /// The journal is not thread-safe: it is meant to be written by one
+    /// commit thread at a time.
+{
+public:
+    struct Record
+        /// Usage of a client's quotas as of the time the record was written.
+        /// Later records of the same client replace earlier ones.
+    {
+        uint32_t    client;
+        int32_t     day;
+            /// Days since 1970-01-01 in the quotas' time zone.
+        uint32_t    dailyCount;
+        int32_t     month;
+            /// Months since 1970-01 in the quotas' time zone.
+        uint32_t    monthlyCount;
+        uint32_t    check;
+            /// Checksum of the fields above, set by the journal.
+    };
+
+    QuotaJournal();
+
+    ~QuotaJournal();
+
+    QuotaJournal(const QuotaJournal&) = delete;
+    QuotaJournal& operator=(const QuotaJournal&) = delete;
+
+    bool        open(const std::string& path, std::vector<Record>& records);
+        /// Opens the journal at path for appending, creating it if it does
+        /// not exist, and returns its valid records in the order they were
+        /// written. The return is false if the file cannot be opened.
+
+    bool        append(const std::vector<Record>& records);
+        /// Writes the records at the end of the journal and waits until
+        /// they are on stable storage. The return is false if the write or
+        /// the sync failed; the records may then be written in part.
+
+    bool        rewrite(const std::vector<Record>& records);
+        /// Replaces the contents of the journal with the records. They are
+        /// written to a temporary file which is synced and renamed over the
+        /// journal, so a crash leaves either the old or the new journal.
+        /// The return is false if the journal could not be replaced; the
+        /// old journal is kept open then.
+
+    bool        isOpen() const { return file != noFile; }
+
+    size_t      size() const { return recordCount; }
+        /// Number of records in the journal.
+
+private:
+    static uint32_t checkOf(const Record& record);
+
+    using NativeFile = intptr_t;
+        /// File descriptor, or HANDLE on Windows.
+
+    static constexpr NativeFile noFile = -1;
+
+    static bool writeRecords(NativeFile file, const std::vector<Record>& records);
+        /// Writes the records with their checksums set and syncs the file.
+
+    std::string path;
+    NativeFile  file;
+    size_t      recordCount;
+};
+
+#endif // QUOTA_JOURNAL_H
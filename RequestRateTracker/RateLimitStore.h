@@ -0,0 +1,38 @@
+#ifndef RATE_LIMIT_STORE_H
+#define RATE_LIMIT_STORE_H
+
+#include <cstdint>
+#include <functional>
+#include "RequestRateTracker.h"
+
+class RateLimitStore
+    /// Interface of a backend which counts requests of clients in windows
+    /// shared by many processes, e.g. a Redis compatible store (see
+    /// RespRateLimitStore).
+{
+public:
+    using HTTPClientID = RequestRateTracker::HTTPClientID;
+
+    struct Window
+    {
+        int64_t                 count;
+            /// Requests counted in the window, including the ones added.
+        RequestRate::Seconds    remaining;
+            /// Seconds until the window ends.
+    };
+
+    using Callback = std::function<void(bool counted, const Window& window)>;
+        /// counted is false if the store cannot be reached or failed; the
+        /// window is undefined then.
+
+    virtual ~RateLimitStore() = default;
+
+    virtual void    increment(HTTPClientID client, uint32_t requests,
+                        RequestRate::Seconds period, Callback done) = 0;
+        /// Adds requests to the current window of the client, which starts
+        /// a new window of period seconds if the client has none, as one
+        /// atomic operation of the store. done may be called on any thread,
+        /// before or after the return. Called concurrently.
+};
+
+#endif // RATE_LIMIT_STORE_H
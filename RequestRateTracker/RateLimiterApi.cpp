@@ -0,0 +1,162 @@
+//
+// C interface of the rate-limiting module. See RateLimiterApi.h for details.
+//
+#include "RateLimiterApi.h"
+#include "RequestRateTracker.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+
+struct rrt_tracker
+    /// Opaque handle of the C interface.
+{
+    rrt_tracker(RequestRate rateLimit, const NumaTopology& topology, unsigned shardsPerNode)
+        : tracker(rateLimit, topology, shardsPerNode)
+    {
+    }
+
+    RequestRateTracker  tracker;
+};
+
+namespace {
+
+template <class Struct>
+void copyVersioned(Struct& to, const Struct& from, uint32_t callerSize)
+    /// Copies the fields known to both the caller and the library.
+{
+    std::memcpy(&to, &from, std::min<size_t>(callerSize, sizeof(Struct)));
+}
+
+} // namespace
+
+int32_t rrt_api_version(void)
+{
+    return RRT_API_VERSION;
+}
+
+void rrt_config_init(rrt_config* config)
+{
+    if (config == nullptr)
+        return;
+    rrt_config defaults;
+    std::memset(&defaults, 0, sizeof(defaults));
+    defaults.struct_size = config->struct_size;
+    defaults.limit_requests = 100;
+    defaults.limit_period = 3600;
+    defaults.window_alignment = RRT_ALIGN_GLOBAL;
+    copyVersioned(*config, defaults, config->struct_size);
+}
+
+int rrt_create(const rrt_config* userConfig, rrt_tracker** tracker)
+{
+    if (userConfig == nullptr || tracker == nullptr)
+        return RRT_INVALID_ARGUMENT;
+
+    rrt_config config;
+    config.struct_size = sizeof(config);
+    rrt_config_init(&config);
+    copyVersioned(config, *userConfig, userConfig->struct_size);
+    if (config.limit_requests <= 0 || config.limit_period <= 0
+        || config.window_alignment < RRT_ALIGN_GLOBAL
+        || config.window_alignment > RRT_ALIGN_FIRST_REQUEST
+        || config.global_limit_requests < 0
+        || (config.global_limit_requests > 0 && config.global_limit_period <= 0))
+    {
+        return RRT_INVALID_ARGUMENT;
+    }
+
+    try {
+        RequestRate rateLimit{ config.limit_requests, (RequestRate::Seconds)config.limit_period };
+        const NumaTopology& topology = (config.shards_per_node > 0)
+            ? NumaTopology::system() : NumaTopology::singleNode();
+        std::unique_ptr<rrt_tracker> created(new rrt_tracker(rateLimit, topology,
+            config.shards_per_node > 0 ? config.shards_per_node : 1));
+        static const RequestRateTracker::WindowAlignment alignments[] = {
+            RequestRateTracker::WindowAlignment::Global,
+            RequestRateTracker::WindowAlignment::ClientHash,
+            RequestRateTracker::WindowAlignment::FirstRequest
+        };
+        created->tracker.setWindowAlignment(alignments[config.window_alignment]);
+        created->tracker.setRetryJitter((RequestRate::Seconds)config.retry_jitter);
+        if (config.fixed_capacity > 0)
+            created->tracker.setFixedCapacity((size_t)config.fixed_capacity, config.huge_pages != 0);
+        if (config.global_limit_requests > 0)
+            created->tracker.setGlobalLimit(RequestRate{ config.global_limit_requests,
+                (RequestRate::Seconds)config.global_limit_period });
+        *tracker = created.release();
+        return RRT_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return RRT_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return RRT_ERROR;
+    }
+}
+
+int64_t rrt_check(rrt_tracker* tracker, uint32_t client)
+{
+    if (tracker == nullptr)
+        return RRT_INVALID_ARGUMENT;
+    try {
+        return tracker->tracker.addRequest(client);
+    }
+    catch (const std::bad_alloc&) {
+        return RRT_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return RRT_ERROR;
+    }
+}
+
+int rrt_check_batch(rrt_tracker* tracker, const uint32_t* clients,
+    int64_t* waitTimes, size_t count)
+{
+    if (tracker == nullptr || ((clients == nullptr || waitTimes == nullptr) && count > 0))
+        return RRT_INVALID_ARGUMENT;
+    try {
+        for (size_t i = 0; i < count; i++)
+            waitTimes[i] = tracker->tracker.addRequest(clients[i]);
+        return RRT_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return RRT_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return RRT_ERROR;
+    }
+}
+
+int rrt_get_stats(const rrt_tracker* tracker, rrt_stats* userStats)
+{
+    if (tracker == nullptr || userStats == nullptr)
+        return RRT_INVALID_ARGUMENT;
+
+    rrt_stats stats;
+    stats.struct_size = userStats->struct_size;
+    stats.clients = tracker->tracker.size();
+    stats.local_requests = tracker->tracker.localRequests();
+    stats.cross_node_requests = tracker->tracker.crossNodeRequests();
+    stats.overflow_requests = tracker->tracker.overflowRequests();
+    stats.bytes_per_client = tracker->tracker.bytesPerClient();
+    copyVersioned(*userStats, stats, userStats->struct_size);
+    return RRT_OK;
+}
+
+uint32_t rrt_client_id(const char* address)
+{
+    if (address == nullptr)
+        return 0;
+    try {
+        return RequestRateTracker::getClientId(address);
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+void rrt_destroy(rrt_tracker* tracker)
+{
+    delete tracker;
+}
@@ -0,0 +1,116 @@
+/*
+ * C interface of the rate-limiting module, for C servers and for FFI from
+ * other runtimes. The interface does not depend on Poco.
+ *
+ * A tracker is an opaque handle created by rrt_create() and released by
+ * rrt_destroy(). All functions taking a tracker are thread-safe.
+ * rrt_check() and rrt_check_batch() do not allocate memory when the tracker
+ * has a fixed capacity; otherwise new clients take memory from the tracker's
+ * arenas, which grow in large chunks.
+ *
+ * Structures passed to the library start with struct_size, which must be
+ * set to sizeof the structure the caller was compiled with. This allows
+ * fields to be appended in later versions without breaking the ABI.
+ *
+ * Define RRT_SHARED when linking with the shared library (and RRT_EXPORTS
+ * when building it); leave both undefined for the static library.
+ */
+#ifndef RATE_LIMITER_API_H
+#define RATE_LIMITER_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(RRT_SHARED) && defined(_WIN32)
+#  if defined(RRT_EXPORTS)
+#    define RRT_API __declspec(dllexport)
+#  else
+#    define RRT_API __declspec(dllimport)
+#  endif
+#elif defined(RRT_SHARED) && defined(__GNUC__)
+#  define RRT_API __attribute__((visibility("default")))
+#else
+#  define RRT_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RRT_API_VERSION 1
+
+/* Return codes */
+#define RRT_OK              0
+#define RRT_INVALID_ARGUMENT (-1)
+#define RRT_OUT_OF_MEMORY   (-2)
+#define RRT_ERROR           (-3)
+
+/* Window alignment, see RequestRateTracker::WindowAlignment */
+#define RRT_ALIGN_GLOBAL        0
+#define RRT_ALIGN_CLIENT_HASH   1
+#define RRT_ALIGN_FIRST_REQUEST 2
+
+typedef struct rrt_tracker rrt_tracker;
+
+typedef struct rrt_config
+{
+    uint32_t    struct_size;
+    int32_t     limit_requests;     /* Requests allowed per period, > 0 */
+    int64_t     limit_period;       /* Period in seconds, > 0 */
+    uint32_t    shards_per_node;    /* 0 for a single shard without NUMA placement */
+    int32_t     window_alignment;   /* One of RRT_ALIGN_* */
+    int64_t     retry_jitter;       /* Maximum seconds added to wait times */
+    uint64_t    fixed_capacity;     /* Maximum clients, 0 for growable tables */
+    int32_t     huge_pages;         /* Back fixed-capacity tables by huge pages */
+    int32_t     global_limit_requests; /* Requests of all clients per global period, 0 for none */
+    int64_t     global_limit_period;   /* Global period in seconds */
+} rrt_config;
+
+typedef struct rrt_stats
+{
+    uint32_t    struct_size;
+    uint64_t    clients;            /* Clients with open windows */
+    uint64_t    local_requests;     /* Requests handled on the node of their shard */
+    uint64_t    cross_node_requests;
+    uint64_t    overflow_requests;  /* Requests not limited because tables were full */
+    uint64_t    bytes_per_client;
+} rrt_stats;
+
+RRT_API int32_t     rrt_api_version(void);
+    /* Returns RRT_API_VERSION the library was built with. */
+
+RRT_API void        rrt_config_init(rrt_config* config);
+    /* Fills config with defaults: 100 requests per hour, one shard,
+     * global alignment, no jitter, growable tables, no global limit.
+     * config->struct_size must be set by the caller; only the fields
+     * within it are written. */
+
+RRT_API int         rrt_create(const rrt_config* config, rrt_tracker** tracker);
+    /* Creates a tracker. Returns RRT_OK and stores the handle in *tracker,
+     * or an error code. */
+
+RRT_API int64_t     rrt_check(rrt_tracker* tracker, uint32_t client);
+    /* Tracks a request of the client (IPv4 address in host byte order).
+     * Returns 0 if the request is allowed, the number of seconds to wait
+     * if it is denied, or RRT_INVALID_ARGUMENT if tracker is NULL. */
+
+RRT_API int         rrt_check_batch(rrt_tracker* tracker, const uint32_t* clients,
+                        int64_t* wait_times, size_t count);
+    /* Tracks requests of count clients in order and stores the result of
+     * rrt_check() for each of them in wait_times. */
+
+RRT_API int         rrt_get_stats(const rrt_tracker* tracker, rrt_stats* stats);
+    /* Fills stats. stats->struct_size must be set by the caller. */
+
+RRT_API uint32_t    rrt_client_id(const char* address);
+    /* Converts a dotted IPv4 address to a client ID, or returns 0 if it
+     * cannot be parsed. Allocates; not meant for the hot path. */
+
+RRT_API void        rrt_destroy(rrt_tracker* tracker);
+    /* Releases the tracker. NULL is ignored. */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RATE_LIMITER_API_H */
@@ -2,21 +2,66 @@
 // HTTP rate limiting module. See RequestRateTracker class header for details.
 //
 #include "RequestRateTracker.h"
-#include "Poco/Mutex.h"
+#include <algorithm>
 #include <regex>
 #include <limits>
-
-using Poco::Mutex;
+#include <new>
 
 RequestRateTracker::RequestRateTracker(RequestRate rateLimit, NowFunction* nowFunction)
-    : rateLimit(rateLimit), nowFunction(nowFunction)
-    , currentWindowStart(std::numeric_limits<decltype(currentWindowStart)>::lowest())
+    : RequestRateTracker(rateLimit, NumaTopology::singleNode(), 1, nowFunction)
+{
+}
+
+RequestRateTracker::RequestRateTracker(RequestRate rateLimit, const NumaTopology& topology,
+    unsigned shardsPerNode, NowFunction* nowFunction)
+    : rateLimit(rateLimit)
+    , counterBits(0)
+    , windowAlignment(WindowAlignment::Global)
+    , clientLimit(rateLimit.num)
+    , retryJitter(0)
+    , topology(topology)
+    , prefixStates(nullptr)
+    , exemptClients(nullptr)
+    , trackedClients(nullptr)
+    , blockedClients(nullptr)
+    , globalBudget(nullptr)
+    , subnetBudgets(nullptr)
+    , tenantBudgets(nullptr)
+    , priorityCapacity(nullptr)
+    , calendarQuotas(nullptr)
+    , fairCapacity(0)
+    , nextFairShard(0)
+    , demandBucketWidth(1)
+    , nowFunction(nowFunction)
 {
     appStartTime = nowFunction();
+
+    // Saturating counter never exceeds rateLimit.num. Window start is stored
+    // modulo 2^(32 - counterBits), which is unambiguous while stored windows
+    // are younger than 3 periods, so leave a margin of one more period.
+    unsigned bits = 1;
+    while (bits < 32 && ((uint64_t)1 << bits) <= (uint64_t)std::max(rateLimit.num, 0))
+        bits++;
+    if (bits <= 24 && ((uint64_t)1 << (32 - bits)) >= 4 * (uint64_t)rateLimit.period)
+        counterBits = bits;
+
+    unsigned nodes = topology.nodeCount();
+    size_t shardCount = (size_t)nodes * (shardsPerNode > 0 ? shardsPerNode : 1);
+    shards.reserve(shardCount);
+    for (size_t i = 0; i < shardCount; i++) {
+        unsigned node = (unsigned)(i % nodes);
+        void* memory = topology.allocate(sizeof(Shard), alignof(Shard), node);
+        shards.push_back(new (memory) Shard(topology, node));
+    }
 }
 
 RequestRateTracker::~RequestRateTracker()
 {
+    for (Shard* shard : shards) {
+        unsigned node = shard->node;
+        shard->~Shard();
+        topology.deallocate(shard, sizeof(Shard), alignof(Shard), node);
+    }
 }
 
 RequestRate::Seconds RequestRateTracker::addRequest(HTTPClientID client)
@@ -26,40 +71,244 @@ RequestRate::Seconds RequestRateTracker::addRequest(HTTPClientID client)
     /// will be rate-limited.
     /// The return is a number of seconds to wait before a request is
     /// allowed or 0 if current request is within preset rate limit.
+    /// If retry jitter is set, the wait time may exceed the remaining
+    /// time of the client's window by up to the jitter.
+    /// Requests of exempt clients and subnets are always allowed and
+    /// requests of blocked clients and subnets are always denied for
+    /// a whole period, whether or not the client was added (see
+    /// setExemptClients(), setBlockedClients() and setSubnetState()).
+    /// If the limit of the client's subnet, tenant, the global limit or
+    /// a calendar quota of the client is reached, the request is denied
+    /// until the end of that limit's period.
+{
+    return addRequest(resolveClient(client));
+}
+
+RequestRate::Seconds RequestRateTracker::addRequest(const ClientHandle& client)
+    /// Same as addRequest(client.id) with the client's hash taken from
+    /// the handle.
+{
+    return addRequest(client, Priority::Normal);
+}
+
+RequestRate::Seconds RequestRateTracker::addRequest(HTTPClientID client, Priority priority)
+    /// Same as addRequest(client) for a request of the priority class.
+    /// Requests without a priority are of the normal class.
+{
+    return addRequest(resolveClient(client), priority);
+}
+
+RequestRate::Seconds RequestRateTracker::addRequest(const ClientHandle& client,
+    Priority priority)
 {
-    auto now = nowFunction();
-    auto sinceStart = std::chrono::duration_cast<std::chrono::seconds>(now - appStartTime);
-    RequestRate::Seconds secSinceStart = (RequestRate::Seconds)sinceStart.count();
+    switch (listedAdmission(client.id)) {
+    case Admission::Allowed:
+        return 0;
+    case Admission::Denied:
+        return rateLimit.period;
+    default:
+        break;
+    }
+
+    const ClientAllowlist* tracked = trackedClients.load(std::memory_order_acquire);
+    const bool isListed = (tracked != nullptr && tracked->contains(client.id));
+
+    RequestRate::Seconds secSinceStart = secondsSinceStart();
     RequestRate::Seconds waitTime = 0;
+    const int limit = clientLimit.load(std::memory_order_relaxed);
+    Shard& shard = shardOf(client);
+    bool isLocal = (shard.node == topology.currentNode());
     {
-        Mutex::ScopedLock lock(requestCountsMutex);
+        std::lock_guard<std::mutex> lock(shard.mutex);
 
-        if (!clients.empty() 
-            && (clients.find(client) == clients.end())) {
+        if (!isListed && (tracked != nullptr || !shard.clients.empty())
+            && (shard.clients.find(client.id) == shard.clients.end())) {
                 return 0;
         }
-        if (secSinceStart >= currentWindowStart &&
-            secSinceStart < (currentWindowStart + rateLimit.period))
+        if (isLocal)
+            shard.localRequests++;
+        else
+            shard.crossNodeRequests++;
+
+        if (!shard.shadowLimits.empty())
+            evaluateShadowLimits(shard, client, secSinceStart);
+
+        if (secSinceStart < shard.currentWindowStart ||
+            secSinceStart >= (shard.currentWindowStart + rateLimit.period))
         {
-            // Request was made within the current window
-            int& requestCount = requestCounts[client];
-            if (requestCount < rateLimit.num) {
-                requestCount++;
-            }
-            else {
-                waitTime = rateLimit.period - (secSinceStart - currentWindowStart);
-            }
+            // Request was made beyond the current window or this is the first request.
+            reclaimExpiredWindows(shard, secSinceStart);
+            shard.currentWindowStart = secSinceStart - (secSinceStart % rateLimit.period);
+        }
+
+        WindowSlot slot = findOrInsertWindow(shard, client);
+        if (!slot) {
+            // No room to track the client: let the request through
+            shard.overflowRequests++;
+            return 0;
+        }
+        ClientWindow window = loadWindow(slot, secSinceStart);
+        if (window.count == 0 || secSinceStart >= (window.start + rateLimit.period)) {
+            // First request of the client or its previous window has ended
+            window.start = windowStartFor(client, secSinceStart);
+            window.count = 0;
+            shard.lastWindowEnd = std::max(shard.lastWindowEnd, window.start + rateLimit.period);
+        }
+        if (window.count >= limit) {
+            waitTime = rateLimit.period - (secSinceStart - window.start)
+                + retryJitterFor(client.id, window.start);
         }
         else {
-            // Request was made beyond the current window or this is the first request.
-            requestCounts.clear();
-            currentWindowStart = secSinceStart - (secSinceStart % rateLimit.period);
-            requestCounts[client] = 1;
+            waitTime = debitSharedBudgets(client.id, priority, secSinceStart);
+            if (waitTime == 0)
+                window.count++;
+            else
+                waitTime += retryJitterFor(client.id, window.start);
         }
+        storeWindow(slot, window);
     }
     return waitTime;
 }
 
+RequestRateTracker::Admission RequestRateTracker::admissionOf(HTTPClientID client) const
+    /// Tells whether requests of the client are decided by its limit or
+    /// always allowed or denied, by the same checks as addRequest() makes
+    /// before it counts a request. Limiters which keep the counts of
+    /// clients elsewhere (see StoreRateLimiter) make these checks first.
+{
+    Admission admission = listedAdmission(client);
+    if (admission != Admission::Counted)
+        return admission;
+
+    const ClientAllowlist* tracked = trackedClients.load(std::memory_order_acquire);
+    if (tracked != nullptr && tracked->contains(client))
+        return Admission::Counted;
+    Shard& shard = shardOf(resolveClient(client));
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if ((tracked != nullptr || !shard.clients.empty())
+        && (shard.clients.find(client) == shard.clients.end()))
+    {
+        return Admission::Allowed;
+    }
+    return Admission::Counted;
+}
+
+RequestRate::Seconds RequestRateTracker::debitSharedLimits(HTTPClientID client,
+    Priority priority)
+    /// Counts a request which the client's limit allows, when the client's
+    /// count is kept elsewhere, in the limits shared with other clients:
+    /// the subnet, tenant and global limits, the capacity of the priority
+    /// class and the calendar quotas. The return is 0 if all of them allow
+    /// the request, or the time until the denying limit's period ends; the
+    /// request is then counted by none of them.
+{
+    return debitSharedBudgets(client, priority, secondsSinceStart());
+}
+
+RequestRate::Seconds RequestRateTracker::secondsSinceStart() const
+{
+    auto sinceStart = std::chrono::duration_cast<std::chrono::seconds>(
+        nowFunction() - appStartTime);
+    return (RequestRate::Seconds)sinceStart.count();
+}
+
+RequestRateTracker::Admission RequestRateTracker::listedAdmission(HTTPClientID client) const
+    /// Admission by the exempt and blocked clients and the subnet states;
+    /// Counted if none of them decides requests of the client.
+{
+    const ClientAllowlist* exempt = exemptClients.load(std::memory_order_acquire);
+    if (exempt != nullptr && exempt->contains(client))
+        return Admission::Allowed;
+
+    const ClientAllowlist* blocked = blockedClients.load(std::memory_order_acquire);
+    if (blocked != nullptr && blocked->contains(client))
+        return Admission::Denied;
+
+    const Ipv4PrefixMap* prefixes = prefixStates.load(std::memory_order_acquire);
+    if (prefixes != nullptr) {
+        switch (prefixes->stateOf(client)) {
+        case Ipv4PrefixMap::State::Exempt:
+            return Admission::Allowed;
+        case Ipv4PrefixMap::State::Blocked:
+            return Admission::Denied;
+        default:
+            break;
+        }
+    }
+    return Admission::Counted;
+}
+
+RequestRate::Seconds RequestRateTracker::debitSharedBudgets(HTTPClientID client,
+    Priority priority, RequestRate::Seconds secSinceStart)
+    /// Counts the request in the budgets of the client's subnet, its tenant,
+    /// the global budget, the capacity of its priority class and the
+    /// client's calendar quotas, in this order. If one of them denies it,
+    /// the budgets counted so far are credited back and the return is the
+    /// time until the denying budget's period ends. Otherwise the return
+    /// is 0.
+{
+    SubnetBudgets* subnets = subnetBudgets.load(std::memory_order_acquire);
+    if (subnets != nullptr && !subnets->tryAcquire(client, secSinceStart))
+        return (RequestRate::Seconds)subnets->periodEnd(secSinceStart) - secSinceStart;
+
+    GlobalRequestBudget* tenant = nullptr;
+    const TenantBudgets* tenants = tenantBudgets.load(std::memory_order_acquire);
+    if (tenants != nullptr) {
+        int index = tenants->tenants.tenantOf(client);
+        if (index >= 0)
+            tenant = tenants->budgets[index].get();
+    }
+    if (tenant != nullptr && !tenant->tryAcquire(secSinceStart)) {
+        if (subnets != nullptr)
+            subnets->release(client, secSinceStart);
+        return (RequestRate::Seconds)tenant->periodEnd(secSinceStart) - secSinceStart;
+    }
+
+    GlobalRequestBudget* global = globalBudget.load(std::memory_order_acquire);
+    if (global != nullptr && !global->tryAcquire(secSinceStart)) {
+        if (tenant != nullptr)
+            tenant->release(secSinceStart);
+        if (subnets != nullptr)
+            subnets->release(client, secSinceStart);
+        return (RequestRate::Seconds)global->periodEnd(secSinceStart) - secSinceStart;
+    }
+
+    PriorityCapacity* classes = priorityCapacity.load(std::memory_order_acquire);
+    if (classes != nullptr && !classes->tryAcquire(priority, secSinceStart)) {
+        if (global != nullptr)
+            global->release(secSinceStart);
+        if (tenant != nullptr)
+            tenant->release(secSinceStart);
+        if (subnets != nullptr)
+            subnets->release(client, secSinceStart);
+        return (RequestRate::Seconds)classes->periodEnd(secSinceStart) - secSinceStart;
+    }
+
+    CalendarQuotas* quotas = calendarQuotas.load(std::memory_order_acquire);
+    if (quotas != nullptr) {
+        CalendarQuotas::Seconds untilReset = quotas->tryAcquire(client);
+        if (untilReset > 0) {
+            if (classes != nullptr)
+                classes->release(priority, secSinceStart);
+            if (global != nullptr)
+                global->release(secSinceStart);
+            if (tenant != nullptr)
+                tenant->release(secSinceStart);
+            if (subnets != nullptr)
+                subnets->release(client, secSinceStart);
+            return (RequestRate::Seconds)untilReset;
+        }
+    }
+    return 0;
+}
+
+RequestRateTracker::ClientHandle RequestRateTracker::resolveClient(HTTPClientID client) const
+    /// Returns handle of the client for addRequest(). Handles are valid
+    /// for the tracker which has resolved them.
+{
+    return ClientHandle{ client, hashClientId(client) };
+}
+
 RequestRateTracker::HTTPClientID RequestRateTracker::getClientId(
     const std::string& clientAddressStr)
     /// Creates unique integer client ID based on its IP address.
@@ -82,14 +331,823 @@ RequestRateTracker::HTTPClientID RequestRateTracker::getClientId(
 
 size_t RequestRateTracker::size() const
 {
-    Mutex::ScopedLock lock(requestCountsMutex);
-
-    return requestCounts.size();
+    size_t total = 0;
+    for (const Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (shard->packedCounts)
+            total += shard->packedCounts->size();
+        else if (shard->fixedCounts)
+            total += shard->fixedCounts->size();
+        else
+            total += shard->requestCounts().size();
+    }
+    return total;
 }
 
 void RequestRateTracker::addClient(HTTPClientID id)
 {
-    Mutex::ScopedLock lock(requestCountsMutex);
-    if (id != 0)
-        clients.emplace(id);
+    if (id == 0)
+        return;
+    for (Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->clients.emplace(id);
+    }
+}
+
+void RequestRateTracker::setWindowAlignment(WindowAlignment alignment)
+    /// Changes how windows of clients are aligned. Windows which are
+    /// already open are not affected.
+{
+    windowAlignment = alignment;
+}
+
+RequestRateTracker::WindowAlignment RequestRateTracker::getWindowAlignment() const
+{
+    return windowAlignment;
+}
+
+void RequestRateTracker::setRetryJitter(RequestRate::Seconds maxJitter)
+    /// Sets maximum number of seconds added to the wait time of denied
+    /// requests. Jitter is derived from the client ID and its window, so
+    /// a client is given the same retry time for all its denied requests
+    /// within a window, while different clients are given different ones.
+{
+    retryJitter = (maxJitter > 0) ? maxJitter : 0;
+}
+
+RequestRate::Seconds RequestRateTracker::retryJitterFor(HTTPClientID client,
+    RequestRate::Seconds windowStart) const
+{
+    RequestRate::Seconds maxJitter = retryJitter;
+    if (maxJitter == 0)
+        return 0;
+    uint32_t h = (uint32_t)hashClientId(client ^ ((uint32_t)windowStart * 0x9E3779B9u));
+    return (RequestRate::Seconds)(h % ((uint32_t)maxJitter + 1));
+}
+
+RequestRate::Seconds RequestRateTracker::windowStartFor(const ClientHandle& client,
+    RequestRate::Seconds secSinceStart) const
+    /// Returns start of the client's window which includes secSinceStart.
+{
+    return windowStartFor(client, secSinceStart, rateLimit.period, windowAlignment);
+}
+
+RequestRate::Seconds RequestRateTracker::windowStartFor(const ClientHandle& client,
+    RequestRate::Seconds secSinceStart, RequestRate::Seconds period,
+    WindowAlignment alignment)
+    /// Returns start of the client's window of the period and alignment
+    /// which includes secSinceStart.
+{
+    switch (alignment) {
+    case WindowAlignment::ClientHash: {
+        RequestRate::Seconds phase = (uint32_t)client.hash % period;
+        RequestRate::Seconds offset = (secSinceStart - phase) % period;
+        if (offset < 0)
+            offset += period;
+        return secSinceStart - offset;
+    }
+    case WindowAlignment::FirstRequest:
+        return secSinceStart;
+    case WindowAlignment::Global:
+    default:
+        return secSinceStart - (secSinceStart % period);
+    }
+}
+
+void RequestRateTracker::reclaimExpiredWindows(Shard& shard,
+    RequestRate::Seconds secSinceStart)
+    /// Removes counters of the shard's clients whose windows ended before
+    /// secSinceStart. With the global alignment this removes all counters.
+    /// Growable tables are not erased from: surviving counters are copied
+    /// to the spare arena and the active arena is released at once.
+    /// Shard's mutex must be locked.
+{
+    if (!shard.shadowWindows.empty())
+        reclaimExpiredShadowWindows(shard, secSinceStart);
+
+    if (shard.packedCounts) {
+        // Stored window starts are only unambiguous for recent windows
+        if (secSinceStart >= shard.lastWindowEnd) {
+            shard.packedCounts->clear();
+            return;
+        }
+        shard.packedCounts->eraseIf([&](uint32_t packed) {
+            ClientWindow window = unpackWindow(packed, secSinceStart);
+            return secSinceStart >= (window.start + rateLimit.period);
+        });
+        return;
+    }
+    if (shard.fixedCounts) {
+        shard.fixedCounts->eraseIf([&](const ClientWindow& window) {
+            return secSinceStart >= (window.start + rateLimit.period);
+        });
+        return;
+    }
+
+    CountArena& active = shard.arenas[shard.activeArena];
+    CountArena& spare = shard.arenas[1 - shard.activeArena];
+    if (secSinceStart >= shard.lastWindowEnd) {
+        // All windows have ended, nothing to copy
+        active.reset(active.table()->size());
+        return;
+    }
+    spare.reset(active.table()->size());
+    for (const auto& entry : *active.table()) {
+        if (secSinceStart < (entry.second.start + rateLimit.period))
+            spare.table()->emplace(entry);
+    }
+    active.release();
+    shard.activeArena = 1 - shard.activeArena;
+}
+
+void RequestRateTracker::evaluateShadowLimits(Shard& shard, const ClientHandle& client,
+    RequestRate::Seconds secSinceStart) const
+    /// Counts the request for every shadow limit of the shard, as the real
+    /// limit would, and records the requests the limits would deny.
+    /// Shard's mutex must be locked.
+{
+    ShadowWindows& shadows = shard.shadowWindows[client];
+    for (size_t i = 0; i < shard.shadowLimits.size(); i++) {
+        const ShadowLimit& limit = shard.shadowLimits[i];
+        ShadowStats& stats = shard.shadowStats[i];
+        ClientWindow& window = shadows.windows[i];
+        const uint8_t bit = (uint8_t)(1u << i);
+        stats.requests++;
+        if (window.count == 0 || secSinceStart >= (window.start + limit.rateLimit.period)) {
+            window.start = windowStartFor(client, secSinceStart,
+                limit.rateLimit.period, limit.alignment);
+            window.count = 0;
+            shadows.deniedMask &= (uint8_t)~bit;
+        }
+        if (window.count < limit.rateLimit.num) {
+            window.count++;
+            continue;
+        }
+        stats.wouldDeny++;
+        if ((shadows.deniedMask & bit) == 0) {
+            shadows.deniedMask |= bit;
+            stats.affectedClients++;
+            if (stats.sampleClients.size() < maxShadowSamples)
+                stats.sampleClients.push_back(client.id);
+        }
+    }
+}
+
+void RequestRateTracker::reclaimExpiredShadowWindows(Shard& shard,
+    RequestRate::Seconds secSinceStart) const
+    /// Removes shadow windows of clients whose windows have ended for all
+    /// shadow limits. Shard's mutex must be locked.
+{
+    for (auto it = shard.shadowWindows.begin(); it != shard.shadowWindows.end();) {
+        bool expired = true;
+        for (size_t i = 0; i < shard.shadowLimits.size() && expired; i++) {
+            const ClientWindow& window = it->second.windows[i];
+            expired = secSinceStart >= window.start + shard.shadowLimits[i].rateLimit.period;
+        }
+        it = expired ? shard.shadowWindows.erase(it) : std::next(it);
+    }
+}
+
+RequestRateTracker::WindowSlot RequestRateTracker::findOrInsertWindow(
+    Shard& shard, const ClientHandle& client)
+    /// Returns location of the client's window, which is zero-filled for
+    /// a new client, or an empty slot if the shard has no room for a new
+    /// client. Shard's mutex must be locked.
+{
+    WindowSlot slot = { nullptr, nullptr };
+    if (shard.packedCounts)
+        slot.packed = shard.packedCounts->findOrInsert(client.id, client.hash);
+    else if (shard.fixedCounts)
+        slot.wide = shard.fixedCounts->findOrInsert(client.id, client.hash);
+    else
+        slot.wide = &shard.requestCounts()[client.id];
+    return slot;
+}
+
+RequestRateTracker::ClientWindow RequestRateTracker::loadWindow(const WindowSlot& slot,
+    RequestRate::Seconds secSinceStart) const
+{
+    return slot.packed ? unpackWindow(*slot.packed, secSinceStart) : *slot.wide;
+}
+
+void RequestRateTracker::storeWindow(const WindowSlot& slot, const ClientWindow& window) const
+{
+    if (slot.packed)
+        *slot.packed = packWindow(window);
+    else
+        *slot.wide = window;
+}
+
+uint32_t RequestRateTracker::packWindow(const ClientWindow& window) const
+    /// Packs counter into the low counterBits and window start modulo
+    /// 2^(32 - counterBits) into the high bits.
+{
+    return ((uint32_t)window.start << counterBits) | (uint32_t)window.count;
+}
+
+RequestRateTracker::ClientWindow RequestRateTracker::unpackWindow(
+    uint32_t packed, RequestRate::Seconds secSinceStart) const
+    /// Restores window start as the latest time not after secSinceStart
+    /// which matches the stored bits.
+{
+    const uint32_t epochMask = 0xFFFFFFFFu >> counterBits;
+    ClientWindow window;
+    window.count = (int)(packed & ((1u << counterBits) - 1));
+    uint32_t age = ((uint32_t)secSinceStart - (packed >> counterBits)) & epochMask;
+    window.start = secSinceStart - (RequestRate::Seconds)age;
+    return window;
+}
+
+void RequestRateTracker::setFixedCapacity(size_t maxClients, bool hugePages)
+    /// Replaces counters of all shards with fixed-capacity tables which
+    /// can hold maxClients in total. The capacity is divided between shards
+    /// with 1/8 headroom for uneven spread of clients. Tables are placed
+    /// on the node of their shard and backed by huge pages if hugePages is
+    /// true and huge pages are available. Counters accumulated so far are
+    /// discarded and the arenas of growable tables are released, so this
+    /// should be called before requests are tracked.
+    /// Requests of new clients are not rate-limited while their shard is
+    /// full (see overflowRequests()).
+{
+    size_t perShard = (maxClients + shards.size() - 1) / shards.size();
+    perShard += perShard / 8;
+    for (Shard* shard : shards) {
+        std::unique_ptr<FixedClientTable<uint32_t>> packedTable;
+        std::unique_ptr<FixedClientTable<ClientWindow>> wideTable;
+        if (counterBits > 0)
+            packedTable.reset(new FixedClientTable<uint32_t>(perShard, hugePages,
+                (int)shard->node, clientHash));
+        else
+            wideTable.reset(new FixedClientTable<ClientWindow>(perShard, hugePages,
+                (int)shard->node, clientHash));
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        // Growable tables are not used again: their memory goes back to the
+        // node rather than staying in the arena, which clear() would leave
+        for (CountArena& arena : shard->arenas)
+            arena.release();
+        shard->packedCounts = std::move(packedTable);
+        shard->fixedCounts = std::move(wideTable);
+    }
+}
+
+PageRegion::PageKind RequestRateTracker::pageKind() const
+    /// Returns kind of pages backing the counters. Default pages are reported
+    /// if any of the shards has fallen back to them.
+{
+    PageRegion::PageKind kind = PageRegion::PageKind::Huge;
+    for (const Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        PageRegion::PageKind shardKind = PageRegion::PageKind::Default;
+        if (shard->packedCounts)
+            shardKind = shard->packedCounts->pageKind();
+        else if (shard->fixedCounts)
+            shardKind = shard->fixedCounts->pageKind();
+        if (shardKind < kind)
+            kind = shardKind;
+    }
+    return kind;
+}
+
+size_t RequestRateTracker::bytesPerClient() const
+    /// Returns memory taken by a tracked client: the slot size for
+    /// fixed-capacity tables, or an estimate of the node and bucket size
+    /// for growable tables. Fixed-capacity tables also reserve free slots
+    /// to keep load factor under 7/8.
+{
+    std::lock_guard<std::mutex> lock(shards.front()->mutex);
+    if (shards.front()->packedCounts)
+        return FixedClientTable<uint32_t>::slotSize();
+    if (shards.front()->fixedCounts)
+        return FixedClientTable<ClientWindow>::slotSize();
+    // Node: next pointer, key and window; plus one bucket pointer per node
+    return sizeof(void*) + sizeof(RequestCountHashTable::value_type) + sizeof(void*);
+}
+
+bool RequestRateTracker::setSubnetState(HTTPClientID subnet, unsigned prefixLength,
+    Ipv4PrefixMap::State state)
+    /// Exempts, blocks or tracks again all clients of the IPv4 subnet,
+    /// e.g. setSubnetState(0x0A000000, 8, Exempt) for 10.0.0.0/8. Prefixes
+    /// longer than /24 are not supported: the return is false for them.
+    /// Counters of already tracked clients of the subnet are kept until
+    /// their windows expire. May be called while requests are tracked.
+{
+    std::lock_guard<std::mutex> lock(prefixMutex);
+    if (prefixLength > 24)
+        return false;
+    if (!prefixMap) {
+        prefixMap.reset(new Ipv4PrefixMap());
+        prefixStates.store(prefixMap.get(), std::memory_order_release);
+    }
+    return prefixMap->setState(subnet, prefixLength, state);
+}
+
+void RequestRateTracker::setExemptClients(const ClientAllowlist& allowlist)
+    /// Atomically replaces the list of exempt prefixes with a copy of
+    /// allowlist. Requests of exempt clients are allowed without being
+    /// counted and without locking. May be called while requests are
+    /// tracked; each replaced list takes memory until the tracker is
+    /// destroyed, so it is intended for infrequent reloads.
+{
+    std::lock_guard<std::mutex> lock(exemptMutex);
+    const ClientAllowlist* current = nullptr;
+    if (!allowlist.empty()) {
+        exemptLists.emplace_back(new ClientAllowlist(allowlist));
+        current = exemptLists.back().get();
+    }
+    exemptClients.store(current, std::memory_order_release);
+}
+
+void RequestRateTracker::setTrackedClients(ClientAllowlist clients)
+    /// Atomically replaces the list of clients to track, in addition to
+    /// the clients added with addClient(). Requests of other clients are
+    /// allowed without being counted. An empty list removes the list.
+    /// Pass large lists with std::move: the list is kept as it is, and
+    /// each replaced list takes memory until the tracker is destroyed.
+{
+    std::lock_guard<std::mutex> lock(clientListsMutex);
+    const ClientAllowlist* current = nullptr;
+    if (!clients.empty()) {
+        clientLists.emplace_back(new ClientAllowlist(std::move(clients)));
+        current = clientLists.back().get();
+    }
+    trackedClients.store(current, std::memory_order_release);
+}
+
+void RequestRateTracker::setBlockedClients(ClientAllowlist clients)
+    /// Atomically replaces the list of blocked clients. Their requests are
+    /// denied for a whole period without being counted, unless the client
+    /// is exempt. Prefixes of any length may be blocked, unlike with
+    /// setSubnetState(). Lists are kept like with setTrackedClients().
+{
+    std::lock_guard<std::mutex> lock(clientListsMutex);
+    const ClientAllowlist* current = nullptr;
+    if (!clients.empty()) {
+        clientLists.emplace_back(new ClientAllowlist(std::move(clients)));
+        current = clientLists.back().get();
+    }
+    blockedClients.store(current, std::memory_order_release);
+}
+
+void RequestRateTracker::setGlobalLimit(RequestRate globalLimit, unsigned slices)
+    /// Limits the total number of requests of all tracked clients to
+    /// globalLimit.num per globalLimit.period, counted in windows aligned
+    /// to multiples of the period. A limit with num or period <= 0 removes
+    /// the global limit. The count is split into slices (one per hardware
+    /// thread if slices is 0) which claim requests from the total in
+    /// batches, so the limit is never exceeded, but some requests may be
+    /// denied while other slices still hold claimed requests (see
+    /// GlobalRequestBudget). May be called while requests are tracked;
+    /// the new limit starts with an empty count.
+{
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    GlobalRequestBudget* current = nullptr;
+    if (globalLimit.num > 0 && globalLimit.period > 0) {
+        globalBudgets.emplace_back(
+            new GlobalRequestBudget(globalLimit.num, globalLimit.period, slices));
+        current = globalBudgets.back().get();
+    }
+    globalBudget.store(current, std::memory_order_release);
+}
+
+RequestRate RequestRateTracker::getGlobalLimit() const
+    /// Returns the global limit, or { 0, 0 } if there is none.
+{
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    const GlobalRequestBudget* current = globalBudget.load(std::memory_order_relaxed);
+    if (current == nullptr)
+        return RequestRate{ 0, 0 };
+    return RequestRate{ (int)current->limit(), (RequestRate::Seconds)current->period() };
+}
+
+bool RequestRateTracker::setSubnetLimit(RequestRate subnetLimit)
+    /// Limits requests of all tracked clients of each /24 subnet together
+    /// to subnetLimit.num per subnetLimit.period, counted in windows
+    /// aligned to multiples of the period. A limit with num or period <= 0
+    /// removes the subnet limit. The return is false if num is larger than
+    /// SubnetBudgets::maxLimit. May be called while requests are tracked;
+    /// the new limit starts with empty counts. Each limit reserves 64 MiB
+    /// of address space until the tracker is destroyed, so it is intended
+    /// for infrequent changes.
+{
+    if (subnetLimit.num > SubnetBudgets::maxLimit)
+        return false;
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    SubnetBudgets* current = nullptr;
+    if (subnetLimit.num > 0 && subnetLimit.period > 0) {
+        subnetBudgetSets.emplace_back(new SubnetBudgets(subnetLimit.num, subnetLimit.period));
+        current = subnetBudgetSets.back().get();
+    }
+    subnetBudgets.store(current, std::memory_order_release);
+    return true;
+}
+
+RequestRate RequestRateTracker::getSubnetLimit() const
+    /// Returns the subnet limit, or { 0, 0 } if there is none.
+{
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    const SubnetBudgets* current = subnetBudgets.load(std::memory_order_relaxed);
+    if (current == nullptr)
+        return RequestRate{ 0, 0 };
+    return RequestRate{ (int)current->limit(), (RequestRate::Seconds)current->period() };
+}
+
+void RequestRateTracker::setTenantLimits(const TenantLimits& tenants)
+    /// Replaces tenants and their limits with a copy of tenants. Requests
+    /// of clients which do not belong to any tenant are not limited at the
+    /// tenant level. Budgets of tenants are sliced like the global budget
+    /// (see setGlobalLimit()). May be called while requests are tracked;
+    /// the new limits start with empty counts.
+{
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    TenantBudgets* current = nullptr;
+    if (tenants.size() > 0) {
+        tenantBudgetSets.emplace_back(new TenantBudgets(tenants));
+        current = tenantBudgetSets.back().get();
+    }
+    tenantBudgets.store(current, std::memory_order_release);
+}
+
+void RequestRateTracker::setFairCapacity(int capacity)
+    /// Enables the fair sharing mode with capacity requests per rate limit
+    /// period shared by all active clients, or disables it if capacity
+    /// is <= 0. The client limit stays rateLimit.num until the first
+    /// updateFairShare(), and it never exceeds rateLimit.num.
+{
+    std::lock_guard<std::mutex> lock(fairMutex);
+    fairCapacity = (capacity > 0) ? capacity : 0;
+    // Exact counts for limits up to 1024, fewer buckets for larger ones
+    const int buckets = std::min(std::max(rateLimit.num, 1), 1024);
+    demandBucketWidth = (std::max(rateLimit.num, 1) + buckets - 1) / buckets;
+    shardDemands.assign(shards.size(), std::vector<uint32_t>(buckets + 1, 0));
+    nextFairShard = 0;
+    if (fairCapacity == 0)
+        clientLimit = rateLimit.num;
+}
+
+void RequestRateTracker::updateFairShare()
+    /// Counts the active clients of the next shard by their requests in
+    /// their current windows and recomputes the client limit from the
+    /// counts of all shards, which are at most one round of calls old.
+    /// Each call locks one shard while its counters are read, so calling
+    /// it shards.size() times per rate limit period keeps the share
+    /// current without stalling all shards at once.
+{
+    std::lock_guard<std::mutex> lock(fairMutex);
+    if (fairCapacity == 0)
+        return;
+
+    const size_t index = nextFairShard;
+    nextFairShard = (nextFairShard + 1) % shards.size();
+    const int currentLimit = clientLimit.load(std::memory_order_relaxed);
+    const RequestRate::Seconds secSinceStart = secondsSinceStart();
+    std::vector<uint32_t>& demand = shardDemands[index];
+    const size_t saturated = demand.size() - 1;
+    std::fill(demand.begin(), demand.end(), 0);
+    {
+        Shard& shard = *shards[index];
+        std::lock_guard<std::mutex> shardLock(shard.mutex);
+        forEachWindow(shard, secSinceStart, [&](HTTPClientID, const ClientWindow& window) {
+            if (window.count == 0 || secSinceStart >= window.start + rateLimit.period)
+                return;
+            if (window.count >= currentLimit)
+                demand[saturated]++;
+            else
+                demand[std::min<size_t>(window.count / demandBucketWidth, saturated - 1)]++;
+        });
+    }
+    clientLimit.store(fairShareOf(fairCapacity, currentLimit), std::memory_order_relaxed);
+}
+
+int RequestRateTracker::fairShareOf(int capacity, int currentLimit) const
+    /// Water-filling over the demand histograms: raises the share until
+    /// the requests of clients below it plus the share of every client
+    /// above it reach the capacity. Clients at the current limit may want
+    /// more, so they always take the full share. fairMutex must be locked.
+{
+    const size_t buckets = shardDemands.front().size();
+    std::vector<uint64_t> clients(buckets, 0);
+    for (const std::vector<uint32_t>& demand : shardDemands) {
+        for (size_t b = 0; b < buckets; b++)
+            clients[b] += demand[b];
+    }
+    uint64_t remainingClients = 0;
+    for (uint64_t n : clients)
+        remainingClients += n;
+
+    uint64_t satisfied = 0;
+    for (size_t b = 0; b + 1 < buckets && remainingClients > 0; b++) {
+        // Highest count of the bucket, so that the share is not overestimated
+        const uint64_t demand = (uint64_t)(b + 1) * demandBucketWidth - 1;
+        if (demand >= (uint64_t)currentLimit
+            || satisfied + demand * remainingClients >= (uint64_t)capacity)
+        {
+            break;
+        }
+        satisfied += demand * clients[b];
+        remainingClients -= clients[b];
+    }
+    if (remainingClients == 0)
+        return rateLimit.num;
+    uint64_t share = ((uint64_t)capacity > satisfied)
+        ? ((uint64_t)capacity - satisfied) / remainingClients : 0;
+    return (int)std::min<uint64_t>(std::max<uint64_t>(share, 1), (uint64_t)rateLimit.num);
+}
+
+int RequestRateTracker::getClientLimit() const
+    /// Returns the number of requests currently allowed per client and
+    /// period: rateLimit.num, or the fair share if it is lower.
+{
+    return clientLimit.load(std::memory_order_relaxed);
+}
+
+bool RequestRateTracker::setPriorityCapacity(const PriorityCapacity::Reservations& reserved,
+    RequestRate::Seconds period)
+    /// Sets capacity per period shared by the priority classes as the
+    /// requests reserved for each class (indexed by Priority). Reservations
+    /// of all 0 remove the priority limit. The return is false if the
+    /// reservations together exceed PriorityCapacity::maxCapacity or the
+    /// period is not positive. May be called while requests are tracked;
+    /// the new capacity starts with empty counts.
+{
+    int64_t total = 0;
+    for (int64_t r : reserved)
+        total += std::max<int64_t>(r, 0);
+    if (total > PriorityCapacity::maxCapacity || period <= 0)
+        return false;
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    PriorityCapacity* current = nullptr;
+    if (total > 0) {
+        priorityCapacities.emplace_back(new PriorityCapacity(reserved, period));
+        current = priorityCapacities.back().get();
+    }
+    priorityCapacity.store(current, std::memory_order_release);
+    return true;
+}
+
+void RequestRateTracker::setAvailableCapacity(int capacity)
+    /// Lowers the capacity shared by the priority classes to shed load, or
+    /// restores it. Capacity is taken from the reservation of the bulk
+    /// class first and of the critical class last. It cannot be raised
+    /// above the sum of the reservations.
+{
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    PriorityCapacity* current = priorityCapacity.load(std::memory_order_relaxed);
+    if (current != nullptr)
+        current->setCapacity(capacity);
+}
+
+void RequestRateTracker::setCalendarQuotas(std::unique_ptr<CalendarQuotas> quotas)
+    /// Replaces the calendar quotas of clients; nullptr removes them. Their
+    /// journal should be opened before they are set. Quotas which are
+    /// replaced are kept, with their journal open, until the tracker is
+    /// destroyed, so new quotas must use another journal. To change the
+    /// quotas of clients, use CalendarQuotas::setQuotas() instead.
+{
+    std::lock_guard<std::mutex> lock(limitsMutex);
+    CalendarQuotas* current = quotas.get();
+    if (quotas)
+        calendarQuotaSets.push_back(std::move(quotas));
+    calendarQuotas.store(current, std::memory_order_release);
+}
+
+CalendarQuotas* RequestRateTracker::getCalendarQuotas() const
+{
+    return calendarQuotas.load(std::memory_order_acquire);
+}
+
+bool RequestRateTracker::setShadowLimits(const std::vector<ShadowLimit>& limits)
+    /// Replaces the shadow limits, up to maxShadowLimits of them. Shadow
+    /// limits only count requests of tracked clients which reach the per-
+    /// client check: requests of exempt or blocked clients are not counted.
+    /// The return is false if there are too many limits or one of them
+    /// has a period <= 0. Counts of the previous shadow limits are
+    /// discarded. An empty vector stops the shadow evaluation.
+{
+    if (limits.size() > maxShadowLimits)
+        return false;
+    for (const ShadowLimit& limit : limits) {
+        if (limit.rateLimit.period <= 0)
+            return false;
+    }
+    for (Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->shadowWindows.clear();
+        shard->shadowLimits = limits;
+        shard->shadowStats.assign(limits.size(), ShadowStats{ 0, 0, 0, {} });
+    }
+    return true;
+}
+
+std::vector<RequestRateTracker::ShadowReport> RequestRateTracker::shadowReports() const
+    /// Returns counts of the shadow limits summed over all shards, in the
+    /// order the limits were set.
+{
+    std::vector<ShadowReport> reports;
+    for (const Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (reports.empty()) {
+            for (const ShadowLimit& limit : shard->shadowLimits)
+                reports.push_back(ShadowReport{ limit, 0, 0, 0, {} });
+        }
+        for (size_t i = 0; i < shard->shadowStats.size() && i < reports.size(); i++) {
+            const ShadowStats& stats = shard->shadowStats[i];
+            reports[i].requests += stats.requests;
+            reports[i].wouldDeny += stats.wouldDeny;
+            reports[i].affectedClients += stats.affectedClients;
+            reports[i].sampleClients.insert(reports[i].sampleClients.end(),
+                stats.sampleClients.begin(), stats.sampleClients.end());
+        }
+    }
+    return reports;
+}
+
+bool RequestRateTracker::exportState(
+    const std::function<bool(const std::vector<ClientState>&)>& write) const
+    /// Passes the open windows of all clients to write(), one shard at a
+    /// time. A shard is only locked while its windows are copied, so
+    /// requests are tracked meanwhile; windows counted after their shard
+    /// was copied are not exported. The return is false if write()
+    /// returned false, which stops the export.
+{
+    std::vector<ClientState> states;
+    for (const Shard* shard : shards) {
+        states.clear();
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            const RequestRate::Seconds secSinceStart = secondsSinceStart();
+            forEachWindow(*shard, secSinceStart, [&](HTTPClientID client,
+                const ClientWindow& window) {
+                const RequestRate::Seconds end = window.start + rateLimit.period;
+                if (window.count > 0 && secSinceStart < end)
+                    states.push_back(ClientState{ client, end - secSinceStart, window.count });
+            });
+        }
+        if (!states.empty() && !write(states))
+            return false;
+    }
+    return true;
+}
+
+size_t RequestRateTracker::importState(const std::vector<ClientState>& states)
+    /// Merges counters exported by another tracker with the same rate
+    /// limit into the tracker. A client with an open window here keeps it
+    /// and is debited the imported requests as well, up to the limit;
+    /// otherwise the imported window is taken over until its end. Only
+    /// the client's shard is locked, one client at a time, so requests are
+    /// tracked meanwhile. Clients which are not tracked, or which do not
+    /// fit in a fixed-capacity table, are skipped. The return is the number
+    /// of clients imported.
+{
+    const ClientAllowlist* tracked = trackedClients.load(std::memory_order_acquire);
+    size_t imported = 0;
+    for (const ClientState& state : states) {
+        if (state.count <= 0 || state.remaining <= 0)
+            continue;
+        const ClientHandle client = resolveClient(state.id);
+        const bool isListed = (tracked != nullptr && tracked->contains(client.id));
+        Shard& shard = shardOf(client);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!isListed && (tracked != nullptr || !shard.clients.empty())
+            && (shard.clients.find(client.id) == shard.clients.end())) {
+                continue;
+        }
+        const RequestRate::Seconds secSinceStart = secondsSinceStart();
+        WindowSlot slot = findOrInsertWindow(shard, client);
+        if (!slot)
+            continue;
+        ClientWindow window = loadWindow(slot, secSinceStart);
+        if (window.count == 0 || secSinceStart >= (window.start + rateLimit.period)) {
+            window.start = secSinceStart + std::min(state.remaining, rateLimit.period)
+                - rateLimit.period;
+            window.count = 0;
+            shard.lastWindowEnd = std::max(shard.lastWindowEnd, window.start + rateLimit.period);
+        }
+        window.count = std::min(window.count + state.count, rateLimit.num);
+        storeWindow(slot, window);
+        imported++;
+    }
+    return imported;
+}
+
+template <class Visitor>
+void RequestRateTracker::forEachWindow(const Shard& shard,
+    RequestRate::Seconds secSinceStart, Visitor visit) const
+    /// Calls visit(HTTPClientID, const ClientWindow&) for every client of
+    /// the shard. Shard's mutex must be locked.
+{
+    if (shard.packedCounts) {
+        shard.packedCounts->forEach([&](HTTPClientID client, uint32_t packed) {
+            visit(client, unpackWindow(packed, secSinceStart));
+        });
+    }
+    else if (shard.fixedCounts) {
+        shard.fixedCounts->forEach(visit);
+    }
+    else {
+        for (const auto& entry : shard.requestCounts())
+            visit(entry.first, entry.second);
+    }
+}
+
+uint64_t RequestRateTracker::overflowRequests() const
+    /// Returns number of requests which were not rate-limited because
+    /// the fixed-capacity table of the client's shard was full.
+{
+    uint64_t total = 0;
+    for (const Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->overflowRequests;
+    }
+    return total;
+}
+
+RequestRateTracker::CountArena::CountArena(std::pmr::memory_resource* upstream)
+    : resource(upstream), counts(nullptr)
+{
+}
+
+void RequestRateTracker::CountArena::reset(size_t expectedClients)
+{
+    release();
+    void* memory = resource.allocate(sizeof(RequestCountHashTable),
+        alignof(RequestCountHashTable));
+    counts = new (memory) RequestCountHashTable(&resource);
+    counts->reserve(expectedClients);
+}
+
+void RequestRateTracker::CountArena::release()
+{
+    // The table is dropped without its destructor: all its memory,
+    // including the table object itself, belongs to the arena.
+    counts = nullptr;
+    resource.release();
+}
+
+RequestRateTracker::TenantBudgets::TenantBudgets(const TenantLimits& tenants)
+    : tenants(tenants)
+{
+    budgets.reserve(tenants.size());
+    for (size_t i = 0; i < tenants.size(); i++) {
+        const TenantLimits::Limit& limit = tenants.limitOf(i);
+        budgets.emplace_back(new GlobalRequestBudget(limit.requests, limit.period));
+    }
+}
+
+RequestRateTracker::Shard::Shard(const NumaTopology& topology, unsigned node)
+    : currentWindowStart(std::numeric_limits<decltype(currentWindowStart)>::lowest())
+    , lastWindowEnd(std::numeric_limits<decltype(lastWindowEnd)>::lowest())
+    , nodeMemory(topology, node)
+    , arenas{ { &nodeMemory }, { &nodeMemory } }
+    , activeArena(0)
+    , clientsPool(&nodeMemory)
+    , clients(&clientsPool)
+    , node(node)
+    , localRequests(0)
+    , crossNodeRequests(0)
+    , overflowRequests(0)
+    , shadowPool(&nodeMemory)
+    , shadowWindows(&shadowPool)
+{
+    arenas[activeArena].reset(0);
+}
+
+unsigned RequestRateTracker::nodeOf(HTTPClientID client) const
+    /// Returns NUMA node which owns counters of the client.
+{
+    return shardOf(resolveClient(client)).node;
+}
+
+uint64_t RequestRateTracker::localRequests() const
+    /// Returns number of tracked requests handled by threads running on
+    /// the node of the client's shard.
+{
+    uint64_t total = 0;
+    for (const Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->localRequests;
+    }
+    return total;
+}
+
+uint64_t RequestRateTracker::crossNodeRequests() const
+    /// Returns number of tracked requests handled by threads running on
+    /// a node other than the node of the client's shard.
+{
+    uint64_t total = 0;
+    for (const Shard* shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->crossNodeRequests;
+    }
+    return total;
+}
+
+RequestRateTracker::Shard& RequestRateTracker::shardOf(const ClientHandle& client) const
+{
+    // High bits of the hash are used: low bits select the window phase
+    return *shards[KeyedClientHash::shardOfHash(client.hash, shards.size())];
+}
+
+uint64_t RequestRateTracker::hashClientId(HTTPClientID client) const
+{
+    return clientHash.hash64(client);
 }
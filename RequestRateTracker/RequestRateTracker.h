@@ -1,15 +1,28 @@
 #ifndef REQUEST_RATE_TRACKER_H
 #define REQUEST_RATE_TRACKER_H
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
-#include "Poco/Mutex.h"
-
-using Poco::Mutex;
+#include <vector>
+#include "NumaTopology.h"
+#include "FixedClientTable.h"
+#include "KeyedClientHash.h"
+#include "Ipv4PrefixMap.h"
+#include "ClientAllowlist.h"
+#include "GlobalRequestBudget.h"
+#include "SubnetBudgets.h"
+#include "TenantLimits.h"
+#include "PriorityCapacity.h"
+#include "CalendarQuotas.h"
 
 struct RequestRate
     /// Responsible for storing together parameters for http requests
@@ -38,19 +51,192 @@ class RequestRateTracker
     ///
     /// If no clients were added to the RequestRateTracker then all clients
     /// will be rate-limited.
+    ///
+    /// By default windows of all clients are aligned to multiples of the
+    /// rate limit period, so budgets of all clients are reset at the same
+    /// time. Use setWindowAlignment() to spread windows of different
+    /// clients across the period.
+    ///
+    /// Wait time returned for denied requests can be extended by a
+    /// deterministic per-client jitter (see setRetryJitter()), so clients
+    /// denied at the same time do not retry in lockstep.
+    ///
+    /// Clients are split between shards by the hash of their ID, each shard
+    /// with its own lock and counters. Shards are spread over the nodes of
+    /// the NumaTopology passed to the constructor and placed in memory of
+    /// their node. Threads which handle clients of a particular node
+    /// (see nodeOf()) should be pinned to that node; requests handled on
+    /// another node are counted by crossNodeRequests().
+    ///
+    /// Counters are kept in growable hash tables by default. When the number
+    /// of clients is known, setFixedCapacity() switches to fixed-capacity
+    /// tables which are preallocated in a single region per shard, optionally
+    /// backed by huge pages to reduce TLB misses. Fixed-capacity tables pack
+    /// client ID, counter and window start into 8 bytes per client, using
+    /// as few counter bits as the rate limit allows, unless the rate limit
+    /// is too large to be packed. They are probed Swiss-table style, with
+    /// one control byte per client compared a group at a time.
+    ///
+    /// Growable tables allocate from per-shard arenas, which are released
+    /// wholesale when the window rolls over: counters of clients whose
+    /// windows are still open are copied to a fresh arena and the previous
+    /// arena is dropped without freeing its nodes one by one.
+    ///
+    /// Whole IPv4 subnets can be exempted or blocked with setSubnetState().
+    /// Their state is looked up in a directly indexed array of /24 prefixes
+    /// before any shard is locked, so requests of such subnets never touch
+    /// the counters. Trusted prefixes of any length can be exempted with
+    /// setExemptClients(), which is checked first and may be replaced
+    /// while requests are tracked.
+    ///
+    /// Lists of millions of clients to track or to block (see
+    /// setTrackedClients() and setBlockedClients()) are meant to be loaded
+    /// with ClientListLoader and installed with a single atomic swap. They
+    /// are searched without locking, like the exempt clients.
+    ///
+    /// Besides the per-client limit, a request may be subject to limits
+    /// shared by several clients: the limit of its /24 subnet (see
+    /// setSubnetLimit()), of its tenant (see setTenantLimits()) and the
+    /// global limit on all tracked clients (see setGlobalLimit()). They
+    /// are checked in this order, only for requests within their client's
+    /// limit, and a request is counted at all levels or at none: when a
+    /// level denies it, the levels already debited are credited back.
+    /// Shared levels are lock-free or sliced, so a request touches one
+    /// word of the subnet array and one slice per tenant and global
+    /// budget in addition to its client's counter.
+    ///
+    /// In the fair sharing mode (see setFairCapacity()) the per-client
+    /// limit is lowered to the max-min fair share of a total capacity
+    /// among the clients which are active, so that light clients are
+    /// served in full and heavy clients share the rest equally. The share
+    /// is recomputed by updateFairShare(), which is meant to be called
+    /// periodically from a thread other than the request threads.
+    ///
+    /// Requests may be tagged with a priority class. Capacity shared by the
+    /// classes (see setPriorityCapacity()) is checked after all other
+    /// limits: each class has a reserved part of it and may borrow unused
+    /// reservations of lower classes, so when the capacity is lowered to
+    /// shed load, bulk requests are denied first and critical ones last.
+    ///
+    /// Daily and monthly quotas of clients by the wall clock, which survive
+    /// restarts, are set with setCalendarQuotas(). They are checked last,
+    /// so that requests denied by any other limit are never written to
+    /// the quotas' journal.
+    ///
+    /// Candidate per-client limits can be tried without enforcing them with
+    /// setShadowLimits(). Every tracked request is then also counted for
+    /// each candidate, in the same pass and under the same shard lock as
+    /// the real limit, and shadowReports() tells how many requests and
+    /// clients each candidate would have denied.
 {
 public:
     using HTTPClientID = uint32_t;
 
+    using Priority = PriorityCapacity::Priority;
+
+    enum class WindowAlignment
+        /// Defines how the start of a client's window is chosen.
+    {
+        Global,
+            /// Windows of all clients start at multiples of the period.
+        ClientHash,
+            /// Windows of a client are shifted by a phase derived from
+            /// the hash of its ID, so resets are spread across the period.
+        FirstRequest
+            /// A window starts with the first request of a client which
+            /// is not covered by its previous window.
+    };
+
+    enum class Admission
+        /// Defines how requests of a client are decided before its counter
+        /// is looked at (see admissionOf()).
+    {
+        Counted,
+            /// Requests are decided by the client's limit.
+        Allowed,
+            /// Requests are always allowed: the client or its subnet is
+            /// exempt, or the client is not tracked.
+        Denied
+            /// Requests are denied for a whole period: the client or its
+            /// subnet is blocked.
+    };
+
+    struct ClientHandle
+        /// Client ID together with its hash, as returned by resolveClient().
+        /// Callers which see many requests of the same client (e.g. on
+        /// a keep-alive connection) can keep it to skip hashing.
+    {
+        HTTPClientID    id;
+        uint64_t        hash;
+    };
+
+    struct ShadowLimit
+        /// Candidate per-client limit evaluated alongside the real one.
+    {
+        RequestRate     rateLimit;
+        WindowAlignment alignment;
+    };
+
+    struct ShadowReport
+        /// What a shadow limit would have done since it was set.
+    {
+        ShadowLimit     limit;
+        uint64_t        requests;
+            /// Requests evaluated against the limit.
+        uint64_t        wouldDeny;
+            /// Requests the limit would have denied.
+        uint64_t        affectedClients;
+            /// Number of client windows in which the limit would have
+            /// denied at least one request.
+        std::vector<HTTPClientID>
+                        sampleClients;
+            /// Some of the clients the limit would have denied, at most
+            /// maxShadowSamples per shard.
+    };
+
+    struct ClientState
+        /// Counter of a client's open window, with the end of the window
+        /// relative to now, so that it can be moved to a tracker of another
+        /// process (see exportState() and importState()).
+    {
+        HTTPClientID            id;
+        RequestRate::Seconds    remaining;
+            /// Seconds until the window ends.
+        int                     count;
+    };
+
+    static constexpr size_t maxShadowLimits = 4;
+
+    static constexpr size_t maxShadowSamples = 16;
+
     typedef std::chrono::steady_clock::time_point NowFunction();
 
     RequestRateTracker(RequestRate rateLimit,
         NowFunction* nowFunction = std::chrono::steady_clock::now);
 
+    RequestRateTracker(RequestRate rateLimit, const NumaTopology& topology,
+        unsigned shardsPerNode,
+        NowFunction* nowFunction = std::chrono::steady_clock::now);
+
+    RequestRateTracker(const RequestRateTracker&) = delete;
+    RequestRateTracker& operator=(const RequestRateTracker&) = delete;
+
     ~RequestRateTracker();
 
     RequestRate::Seconds addRequest(HTTPClientID client);
 
+    RequestRate::Seconds addRequest(const ClientHandle& client);
+
+    RequestRate::Seconds addRequest(HTTPClientID client, Priority priority);
+
+    RequestRate::Seconds addRequest(const ClientHandle& client, Priority priority);
+
+    Admission           admissionOf(HTTPClientID client) const;
+
+    RequestRate::Seconds debitSharedLimits(HTTPClientID client, Priority priority);
+
+    ClientHandle        resolveClient(HTTPClientID client) const;
+
     RequestRate         getRateLimit() const { return rateLimit; }
 
     size_t              size() const;
@@ -59,28 +245,383 @@ public:
 
     void                addClient(HTTPClientID);
 
+    void                setWindowAlignment(WindowAlignment alignment);
+
+    WindowAlignment     getWindowAlignment() const;
+
+    void                setRetryJitter(RequestRate::Seconds maxJitter);
+
+    unsigned            nodeOf(HTTPClientID client) const;
+
+    uint64_t            localRequests() const;
+
+    uint64_t            crossNodeRequests() const;
+
+    void                setFixedCapacity(size_t maxClients, bool hugePages);
+
+    PageRegion::PageKind pageKind() const;
+
+    uint64_t            overflowRequests() const;
+
+    size_t              bytesPerClient() const;
+
+    bool                setSubnetState(HTTPClientID subnet, unsigned prefixLength,
+                            Ipv4PrefixMap::State state);
+
+    void                setExemptClients(const ClientAllowlist& allowlist);
+
+    void                setTrackedClients(ClientAllowlist clients);
+
+    void                setBlockedClients(ClientAllowlist clients);
+
+    void                setGlobalLimit(RequestRate globalLimit, unsigned slices = 0);
+
+    RequestRate         getGlobalLimit() const;
+
+    bool                setSubnetLimit(RequestRate subnetLimit);
+
+    RequestRate         getSubnetLimit() const;
+
+    void                setTenantLimits(const TenantLimits& tenants);
+
+    void                setFairCapacity(int capacity);
+
+    void                updateFairShare();
+
+    int                 getClientLimit() const;
+
+    bool                setPriorityCapacity(const PriorityCapacity::Reservations& reserved,
+                            RequestRate::Seconds period);
+
+    void                setAvailableCapacity(int capacity);
+
+    void                setCalendarQuotas(std::unique_ptr<CalendarQuotas> quotas);
+
+    CalendarQuotas*     getCalendarQuotas() const;
+
+    bool                setShadowLimits(const std::vector<ShadowLimit>& limits);
+
+    std::vector<ShadowReport> shadowReports() const;
+
+    bool                exportState(
+                            const std::function<bool(const std::vector<ClientState>&)>& write) const;
+
+    size_t              importState(const std::vector<ClientState>& states);
+
 private:
+    struct Shard;
+
+    Shard&              shardOf(const ClientHandle& client) const;
+
+    RequestRate::Seconds windowStartFor(const ClientHandle& client,
+                            RequestRate::Seconds secSinceStart) const;
+
+    static RequestRate::Seconds windowStartFor(const ClientHandle& client,
+                            RequestRate::Seconds secSinceStart,
+                            RequestRate::Seconds period, WindowAlignment alignment);
+
+    struct ClientWindow;
+
+    struct WindowSlot
+        /// Location of a client's window in one of the shard's tables.
+    {
+        ClientWindow*   wide;
+        uint32_t*       packed;
+
+        explicit operator bool() const { return wide != nullptr || packed != nullptr; }
+    };
+
+    WindowSlot          findOrInsertWindow(Shard& shard, const ClientHandle& client);
+
+    ClientWindow        loadWindow(const WindowSlot& slot,
+                            RequestRate::Seconds secSinceStart) const;
+
+    void                storeWindow(const WindowSlot& slot, const ClientWindow& window) const;
+
+    uint32_t            packWindow(const ClientWindow& window) const;
+
+    ClientWindow        unpackWindow(uint32_t packed,
+                            RequestRate::Seconds secSinceStart) const;
+
+    void                reclaimExpiredWindows(Shard& shard,
+                            RequestRate::Seconds secSinceStart);
+
+    void                evaluateShadowLimits(Shard& shard, const ClientHandle& client,
+                            RequestRate::Seconds secSinceStart) const;
+
+    void                reclaimExpiredShadowWindows(Shard& shard,
+                            RequestRate::Seconds secSinceStart) const;
+
+    template <class Visitor>
+    void                forEachWindow(const Shard& shard,
+                            RequestRate::Seconds secSinceStart, Visitor visit) const;
+
+    int                 fairShareOf(int capacity, int currentLimit) const;
+
+    RequestRate::Seconds secondsSinceStart() const;
+
+    Admission           listedAdmission(HTTPClientID client) const;
+
+    RequestRate::Seconds debitSharedBudgets(HTTPClientID client, Priority priority,
+                            RequestRate::Seconds secSinceStart);
+
+    RequestRate::Seconds retryJitterFor(HTTPClientID client,
+                            RequestRate::Seconds windowStart) const;
+
+    uint64_t            hashClientId(HTTPClientID client) const;
+
     RequestRate             rateLimit;
         /// Requests arriving at the rate higher than this limit must be denied.
 
-    mutable Mutex           requestCountsMutex;
-        /// This mutex must be locked to access the following members:
-        ///     - currentWindowStart
-        ///     - requestCounts
-        ///     - clientsToTrack
+    unsigned                counterBits;
+        /// Number of low bits of a packed window which hold the counter.
+        /// The remaining bits hold the window start modulo 2^(32-counterBits).
+        /// 0 if windows for the rate limit cannot be packed.
+
+    std::atomic<WindowAlignment>
+                            windowAlignment;
+
+    std::atomic<int>        clientLimit;
+        /// Requests allowed per client and period: rateLimit.num, or the
+        /// fair share of fairCapacity if it is lower.
+
+    std::atomic<RequestRate::Seconds>
+                            retryJitter;
+        /// Maximum number of seconds added to the wait time of a denied
+        /// request. 0 disables jitter.
+
+    struct ClientWindow
+        /// Request counter of a client together with the start of the
+        /// window it accumulates requests for.
+    {
+        RequestRate::Seconds    start;
+        int                     count;
+    };
+
+    using RequestCountHashTable = 
+        std::pmr::unordered_map<HTTPClientID, ClientWindow, KeyedClientHash>;
+
+    using ClientSet = std::pmr::unordered_set<HTTPClientID, KeyedClientHash>;
+
+    struct ShadowWindows
+        /// Windows of a client for each shadow limit.
+    {
+        ClientWindow    windows[maxShadowLimits];
+        uint8_t         deniedMask;
+            /// Bit i is set if shadow limit i has denied a request in
+            /// the client's current window for the limit.
+    };
+
+    struct HandleHash
+        /// Reuses the hash in the handle instead of hashing the ID again.
+    {
+        size_t operator()(const ClientHandle& client) const { return (size_t)client.hash; }
+    };
+
+    struct HandleEqual
+    {
+        bool operator()(const ClientHandle& a, const ClientHandle& b) const
+        {
+            return a.id == b.id;
+        }
+    };
+
+    using ShadowTable =
+        std::pmr::unordered_map<ClientHandle, ShadowWindows, HandleHash, HandleEqual>;
+
+    struct ShadowStats
+    {
+        uint64_t                    requests;
+        uint64_t                    wouldDeny;
+        uint64_t                    affectedClients;
+        std::vector<HTTPClientID>   sampleClients;
+    };
+
+    class CountArena
+        /// Monotonic arena together with the table of counters allocated
+        /// from it. The table is never destroyed node by node: release()
+        /// returns all memory of the table at once, which is valid because
+        /// counters are trivially destructible.
+    {
+    public:
+        CountArena(std::pmr::memory_resource* upstream);
+
+        RequestCountHashTable* table() const { return counts; }
+
+        void        reset(size_t expectedClients);
+            /// Releases the arena and creates an empty table in it.
+
+        void        release();
+            /// Releases the arena. table() is nullptr afterwards.
+
+    private:
+        std::pmr::monotonic_buffer_resource
+                                resource;
+        RequestCountHashTable*  counts;
+    };
+
+    struct alignas(64) Shard
+        /// Counters of the clients whose ID hash maps to the shard.
+    {
+        Shard(const NumaTopology& topology, unsigned node);
+
+        RequestCountHashTable& requestCounts() const { return *arenas[activeArena].table(); }
+            /// Accumulated number of requests per client for the client's
+            /// current window.
+
+        mutable std::mutex      mutex;
+            /// This mutex must be locked to access all other members.
+
+        RequestRate::Seconds    currentWindowStart;
+            /// Time when the current global rate calculation period (refered
+            /// to as "window") started. Expired client windows are reclaimed
+            /// when the global window rolls over.
+
+        RequestRate::Seconds    lastWindowEnd;
+            /// Latest end of the windows opened in the shard. If it has
+            /// passed, no counters survive the rollover.
+
+        NodeMemoryResource      nodeMemory;
+            /// Upstream of the arenas and the pool, bound to the shard's node.
+
+        CountArena              arenas[2];
+        unsigned                activeArena;
+            /// Arena of requestCounts(). The other arena is released, and
+            /// both are once fixed-capacity tables replace requestCounts().
+
+        std::unique_ptr<FixedClientTable<ClientWindow>>
+                                fixedCounts;
+        std::unique_ptr<FixedClientTable<uint32_t>>
+                                packedCounts;
+            /// If one of them is set, it replaces requestCounts().
+
+        std::pmr::unsynchronized_pool_resource
+                                clientsPool;
+
+        ClientSet               clients;
+            /// Clients who must be tracked. If this set is empty then all
+            /// clients are tracked. All shards hold the same set.
+
+        unsigned                node;
+            /// NUMA node the shard is placed on.
+
+        uint64_t                localRequests;
+        uint64_t                crossNodeRequests;
+            /// Number of requests handled by threads on the shard's node
+            /// and on other nodes.
+
+        uint64_t                overflowRequests;
+            /// Number of requests which were not rate-limited because
+            /// the fixed-capacity table was full.
+
+        std::vector<ShadowLimit> shadowLimits;
+        std::vector<ShadowStats> shadowStats;
+            /// Copies of the shadow limits and their counts for the shard.
+            /// All shards hold the same limits.
+
+        std::pmr::unsynchronized_pool_resource
+                                shadowPool;
+
+        ShadowTable             shadowWindows;
+            /// Windows of the shard's clients for the shadow limits.
+            /// Empty if there are no shadow limits.
+    };
+
+    KeyedClientHash         clientHash;
+        /// Selects shard, window phase and retry jitter of a client.
+
+    const NumaTopology&     topology;
+
+    std::vector<Shard*>     shards;
+        /// Shards of node N are stored at indexes N, N + nodeCount, ...
+
+    std::mutex              prefixMutex;
+    std::unique_ptr<Ipv4PrefixMap>
+                            prefixMap;
+        /// Created by the first setSubnetState(). prefixMutex must be locked
+        /// to access it.
+
+    std::atomic<const Ipv4PrefixMap*>
+                            prefixStates;
+        /// prefixMap once it is created, read by addRequest() without locking.
+
+    std::mutex              exemptMutex;
+    std::vector<std::unique_ptr<const ClientAllowlist>>
+                            exemptLists;
+        /// All allowlists ever set, the current one is the last. Replaced
+        /// lists are kept because addRequest() may still be reading them.
+        /// exemptMutex must be locked to access it.
+
+    std::atomic<const ClientAllowlist*>
+                            exemptClients;
+        /// Current allowlist, read by addRequest() without locking.
+        /// nullptr if no clients are exempt.
+
+    std::mutex              clientListsMutex;
+    std::vector<std::unique_ptr<const ClientAllowlist>>
+                            clientLists;
+        /// All lists of tracked and blocked clients ever set, kept like
+        /// exemptLists. clientListsMutex must be locked to access it.
+
+    std::atomic<const ClientAllowlist*>
+                            trackedClients;
+    std::atomic<const ClientAllowlist*>
+                            blockedClients;
+        /// Current lists, read by addRequest() without locking. nullptr
+        /// if no list is set.
+
+    struct TenantBudgets
+        /// Tenants together with a budget for each of them.
+    {
+        explicit TenantBudgets(const TenantLimits& tenants);
+
+        TenantLimits            tenants;
+        std::vector<std::unique_ptr<GlobalRequestBudget>>
+                                budgets;
+    };
 
-    RequestRate::Seconds    currentWindowStart;
-        /// Time when request counters started to accumulate for the 
-        /// current rate calculation period (refered to as "window").
+    mutable std::mutex      limitsMutex;
+    std::vector<std::unique_ptr<GlobalRequestBudget>>
+                            globalBudgets;
+    std::vector<std::unique_ptr<SubnetBudgets>>
+                            subnetBudgetSets;
+    std::vector<std::unique_ptr<TenantBudgets>>
+                            tenantBudgetSets;
+    std::vector<std::unique_ptr<PriorityCapacity>>
+                            priorityCapacities;
+    std::vector<std::unique_ptr<CalendarQuotas>>
+                            calendarQuotaSets;
+        /// All shared budgets ever set, the current ones are the last.
+        /// Replaced budgets are kept because addRequest() may still be
+        /// using them. limitsMutex must be locked to access them.
 
-    using RequestCountHashTable = std::unordered_map<HTTPClientID, int>;
-    RequestCountHashTable   requestCounts;
-        /// Accumulated number of requests per client for the current window. 
+    std::atomic<GlobalRequestBudget*>
+                            globalBudget;
+    std::atomic<SubnetBudgets*>
+                            subnetBudgets;
+    std::atomic<TenantBudgets*>
+                            tenantBudgets;
+    std::atomic<PriorityCapacity*>
+                            priorityCapacity;
+    std::atomic<CalendarQuotas*>
+                            calendarQuotas;
+        /// Current shared budgets, used by addRequest() without locking.
+        /// nullptr if there is no limit at the level.
 
-    using ClientSet = std::unordered_set<HTTPClientID>;
-    ClientSet               clients;
-        /// Clients who must be tracked. If this set is empty then all
-        /// clients are tracked.
+    std::mutex              fairMutex;
+        /// This mutex must be locked to access the members below.
+    int                     fairCapacity;
+        /// Requests per period shared by all active clients. 0 disables
+        /// the fair sharing mode.
+    size_t                  nextFairShard;
+        /// Shard counted by the next updateFairShare().
+    int                     demandBucketWidth;
+    std::vector<std::vector<uint32_t>>
+                            shardDemands;
+        /// Histogram of the request counts of active clients per shard,
+        /// as of the last time the shard was counted. Counts are grouped
+        /// into buckets of demandBucketWidth; the last bucket holds
+        /// clients which have reached the client limit.
 
     std::chrono::time_point<std::chrono::steady_clock> 
                             appStartTime;
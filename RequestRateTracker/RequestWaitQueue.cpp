@@ -0,0 +1,132 @@
+//
+// Coroutine-based waiting for request quota. See RequestWaitQueue class
+// header for details.
+//
+#include "RequestWaitQueue.h"
+
+RequestWaitQueue::Acquire::Acquire(RequestWaitQueue& queue,
+    const RequestRateTracker::ClientHandle& client)
+    : queue(queue), client(client), waitTime(0), acquired(false)
+{
+}
+
+bool RequestWaitQueue::Acquire::await_ready()
+{
+    waitTime = queue.tracker.addRequest(client);
+    acquired = (waitTime == 0);
+    return acquired;
+}
+
+bool RequestWaitQueue::Acquire::await_suspend(std::coroutine_handle<> handle)
+{
+    // Once enqueued, the coroutine may be resumed on another thread:
+    // this must not be accessed afterwards.
+    return queue.enqueue(*this, handle);
+}
+
+RequestWaitQueue::RequestWaitQueue(RequestRateTracker& tracker, Executor executor,
+    bool timerThread, RequestRateTracker::NowFunction* nowFunction)
+    : tracker(tracker)
+    , executor(std::move(executor))
+    , nowFunction(nowFunction)
+    , nextSequence(0)
+    , stopping(false)
+{
+    if (timerThread)
+        timer = std::thread(&RequestWaitQueue::run, this);
+}
+
+RequestWaitQueue::~RequestWaitQueue()
+{
+    std::vector<Waiter> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    if (timer.joinable())
+        timer.join();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (; !waiters.empty(); waiters.pop())
+            cancelled.push_back(waiters.top());
+    }
+    for (const Waiter& waiter : cancelled)
+        executor(waiter.handle);
+}
+
+RequestWaitQueue::Acquire RequestWaitQueue::acquire(RequestRateTracker::HTTPClientID client)
+{
+    return Acquire(*this, tracker.resolveClient(client));
+}
+
+RequestWaitQueue::Acquire RequestWaitQueue::acquire(
+    const RequestRateTracker::ClientHandle& client)
+{
+    return Acquire(*this, client);
+}
+
+bool RequestWaitQueue::enqueue(Acquire& acquire, std::coroutine_handle<> handle)
+{
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            return false;
+        Waiter waiter = { nowFunction() + std::chrono::seconds(acquire.waitTime),
+            nextSequence++, &acquire, handle };
+        notify = waiters.empty() || waiter.due < waiters.top().due;
+        waiters.push(waiter);
+    }
+    if (notify)
+        wakeUp.notify_one();
+    return true;
+}
+
+void RequestWaitQueue::resumeDue()
+{
+    std::vector<std::coroutine_handle<>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const TimePoint now = nowFunction();
+        while (!waiters.empty() && waiters.top().due <= now) {
+            Waiter waiter = waiters.top();
+            waiters.pop();
+            RequestRate::Seconds waitTime = tracker.addRequest(waiter.acquire->client);
+            if (waitTime == 0) {
+                waiter.acquire->acquired = true;
+                ready.push_back(waiter.handle);
+            }
+            else {
+                waiter.due = now + std::chrono::seconds(waitTime);
+                waiters.push(waiter);
+            }
+        }
+    }
+    // Resume outside of the lock: the executor may run the coroutine
+    // inline, and it may wait again.
+    for (std::coroutine_handle<> handle : ready)
+        executor(handle);
+}
+
+size_t RequestWaitQueue::waiting() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return waiters.size();
+}
+
+void RequestWaitQueue::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (waiters.empty())
+            wakeUp.wait(lock);
+        else
+            wakeUp.wait_for(lock, waiters.top().due - nowFunction());
+        if (stopping)
+            break;
+        lock.unlock();
+        resumeDue();
+        lock.lock();
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef REQUEST_WAIT_QUEUE_H
+#define REQUEST_WAIT_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "RequestRateTracker.h"
+
+class RequestWaitQueue
+    /// Responsible for suspending coroutines until the rate limit of their
+    /// client allows another request, so callers can wait for quota
+    /// without blocking a thread:
+    ///
+    ///     bool allowed = co_await waitQueue.acquire(clientId);
+    ///     if (!allowed)
+    ///         co_return;   // the queue was shut down
+    ///     // the request is counted and within the rate limit
+    ///
+    /// acquire() tries RequestRateTracker::addRequest() at once and does
+    /// not suspend if the request is allowed. Otherwise the coroutine is
+    /// kept in a timer queue ordered by the end of its wait time. When the
+    /// wait is over, the request is tried again and, once allowed, the
+    /// coroutine is passed to the executor to be resumed. A waiting request
+    /// costs its coroutine frame and one queue entry.
+    ///
+    /// The timer queue is driven by an internal thread, or by calling
+    /// resumeDue() if the queue was created without the thread.
+{
+public:
+    using Executor = std::function<void(std::coroutine_handle<>)>;
+        /// Resumes a coroutine, e.g. by posting it to a thread pool. It is
+        /// called on the timer thread (or the thread calling resumeDue())
+        /// and must outlive the queue.
+
+    class Acquire
+        /// Awaitable returned by acquire(). The result of co_await is true
+        /// if the request is allowed and false if the queue was shut down
+        /// while the coroutine was waiting.
+    {
+    public:
+        bool    await_ready();
+
+        bool    await_suspend(std::coroutine_handle<> handle);
+
+        bool    await_resume() const { return acquired; }
+
+    private:
+        friend class RequestWaitQueue;
+
+        Acquire(RequestWaitQueue& queue, const RequestRateTracker::ClientHandle& client);
+
+        RequestWaitQueue&                   queue;
+        RequestRateTracker::ClientHandle    client;
+        RequestRate::Seconds                waitTime;
+        bool                                acquired;
+    };
+
+    RequestWaitQueue(RequestRateTracker& tracker, Executor executor,
+        bool timerThread = true,
+        RequestRateTracker::NowFunction* nowFunction = std::chrono::steady_clock::now);
+        /// nowFunction must be the clock of the tracker.
+
+    RequestWaitQueue(const RequestWaitQueue&) = delete;
+    RequestWaitQueue& operator=(const RequestWaitQueue&) = delete;
+
+    ~RequestWaitQueue();
+        /// Stops the timer thread and resumes coroutines which still wait,
+        /// with false as the result of co_await.
+
+    Acquire     acquire(RequestRateTracker::HTTPClientID client);
+
+    Acquire     acquire(const RequestRateTracker::ClientHandle& client);
+
+    void        resumeDue();
+        /// Retries requests whose wait time has ended and resumes
+        /// coroutines whose requests are allowed.
+
+    size_t      waiting() const;
+        /// Number of suspended coroutines.
+
+private:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    struct Waiter
+    {
+        TimePoint               due;
+        uint64_t                sequence;
+            /// Keeps waiters with the same due time in FIFO order.
+        Acquire*                acquire;
+        std::coroutine_handle<> handle;
+
+        bool operator>(const Waiter& other) const
+        {
+            return due != other.due ? due > other.due : sequence > other.sequence;
+        }
+    };
+
+    bool        enqueue(Acquire& acquire, std::coroutine_handle<> handle);
+        /// The return is false if the queue is shut down.
+
+    void        run();
+
+    RequestRateTracker&     tracker;
+    Executor                executor;
+    RequestRateTracker::NowFunction*
+                            nowFunction;
+
+    mutable std::mutex      mutex;
+        /// This mutex must be locked to access the members below.
+    std::condition_variable wakeUp;
+    std::priority_queue<Waiter, std::vector<Waiter>, std::greater<Waiter>>
+                            waiters;
+    uint64_t                nextSequence;
+    bool                    stopping;
+
+    std::thread             timer;
+};
+
+#endif // REQUEST_WAIT_QUEUE_H
@@ -0,0 +1,179 @@
+//
+// RESP encoding and parsing. See Resp class header for details.
+//
+#include "Resp.h"
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+bool parseInteger(const std::string& text, int64_t& value)
+{
+    const char* end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end && !text.empty();
+}
+
+} // namespace
+
+void Resp::Parser::feed(const char* data, size_t size)
+{
+    // Values taken before are dropped once they are most of the buffer
+    if (consumed > 0 && consumed >= buffer.size() / 2) {
+        buffer.erase(0, consumed);
+        consumed = 0;
+    }
+    buffer.append(data, size);
+}
+
+bool Resp::Parser::next(Reply& value)
+{
+    if (invalid)
+        return false;
+    size_t position = consumed;
+    Reply parsed;
+    switch (parse(position, parsed, 0)) {
+    case Result::Complete:
+        consumed = position;
+        value = std::move(parsed);
+        return true;
+    case Result::Invalid:
+        invalid = true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+Resp::Parser::Result Resp::Parser::parse(size_t& position, Reply& value, int depth) const
+{
+    std::string line;
+    if (!readLine(position, line))
+        return Result::Incomplete;
+    if (line.empty())
+        return Result::Invalid;
+    const char kind = line[0];
+    line.erase(0, 1);
+    switch (kind) {
+    case '+':
+        value.type = Reply::Type::SimpleString;
+        value.text = std::move(line);
+        return Result::Complete;
+    case '-':
+        value.type = Reply::Type::Error;
+        value.text = std::move(line);
+        return Result::Complete;
+    case ':':
+        value.type = Reply::Type::Integer;
+        return parseInteger(line, value.integer) ? Result::Complete : Result::Invalid;
+    case '$': {
+        int64_t length = 0;
+        if (!parseInteger(line, length) || length < -1 || length > maxLength)
+            return Result::Invalid;
+        if (length == -1) {
+            value.type = Reply::Type::Null;
+            return Result::Complete;
+        }
+        if (buffer.size() - position < (size_t)length + 2)
+            return Result::Incomplete;
+        if (buffer.compare(position + (size_t)length, 2, "\r\n") != 0)
+            return Result::Invalid;
+        value.type = Reply::Type::BulkString;
+        value.text.assign(buffer, position, (size_t)length);
+        position += (size_t)length + 2;
+        return Result::Complete;
+    }
+    case '*': {
+        int64_t count = 0;
+        if (!parseInteger(line, count) || count < -1 || count > maxLength)
+            return Result::Invalid;
+        if (count == -1) {
+            value.type = Reply::Type::Null;
+            return Result::Complete;
+        }
+        if (depth >= maxDepth)
+            return Result::Invalid;
+        value.type = Reply::Type::Array;
+        // Every element takes at least 3 bytes, which bounds the reservation
+        value.elements.reserve((size_t)std::min<int64_t>(count,
+            (int64_t)(buffer.size() - position) / 3));
+        for (int64_t i = 0; i < count; i++) {
+            Reply element;
+            Result result = parse(position, element, depth + 1);
+            if (result != Result::Complete)
+                return result;
+            value.elements.push_back(std::move(element));
+        }
+        return Result::Complete;
+    }
+    default:
+        return Result::Invalid;
+    }
+}
+
+bool Resp::Parser::readLine(size_t& position, std::string& line) const
+{
+    size_t end = buffer.find("\r\n", position);
+    if (end == std::string::npos)
+        return false;
+    line.assign(buffer, position, end - position);
+    position = end + 2;
+    return true;
+}
+
+void Resp::appendCommand(const std::vector<std::string>& arguments, std::string& out)
+{
+    out += '*';
+    out += std::to_string(arguments.size());
+    out += "\r\n";
+    for (const std::string& argument : arguments) {
+        out += '$';
+        out += std::to_string(argument.size());
+        out += "\r\n";
+        out += argument;
+        out += "\r\n";
+    }
+}
+
+void Resp::appendReply(const Reply& reply, std::string& out)
+{
+    switch (reply.type) {
+    case Reply::Type::SimpleString:
+        out += '+';
+        out += reply.text;
+        break;
+    case Reply::Type::Error:
+        out += '-';
+        out += reply.text;
+        break;
+    case Reply::Type::Integer:
+        out += ':';
+        out += std::to_string(reply.integer);
+        break;
+    case Reply::Type::BulkString:
+        out += '$';
+        out += std::to_string(reply.text.size());
+        out += "\r\n";
+        out += reply.text;
+        break;
+    case Reply::Type::Array:
+        out += '*';
+        out += std::to_string(reply.elements.size());
+        out += "\r\n";
+        for (const Reply& element : reply.elements)
+            appendReply(element, out);
+        return;
+    case Reply::Type::Null:
+        out += "$-1";
+        break;
+    }
+    out += "\r\n";
+}
+
+Resp::Reply Resp::errorReply(const std::string& message)
+{
+    Reply reply;
+    reply.type = Reply::Type::Error;
+    reply.text = message;
+    return reply;
+}
@@ -0,0 +1,82 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Resp
+    /// Responsible for encoding and parsing RESP, the protocol of Redis and
+    /// compatible stores. Commands are sent as arrays of bulk strings and
+    /// replies may be any RESP2 value.
+{
+public:
+    struct Reply
+        /// A RESP value. Commands read by a server are values too.
+    {
+        enum class Type
+        {
+            SimpleString,
+            Error,
+            Integer,
+            BulkString,
+            Array,
+            Null
+        };
+
+        Type                type = Type::Null;
+        int64_t             integer = 0;
+        std::string         text;
+            /// Simple string, error or bulk string.
+        std::vector<Reply>  elements;
+
+        bool                isError() const { return type == Type::Error; }
+    };
+
+    class Parser
+        /// Incremental parser of values read from a stream: bytes are fed
+        /// as they arrive, in pieces of any size, and complete values are
+        /// taken with next().
+    {
+    public:
+        void    feed(const char* data, size_t size);
+
+        bool    next(Reply& value);
+            /// Takes the next complete value. Returns false if no value is
+            /// complete yet, or if the stream is invalid (see failed()).
+
+        bool    failed() const { return invalid; }
+            /// True if the stream cannot be parsed; the connection must be
+            /// closed then.
+
+    private:
+        enum class Result
+        {
+            Complete,
+            Incomplete,
+            Invalid
+        };
+
+        Result  parse(size_t& position, Reply& value, int depth) const;
+
+        bool    readLine(size_t& position, std::string& line) const;
+
+        static constexpr int maxDepth = 8;
+        static constexpr int64_t maxLength = 512 * 1024 * 1024;
+
+        std::string buffer;
+        size_t      consumed = 0;
+            /// Bytes of buffer taken by previous values.
+        bool        invalid = false;
+    };
+
+    static void     appendCommand(const std::vector<std::string>& arguments, std::string& out);
+        /// Appends the command as an array of bulk strings.
+
+    static void     appendReply(const Reply& reply, std::string& out);
+
+    static Reply    errorReply(const std::string& message);
+};
+
+#endif // RESP_H
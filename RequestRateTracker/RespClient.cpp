@@ -0,0 +1,149 @@
+//
+// Pipelined client of a Redis compatible store. See RespClient class
+// header for details.
+//
+#include "RespClient.h"
+#include <future>
+
+RespClient::RespClient(Transport& transport, std::chrono::milliseconds retryDelay)
+    : transport(transport)
+    , connected(false)
+    , connecting(false)
+    , closing(false)
+    , retryDelay(retryDelay)
+    , sent(0)
+{
+    reader = std::thread(&RespClient::readLoop, this);
+}
+
+RespClient::~RespClient()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    transport.close();
+    connectedCondition.notify_all();
+    reader.join();
+}
+
+void RespClient::send(const std::vector<std::string>& command, Callback done)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // A connection found closed by the write is opened again once
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!connected && !connect(lock))
+            break;
+        // Encoded after connecting, which releases the lock
+        frame.clear();
+        Resp::appendCommand(command, frame);
+        // The callback is queued first: its reply cannot be read before
+        // the lock is released
+        waiting.push_back(std::move(done));
+        if (transport.write(frame.data(), frame.size())) {
+            sent++;
+            return;
+        }
+        done = std::move(waiting.back());
+        waiting.pop_back();
+        // The reader fails commands sent before and gives up the connection.
+        // Callbacks run on the reader, which cannot wait for itself.
+        transport.close();
+        if (std::this_thread::get_id() == reader.get_id())
+            break;
+        connectedCondition.wait(lock, [this] { return !connected; });
+    }
+    lock.unlock();
+    done(Resp::errorReply("ERR store unreachable"));
+}
+
+Resp::Reply RespClient::call(const std::vector<std::string>& command)
+{
+    std::promise<Resp::Reply> reply;
+    std::future<Resp::Reply> replied = reply.get_future();
+    send(command, [&reply](const Resp::Reply& value) { reply.set_value(value); });
+    return replied.get();
+}
+
+uint64_t RespClient::sentCommands() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return sent;
+}
+
+bool RespClient::connect(std::unique_lock<std::mutex>& lock)
+{
+    if (closing || connecting || std::chrono::steady_clock::now() < retryTime)
+        return false;
+    connecting = true;
+    lock.unlock();
+    bool opened = transport.open();
+    lock.lock();
+    connecting = false;
+    if (!opened) {
+        retryTime = std::chrono::steady_clock::now() + retryDelay;
+        return false;
+    }
+    if (closing) {
+        transport.close();
+        return false;
+    }
+    connected = true;
+    connectedCondition.notify_all();
+    return true;
+}
+
+void RespClient::readLoop()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            connectedCondition.wait(lock, [this] { return connected || closing; });
+            if (closing && !connected)
+                return;
+        }
+
+        Resp::Parser parser;
+        char buffer[16 * 1024];
+        bool open = true;
+        while (open) {
+            long received = transport.read(buffer, sizeof(buffer));
+            if (received == Transport::timedOut) {
+                // An idle connection is kept; one which owes replies is hung
+                std::lock_guard<std::mutex> lock(mutex);
+                if (waiting.empty())
+                    continue;
+            }
+            if (received <= 0)
+                break;
+            parser.feed(buffer, (size_t)received);
+            Resp::Reply reply;
+            while (open && parser.next(reply)) {
+                Callback done;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (waiting.empty()) {
+                        open = false; // A reply nobody asked for
+                        break;
+                    }
+                    done = std::move(waiting.front());
+                    waiting.pop_front();
+                }
+                done(reply);
+            }
+            if (parser.failed())
+                open = false;
+        }
+
+        transport.close();
+        std::deque<Callback> lost;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            connected = false;
+            lost.swap(waiting);
+        }
+        connectedCondition.notify_all();
+        for (Callback& done : lost)
+            done(Resp::errorReply("ERR store connection closed"));
+    }
+}
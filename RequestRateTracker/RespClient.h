@@ -0,0 +1,122 @@
+#ifndef RESP_CLIENT_H
+#define RESP_CLIENT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Resp.h"
+
+class RespClient
+    /// Responsible for sending commands to a Redis compatible store over
+    /// one connection, asynchronously and pipelined.
+    ///
+    /// send() writes the command at once and returns without waiting for
+    /// the reply, so commands of many threads are in flight together. The
+    /// store answers commands of a connection in order, so replies are
+    /// matched to the queue of commands sent, and each reply is passed to
+    /// the callback of its command on the reader thread of the client.
+    ///
+    /// The connection is opened by the first command and reopened by the
+    /// first command after it was closed; a command whose write finds the
+    /// connection closed is sent again on a new one. Commands which cannot
+    /// be sent, or whose reply is lost with the connection, get an error
+    /// reply.
+    /// The connection is opened without the lock held, so commands of other
+    /// threads get an error reply at once instead of waiting for it, and
+    /// after it cannot be opened, commands get an error reply at once until
+    /// the retry delay has passed. A command thus waits for at most one
+    /// attempt to connect, and the transport must bound how long writes
+    /// block, e.g. with a send timeout.
+    /// The reader thread lives as long as the client and waits for the
+    /// next connection when one is closed.
+{
+public:
+    class Transport
+        /// Byte stream to the store, e.g. a TCP connection.
+    {
+    public:
+        virtual ~Transport() = default;
+
+        virtual bool    open() = 0;
+            /// Opens the stream; it may have been closed before. Returns
+            /// false if the store cannot be reached.
+
+        virtual bool    write(const char* data, size_t size) = 0;
+            /// Writes all bytes. Returns false if the stream is closed.
+
+        virtual long    read(char* data, size_t size) = 0;
+            /// Waits for bytes and reads at most size of them. Returns 0 or
+            /// less when the stream is closed, or timedOut if no bytes
+            /// arrived within the receive timeout of the stream, if it has
+            /// one. The connection is kept then unless commands are waiting
+            /// for replies.
+
+        static constexpr long timedOut = -2;
+
+        virtual void    close() = 0;
+            /// Closes the stream, waking up a thread waiting in read().
+    };
+
+    using Callback = std::function<void(const Resp::Reply& reply)>;
+        /// Called on the reader thread, which must not be blocked long;
+        /// callbacks may send() but must not call().
+
+    explicit RespClient(Transport& transport,
+        std::chrono::milliseconds retryDelay = std::chrono::seconds(1));
+        /// The transport must outlive the client. Connections are not
+        /// attempted again until retryDelay after one failed.
+
+    RespClient(const RespClient&) = delete;
+    RespClient& operator=(const RespClient&) = delete;
+
+    ~RespClient();
+        /// Closes the connection. Commands still waiting get an error
+        /// reply.
+
+    void        send(const std::vector<std::string>& command, Callback done);
+
+    Resp::Reply call(const std::vector<std::string>& command);
+        /// Sends the command and waits for its reply.
+
+    uint64_t    sentCommands() const;
+
+private:
+    bool        connect(std::unique_lock<std::mutex>& lock);
+        /// Opens the connection with the lock released. Returns false at
+        /// once if another thread is opening it or the retry delay has not
+        /// passed.
+
+    void        readLoop();
+
+    Transport&              transport;
+
+    mutable std::mutex      mutex;
+        /// This mutex must be locked to access the members below and to
+        /// write to the transport.
+    std::condition_variable connectedCondition;
+        /// Notified when the connection is opened or given up.
+    bool                    connected;
+    bool                    connecting;
+        /// Set while a thread opens the connection.
+    bool                    closing;
+    std::chrono::milliseconds
+                            retryDelay;
+    std::chrono::steady_clock::time_point
+                            retryTime;
+        /// When the connection may be opened again after it failed.
+    std::deque<Callback>    waiting;
+        /// Callbacks of commands sent, in order.
+    std::string             frame;
+        /// Reused for encoding commands.
+    uint64_t                sent;
+    std::thread             reader;
+};
+
+#endif // RESP_CLIENT_H
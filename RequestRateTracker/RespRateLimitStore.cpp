@@ -0,0 +1,111 @@
+//
+// Request counts kept in a Redis compatible store. See RespRateLimitStore
+// class header for details.
+//
+#include "RespRateLimitStore.h"
+
+const char* const RespRateLimitStore::script =
+    "local count = redis.call('INCRBY', KEYS[1], ARGV[1])\n"
+    "local ttl = redis.call('TTL', KEYS[1])\n"
+    "if ttl < 0 then\n"
+    "  ttl = tonumber(ARGV[2])\n"
+    "  redis.call('EXPIRE', KEYS[1], ttl)\n"
+    "end\n"
+    "return {count, ttl}\n";
+
+RespRateLimitStore::RespRateLimitStore(RespClient& client, const std::string& keyPrefix)
+    : client(client)
+    , keyPrefix(keyPrefix)
+    , reloads(0)
+    , loading(false)
+{
+    loadScript();
+}
+
+void RespRateLimitStore::increment(HTTPClientID clientId, uint32_t requests,
+    RequestRate::Seconds period, Callback done)
+{
+    std::string loaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded = digest;
+    }
+    std::vector<std::string> command = { "EVALSHA", loaded, "1",
+        keyPrefix + std::to_string(clientId), std::to_string(requests), std::to_string(period) };
+    if (loaded.empty()) {
+        evaluate(std::move(command), std::move(done));
+        return;
+    }
+    client.send(command, [this, command, done](const Resp::Reply& reply) mutable {
+        if (reply.isError() && reply.text.compare(0, 8, "NOSCRIPT") == 0) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                digest.clear();
+                reloads++;
+            }
+            loadScript();
+            evaluate(std::move(command), std::move(done));
+            return;
+        }
+        Window window = { 0, 0 };
+        bool counted = windowOf(reply, window);
+        done(counted, window);
+    });
+}
+
+uint64_t RespRateLimitStore::scriptReloads() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return reloads;
+}
+
+void RespRateLimitStore::loadScript()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (loading)
+            return;
+        loading = true;
+    }
+    client.send({ "SCRIPT", "LOAD", script }, [this](const Resp::Reply& reply) {
+        std::lock_guard<std::mutex> lock(mutex);
+        loading = false;
+        if (reply.type == Resp::Reply::Type::BulkString)
+            digest = reply.text;
+    });
+}
+
+void RespRateLimitStore::evaluate(std::vector<std::string> command, Callback done)
+{
+    command[0] = "EVAL";
+    command[1] = script;
+    client.send(command, [this, done](const Resp::Reply& reply) {
+        Window window = { 0, 0 };
+        bool counted = windowOf(reply, window);
+        if (counted) {
+            // The store is up, but the script may have failed to load
+            // while it was not, e.g. when the store was constructed
+            bool loaded;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                loaded = !digest.empty();
+            }
+            if (!loaded)
+                loadScript();
+        }
+        done(counted, window);
+    });
+}
+
+bool RespRateLimitStore::windowOf(const Resp::Reply& reply, Window& window)
+{
+    if (reply.type != Resp::Reply::Type::Array || reply.elements.size() != 2
+        || reply.elements[0].type != Resp::Reply::Type::Integer
+        || reply.elements[1].type != Resp::Reply::Type::Integer)
+    {
+        return false;
+    }
+    window.count = reply.elements[0].integer;
+    window.remaining = (RequestRate::Seconds)reply.elements[1].integer;
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef RESP_RATE_LIMIT_STORE_H
+#define RESP_RATE_LIMIT_STORE_H
+
+#include <mutex>
+#include <string>
+#include "RateLimitStore.h"
+#include "RespClient.h"
+
+class RespRateLimitStore : public RateLimitStore
+    /// Responsible for counting requests in a Redis compatible store.
+    ///
+    /// Each client has a key, keyPrefix followed by its decimal id, which
+    /// holds the count of its window and expires with it. The increment
+    /// and the start of a new window are one Lua script (see script), so
+    /// the check-and-increment is atomic in the store and takes a single
+    /// round trip. The script is loaded once with SCRIPT LOAD and run by
+    /// its digest with EVALSHA. If the store has lost it, e.g. after a
+    /// restart, the command is sent again with EVAL and the script is
+    /// loaded again. A script which could not be loaded because the store
+    /// was unreachable is loaded after the next EVAL which succeeds.
+    ///
+    /// Commands are pipelined over the RespClient, so increments of many
+    /// threads share one connection.
+{
+public:
+    static const char* const script;
+        /// Takes the key, the number of requests and the period, and
+        /// returns the count and the seconds until the window ends.
+
+    RespRateLimitStore(RespClient& client, const std::string& keyPrefix = "rrt:");
+        /// The client must outlive the store.
+
+    void        increment(HTTPClientID client, uint32_t requests,
+                    RequestRate::Seconds period, Callback done) override;
+
+    uint64_t    scriptReloads() const;
+        /// Times the store had lost the script.
+
+private:
+    void        loadScript();
+        /// Sends SCRIPT LOAD unless it is already waiting for its reply.
+
+    void        evaluate(std::vector<std::string> command, Callback done);
+        /// Sends the command, an EVALSHA of the script, as EVAL.
+
+    static bool windowOf(const Resp::Reply& reply, Window& window);
+
+    RespClient&         client;
+    std::string         keyPrefix;
+
+    mutable std::mutex  mutex;
+        /// This mutex must be locked to access the members below.
+    std::string         digest;
+        /// SHA1 digest of the script loaded into the store, or empty.
+    uint64_t            reloads;
+    bool                loading;
+        /// SCRIPT LOAD was sent and its reply has not arrived yet.
+};
+
+#endif // RESP_RATE_LIMIT_STORE_H
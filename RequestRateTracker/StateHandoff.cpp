@@ -0,0 +1,186 @@
+//
+// Handoff of the live counters of a tracker to another process. See
+// StateHandoff class header for details.
+//
+#include "StateHandoff.h"
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+const uint8_t magic[4] = { 'R', 'R', 'T', 'S' };
+
+void appendVarint(std::vector<uint8_t>& bytes, uint64_t value)
+{
+    while (value >= 0x80) {
+        bytes.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back((uint8_t)value);
+}
+
+} // namespace
+
+bool StateHandoff::exportTo(const RequestRateTracker& tracker, const Sink& write)
+{
+    std::vector<uint8_t> bytes(magic, magic + sizeof(magic));
+    bytes.push_back(version);
+    appendVarint(bytes, (uint64_t)tracker.getRateLimit().period);
+    if (!write(bytes.data(), bytes.size()))
+        return false;
+
+    uint64_t total = 0;
+    std::vector<RequestRateTracker::ClientState> sorted;
+    bool written = tracker.exportState([&](const std::vector<RequestRateTracker::ClientState>& states) {
+        // Sorted, IDs of a block are encoded as small differences
+        sorted = states;
+        std::sort(sorted.begin(), sorted.end(),
+            [](const RequestRateTracker::ClientState& a, const RequestRateTracker::ClientState& b) {
+                return a.id < b.id;
+            });
+        bytes.clear();
+        appendVarint(bytes, sorted.size());
+        RequestRateTracker::HTTPClientID previous = 0;
+        for (const RequestRateTracker::ClientState& state : sorted) {
+            appendVarint(bytes, state.id - previous);
+            appendVarint(bytes, (uint64_t)state.remaining);
+            appendVarint(bytes, (uint64_t)state.count);
+            previous = state.id;
+        }
+        total += sorted.size();
+        return write(bytes.data(), bytes.size());
+    });
+    if (!written)
+        return false;
+
+    bytes.clear();
+    appendVarint(bytes, 0);
+    appendVarint(bytes, total);
+    return write(bytes.data(), bytes.size());
+}
+
+StateHandoff::Reader::Reader(RequestRateTracker& tracker)
+    : tracker(tracker)
+    , state(State::Header)
+    , blockLeft(0)
+    , previousId(0)
+    , decodedCount(0)
+    , importedCount(0)
+{
+}
+
+bool StateHandoff::Reader::feed(const uint8_t* data, size_t size)
+{
+    if (state == State::Failed)
+        return false;
+    if (state == State::Finished) {
+        if (size > 0)
+            state = State::Failed;
+        return !failed();
+    }
+    pending.insert(pending.end(), data, data + size);
+
+    const RequestRate::Seconds period = tracker.getRateLimit().period;
+    size_t position = 0;
+    bool complete = true;
+    while (complete && state != State::Finished && state != State::Failed) {
+        const size_t start = position;
+        uint64_t value = 0;
+        int result = 1;
+        switch (state) {
+        case State::Header:
+            if (pending.size() < sizeof(magic) + 1) {
+                result = 0;
+                break;
+            }
+            if (!std::equal(magic, magic + sizeof(magic), pending.begin())
+                || pending[sizeof(magic)] != version)
+            {
+                result = -1;
+                break;
+            }
+            position = sizeof(magic) + 1;
+            result = readVarint(position, value);
+            if (result > 0 && value != (uint64_t)period)
+                result = -1;
+            if (result > 0)
+                state = State::BlockSize;
+            break;
+        case State::BlockSize:
+            result = readVarint(position, value);
+            if (result > 0) {
+                blockLeft = value;
+                previousId = 0;
+                state = (value == 0) ? State::Total : State::Client;
+            }
+            break;
+        case State::Client: {
+            uint64_t remaining = 0;
+            uint64_t count = 0;
+            result = readVarint(position, value);
+            if (result > 0)
+                result = readVarint(position, remaining);
+            if (result > 0)
+                result = readVarint(position, count);
+            if (result <= 0)
+                break;
+            if (previousId + value > UINT32_MAX || remaining > (uint64_t)period
+                || count > (uint64_t)INT_MAX)
+            {
+                result = -1;
+                break;
+            }
+            previousId = (RequestRateTracker::HTTPClientID)(previousId + value);
+            batch.push_back(RequestRateTracker::ClientState{ previousId,
+                (RequestRate::Seconds)remaining, (int)count });
+            decodedCount++;
+            if (--blockLeft == 0)
+                state = State::BlockSize;
+            if (batch.size() >= importBatch)
+                importDecoded();
+            break;
+        }
+        case State::Total:
+            result = readVarint(position, value);
+            if (result > 0)
+                state = (value == decodedCount) ? State::Finished : State::Failed;
+            break;
+        default:
+            break;
+        }
+        if (result < 0)
+            state = State::Failed;
+        else if (result == 0) {
+            // Waits for the rest of the item
+            position = start;
+            complete = false;
+        }
+    }
+    pending.erase(pending.begin(), pending.begin() + position);
+    importDecoded();
+    if (state == State::Finished && !pending.empty())
+        state = State::Failed;
+    return !failed();
+}
+
+int StateHandoff::Reader::readVarint(size_t& position, uint64_t& value) const
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (position >= pending.size())
+            return 0;
+        uint8_t byte = pending[position++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return 1;
+    }
+    return -1;
+}
+
+void StateHandoff::Reader::importDecoded()
+{
+    if (batch.empty())
+        return;
+    importedCount += tracker.importState(batch);
+    batch.clear();
+}
@@ -0,0 +1,101 @@
+#ifndef STATE_HANDOFF_H
+#define STATE_HANDOFF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "RequestRateTracker.h"
+
+class StateHandoff
+    /// Responsible for the binary format in which a draining server hands
+    /// the live counters of its RequestRateTracker over to another server,
+    /// directly or through a file, so that its clients keep their budgets
+    /// rather than starting afresh on other servers.
+    ///
+    /// The stream starts with the magic "RRTS", a version byte and the
+    /// rate limit's period. Then follows a block per shard of the tracker:
+    /// the number of clients, then for each client, in ascending order of
+    /// ID, the difference to the previous ID, the seconds left of its
+    /// window and its count. The stream ends with an empty block and the
+    /// total number of clients. All numbers are unsigned LEB128 varints,
+    /// so a client usually takes 4 to 7 bytes.
+    ///
+    /// Reader decodes a stream received in pieces of any size and imports
+    /// the clients into a tracker as they are decoded, so the stream need
+    /// not be held in memory.
+{
+public:
+    using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+        /// Writes all bytes; returns false if they cannot be written.
+
+    static constexpr uint8_t version = 1;
+
+    static bool         exportTo(const RequestRateTracker& tracker, const Sink& write);
+        /// Writes the open windows of the tracker to the sink, one shard at
+        /// a time (see RequestRateTracker::exportState()). The return is
+        /// false if the sink failed.
+
+    class Reader
+        /// Imports a stream written by exportTo() into a tracker.
+    {
+    public:
+        explicit Reader(RequestRateTracker& tracker);
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        bool        feed(const uint8_t* data, size_t size);
+            /// Decodes the next bytes of the stream and imports the clients
+            /// in them. Returns false once the stream is malformed, is for
+            /// another period than the tracker's, or continues after its
+            /// end.
+
+        bool        finished() const { return state == State::Finished; }
+            /// True once the whole stream has been imported.
+
+        bool        failed() const { return state == State::Failed; }
+
+        size_t      decoded() const { return decodedCount; }
+            /// Clients read from the stream.
+
+        size_t      imported() const { return importedCount; }
+            /// Clients merged into the tracker; clients which the tracker
+            /// does not track are skipped.
+
+    private:
+        enum class State
+        {
+            Header,
+            BlockSize,
+            Client,
+            Total,
+            Finished,
+            Failed
+        };
+
+        static constexpr size_t importBatch = 1024;
+            /// Clients decoded before they are imported together.
+
+        int         readVarint(size_t& position, uint64_t& value) const;
+            /// Decodes a varint at position of pending and advances past it.
+            /// Returns 1 if it was decoded, 0 if it is incomplete and -1 if
+            /// it is longer than any 64 bit value.
+
+        void        importDecoded();
+
+        RequestRateTracker&     tracker;
+        State                   state;
+        std::vector<uint8_t>    pending;
+            /// Bytes received and not decoded yet.
+        uint64_t                blockLeft;
+        RequestRateTracker::HTTPClientID
+                                previousId;
+        std::vector<RequestRateTracker::ClientState>
+                                batch;
+        size_t                  decodedCount;
+        size_t                  importedCount;
+    };
+};
+
+#endif // STATE_HANDOFF_H
@@ -0,0 +1,229 @@
+//
+// Rate limiting with counts kept in a shared store. See StoreRateLimiter
+// class header for details.
+//
+#include "StoreRateLimiter.h"
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <utility>
+#include <vector>
+
+StoreRateLimiter::StoreRateLimiter(RequestRateTracker& tracker, RateLimitStore& store,
+    uint32_t maxBatch, std::chrono::milliseconds timeout, NowFunction* nowFunction,
+    const CircuitBreaker::Settings& breakerSettings)
+    : tracker(tracker)
+    , store(store)
+    , rateLimit(tracker.getRateLimit())
+    , maxBatch(std::max<uint32_t>(maxBatch, 1))
+    , timeout(timeout)
+    , breaker(breakerSettings)
+    , localCount(0)
+    , claimCount(0)
+    , failureCount(0)
+    , fallbackCount(0)
+    , reconciledCount(0)
+    , nowFunction(nowFunction)
+{
+    startTime = nowFunction();
+}
+
+RequestRate::Seconds StoreRateLimiter::addRequest(HTTPClientID client, Priority priority)
+{
+    switch (tracker.admissionOf(client)) {
+    case RequestRateTracker::Admission::Allowed:
+        return 0;
+    case RequestRateTracker::Admission::Denied:
+        return rateLimit.period;
+    default:
+        break;
+    }
+
+    const Seconds now = secondsSinceStart();
+    Shard& shard = shards[clientHash.shardOf(client, shardCount)];
+    uint32_t batch;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.clients.size() >= maxClients)
+            reclaimExpired(shard, now);
+        ClientWindow& window = shard.clients[client];
+        if (window.windowEnd <= now) {
+            startWindow(window);
+        }
+        else if (window.claimed > 0) {
+            localCount.fetch_add(1, std::memory_order_relaxed);
+            return admitClaimed(window, client, priority);
+        }
+        else if (window.storeCount >= rateLimit.num) {
+            localCount.fetch_add(1, std::memory_order_relaxed);
+            return window.windowEnd - now;
+        }
+        batch = batchSize(window);
+    }
+    return claim(shard, client, priority, batch);
+}
+
+uint64_t StoreRateLimiter::localDecisions() const
+{
+    return localCount.load(std::memory_order_relaxed);
+}
+
+uint64_t StoreRateLimiter::storeRequests() const
+{
+    return claimCount.load(std::memory_order_relaxed);
+}
+
+uint64_t StoreRateLimiter::storeFailures() const
+{
+    return failureCount.load(std::memory_order_relaxed);
+}
+
+uint64_t StoreRateLimiter::fallbackDecisions() const
+{
+    return fallbackCount.load(std::memory_order_relaxed);
+}
+
+uint64_t StoreRateLimiter::reconciledRequests() const
+{
+    return reconciledCount.load(std::memory_order_relaxed);
+}
+
+void StoreRateLimiter::reconcile()
+{
+    const Seconds now = secondsSinceStart();
+    std::vector<std::pair<HTTPClientID, uint32_t>> admitted;
+    for (Shard& shard : shards) {
+        admitted.clear();
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto& entry : shard.clients) {
+                ClientWindow& window = entry.second;
+                if (window.unreconciled > 0 && window.unreconciledEnd > now)
+                    admitted.emplace_back(entry.first, window.unreconciled);
+                window.unreconciled = 0;
+            }
+        }
+        // Pipelined: replies are not waited for, and the next claim of
+        // each client reads the count with them
+        for (const auto& client : admitted) {
+            reconciledCount.fetch_add(client.second, std::memory_order_relaxed);
+            store.increment(client.first, client.second, rateLimit.period,
+                [](bool, const RateLimitStore::Window&) {});
+        }
+    }
+}
+
+RequestRate::Seconds StoreRateLimiter::secondsSinceStart() const
+{
+    auto sinceStart = std::chrono::duration_cast<std::chrono::seconds>(
+        nowFunction() - startTime);
+    return (Seconds)sinceStart.count();
+}
+
+uint32_t StoreRateLimiter::batchSize(const ClientWindow& window) const
+{
+    int64_t left = (int64_t)rateLimit.num - window.storeCount;
+    return (uint32_t)std::clamp<int64_t>(left / 8, 1, maxBatch);
+}
+
+RequestRate::Seconds StoreRateLimiter::claim(Shard& shard, HTTPClientID client,
+    Priority priority, uint32_t batch)
+{
+    struct Reply
+        /// Shared with the callback, which may run after a timeout.
+    {
+        std::mutex              mutex;
+        std::condition_variable replied;
+        bool                    done = false;
+        bool                    counted = false;
+        RateLimitStore::Window  window = { 0, 0 };
+    };
+    if (!breaker.allowCall(nowFunction()))
+        return decideLocally(shard, client, priority);
+    // The deadline includes sending, which may open the connection
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto reply = std::make_shared<Reply>();
+    claimCount.fetch_add(1, std::memory_order_relaxed);
+    store.increment(client, batch, rateLimit.period,
+        [reply](bool counted, const RateLimitStore::Window& window) {
+            std::lock_guard<std::mutex> lock(reply->mutex);
+            reply->done = true;
+            reply->counted = counted;
+            reply->window = window;
+            reply->replied.notify_one();
+        });
+    {
+        std::unique_lock<std::mutex> lock(reply->mutex);
+        reply->replied.wait_until(lock, deadline, [&reply] { return reply->done; });
+        if (!reply->done || !reply->counted) {
+            lock.unlock();
+            failureCount.fetch_add(1, std::memory_order_relaxed);
+            breaker.recordFailure(nowFunction());
+            return decideLocally(shard, client, priority);
+        }
+    }
+    if (breaker.recordSuccess())
+        reconcile();
+
+    const Seconds now = secondsSinceStart();
+    const RateLimitStore::Window& counted = reply->window;
+    // Requests of the batch beyond the limit are not granted; the store's
+    // count stays above the limit until the window ends
+    int64_t granted = std::clamp<int64_t>(rateLimit.num - (counted.count - batch), 0, batch);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ClientWindow& window = shard.clients[client];
+    if (window.windowEnd <= now)
+        startWindow(window);
+    window.windowEnd = now + std::max<Seconds>(counted.remaining, 1);
+    window.storeCount = std::max(window.storeCount, counted.count);
+    if (granted == 0)
+        return window.windowEnd - now;
+    window.claimed += (uint32_t)granted;
+    return admitClaimed(window, client, priority);
+}
+
+RequestRate::Seconds StoreRateLimiter::admitClaimed(ClientWindow& window,
+    HTTPClientID client, Priority priority)
+{
+    const Seconds waitTime = tracker.debitSharedLimits(client, priority);
+    if (waitTime == 0)
+        window.claimed--;
+    return waitTime;
+}
+
+RequestRate::Seconds StoreRateLimiter::decideLocally(Shard& shard, HTTPClientID client,
+    Priority priority)
+{
+    fallbackCount.fetch_add(1, std::memory_order_relaxed);
+    const Seconds waitTime = tracker.addRequest(client, priority);
+    if (waitTime == 0) {
+        const Seconds now = secondsSinceStart();
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ClientWindow& window = shard.clients[client];
+        if (window.unreconciled == 0 || window.unreconciledEnd <= now) {
+            window.unreconciled = 0;
+            window.unreconciledEnd = now + rateLimit.period;
+        }
+        window.unreconciled++;
+    }
+    return waitTime;
+}
+
+void StoreRateLimiter::startWindow(ClientWindow& window)
+{
+    ClientWindow next;
+    next.unreconciled = window.unreconciled;
+    next.unreconciledEnd = window.unreconciledEnd;
+    window = next;
+}
+
+void StoreRateLimiter::reclaimExpired(Shard& shard, Seconds now)
+{
+    for (auto entry = shard.clients.begin(); entry != shard.clients.end();) {
+        const ClientWindow& window = entry->second;
+        if (window.windowEnd <= now && (window.unreconciled == 0 || window.unreconciledEnd <= now))
+            entry = shard.clients.erase(entry);
+        else
+            ++entry;
+    }
+}
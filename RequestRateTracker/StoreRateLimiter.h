@@ -0,0 +1,176 @@
+#ifndef STORE_RATE_LIMITER_H
+#define STORE_RATE_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include "CircuitBreaker.h"
+#include "KeyedClientHash.h"
+#include "RateLimitStore.h"
+#include "RequestRateTracker.h"
+
+class StoreRateLimiter
+    /// Responsible for rate limiting clients with counts kept in a
+    /// RateLimitStore shared with other processes, while most requests are
+    /// decided without leaving the process.
+    ///
+    /// As with GlobalRequestBudget, requests are claimed before they are
+    /// admitted: the limiter claims a batch of a client's requests from
+    /// the store in one increment, then admits the client's requests from
+    /// its batch locally. Only when the batch is used up does it go to the
+    /// store again. If the store's count shows that the limit is reached,
+    /// the denial is cached until the window ends and later requests of the
+    /// client are denied locally too. Since every admitted request has been
+    /// counted by the store, the limit is never exceeded over all
+    /// processes. The cost is that requests may be denied while other
+    /// processes still hold unused parts of their batches, less than
+    /// maxBatch per process and window.
+    ///
+    /// Batches shrink to an eighth of the requests left in the window, so
+    /// small limits get batches of a single request and are exact.
+    ///
+    /// The request which claims a batch waits for the store, up to timeout
+    /// including sending the claim. Sending may open the connection, which
+    /// a RespClient attempts at most once per retry delay and its transport
+    /// bounds by its own timeouts. If the store fails or does not answer in
+    /// time, the request is decided by the local tracker alone, an
+    /// approximation of the shared limit, and counted by storeFailures().
+    /// Failures trip a CircuitBreaker; while it is open, claims are decided
+    /// by the tracker at once, so a slow store does not slow down requests.
+    /// Requests admitted by the tracker are remembered per client and added
+    /// to the store when the breaker closes again, so other processes see
+    /// them for the rest of their windows.
+    ///
+    /// Only the counts of clients are shared. Exempt, blocked and untracked
+    /// clients are decided by the tracker first (see
+    /// RequestRateTracker::admissionOf()), and requests which a client's
+    /// shared count allows are also counted in the tracker's subnet,
+    /// tenant, global, priority and calendar limits. A request denied by
+    /// one of them is returned to the client's batch.
+{
+public:
+    using HTTPClientID = RequestRateTracker::HTTPClientID;
+    using Priority = RequestRateTracker::Priority;
+    using NowFunction = RequestRateTracker::NowFunction;
+
+    static constexpr size_t maxClients = 1 << 16;
+        /// Per shard; clients whose windows have ended are dropped when a
+        /// shard is full.
+
+    StoreRateLimiter(RequestRateTracker& tracker, RateLimitStore& store,
+        uint32_t maxBatch, std::chrono::milliseconds timeout,
+        NowFunction* nowFunction = std::chrono::steady_clock::now,
+        const CircuitBreaker::Settings& breakerSettings = CircuitBreaker::Settings());
+        /// The limit is the one of the tracker. The tracker and store must
+        /// outlive the limiter.
+
+    StoreRateLimiter(const StoreRateLimiter&) = delete;
+    StoreRateLimiter& operator=(const StoreRateLimiter&) = delete;
+
+    RequestRate::Seconds addRequest(HTTPClientID client, Priority priority = Priority::Normal);
+        /// Same as RequestRateTracker::addRequest() for all processes
+        /// sharing the store.
+
+    uint64_t            localDecisions() const;
+        /// Requests admitted from a batch or denied from the cache, without
+        /// waiting for the store.
+
+    uint64_t            storeRequests() const;
+        /// Batches claimed from the store.
+
+    uint64_t            storeFailures() const;
+        /// Claims which failed or missed their deadline.
+
+    uint64_t            fallbackDecisions() const;
+        /// Requests decided by the local tracker.
+
+    uint64_t            reconciledRequests() const;
+        /// Requests admitted by the local tracker and added to the store
+        /// later.
+
+    void                reconcile();
+        /// Adds requests admitted by the local tracker to the store. Called
+        /// when the breaker closes; the replies are not waited for, and
+        /// requests which the store fails to add are dropped.
+
+    const CircuitBreaker& circuitBreaker() const { return breaker; }
+
+private:
+    using Seconds = RequestRate::Seconds;
+
+    struct ClientWindow
+    {
+        Seconds     windowEnd = 0;
+            /// In seconds since start; 0 if unknown.
+        int64_t     storeCount = 0;
+            /// Latest count of the store in the window.
+        uint32_t    claimed = 0;
+            /// Requests claimed from the store and not admitted yet.
+        uint32_t    unreconciled = 0;
+            /// Requests admitted by the tracker and not added to the store.
+        Seconds     unreconciledEnd = 0;
+            /// When the unreconciled requests are no longer worth adding:
+            /// a period after the first of them.
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex      mutex;
+            /// This mutex must be locked to access the member below.
+        std::unordered_map<HTTPClientID, ClientWindow, KeyedClientHash>
+                        clients;
+    };
+
+    static constexpr size_t shardCount = 16;
+
+    Seconds             secondsSinceStart() const;
+
+    uint32_t            batchSize(const ClientWindow& window) const;
+
+    Seconds             claim(Shard& shard, HTTPClientID client, Priority priority,
+                            uint32_t batch);
+        /// Claims a batch from the store and admits the request from it.
+
+    Seconds             admitClaimed(ClientWindow& window, HTTPClientID client,
+                            Priority priority);
+        /// Admits the request from the claimed requests of the window if
+        /// the tracker's shared limits allow it.
+
+    Seconds             decideLocally(Shard& shard, HTTPClientID client, Priority priority);
+
+    static void         startWindow(ClientWindow& window);
+        /// Forgets the ended window of the client, but not its
+        /// unreconciled requests.
+
+    static void         reclaimExpired(Shard& shard, Seconds now);
+
+    RequestRateTracker& tracker;
+    RateLimitStore&     store;
+    RequestRate         rateLimit;
+    uint32_t            maxBatch;
+    std::chrono::milliseconds
+                        timeout;
+
+    KeyedClientHash     clientHash;
+        /// Assigns clients to shards and hashes them within a shard, so
+        /// clients cannot choose IDs which collide.
+    Shard               shards[shardCount];
+
+    CircuitBreaker      breaker;
+
+    std::atomic<uint64_t> localCount;
+    std::atomic<uint64_t> claimCount;
+    std::atomic<uint64_t> failureCount;
+    std::atomic<uint64_t> fallbackCount;
+    std::atomic<uint64_t> reconciledCount;
+
+    std::chrono::time_point<std::chrono::steady_clock>
+                        startTime;
+
+    NowFunction*        nowFunction;
+};
+
+#endif // STORE_RATE_LIMITER_H
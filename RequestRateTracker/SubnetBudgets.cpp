@@ -0,0 +1,73 @@
+//
+// Per-/24 request limits. See SubnetBudgets class header for details.
+//
+#include "SubnetBudgets.h"
+#include <algorithm>
+
+namespace {
+
+const size_t subnetCount = (size_t)1 << 24;
+
+int64_t windowIndex(SubnetBudgets::Seconds now, SubnetBudgets::Seconds period)
+{
+    int64_t index = now / period;
+    return (now % period < 0) ? index - 1 : index;
+}
+
+} // namespace
+
+SubnetBudgets::SubnetBudgets(int64_t limit, Seconds period, bool hugePages)
+    : maxRequests(std::clamp<int64_t>(limit, 1, maxLimit))
+    , periodLength(std::max<Seconds>(period, 1))
+    , counterBits(1)
+    , region(subnetCount * sizeof(uint32_t), hugePages)
+    , words(static_cast<uint32_t*>(region.data()))
+{
+    while (((int64_t)1 << counterBits) <= maxRequests)
+        counterBits++;
+    counterMask = (1u << counterBits) - 1;
+}
+
+bool SubnetBudgets::tryAcquire(Address client, Seconds now)
+{
+    const uint32_t tag = tagOf(now);
+    std::atomic_ref<uint32_t> word = wordOf(client);
+    uint32_t expected = word.load(std::memory_order_relaxed);
+    for (;;) {
+        uint32_t count = ((expected >> counterBits) == tag) ? (expected & counterMask) : 0;
+        if ((int64_t)count >= maxRequests)
+            return false;
+        uint32_t desired = (tag << counterBits) | (count + 1);
+        if (word.compare_exchange_weak(expected, desired, std::memory_order_relaxed))
+            return true;
+    }
+}
+
+void SubnetBudgets::release(Address client, Seconds now)
+{
+    const uint32_t tag = tagOf(now);
+    std::atomic_ref<uint32_t> word = wordOf(client);
+    uint32_t expected = word.load(std::memory_order_relaxed);
+    // A counter of another period has nothing to take back
+    while ((expected >> counterBits) == tag && (expected & counterMask) > 0) {
+        if (word.compare_exchange_weak(expected, expected - 1, std::memory_order_relaxed))
+            return;
+    }
+}
+
+int64_t SubnetBudgets::count(Address client, Seconds now) const
+{
+    uint32_t word = wordOf(client).load(std::memory_order_relaxed);
+    return ((word >> counterBits) == tagOf(now)) ? (int64_t)(word & counterMask) : 0;
+}
+
+SubnetBudgets::Seconds SubnetBudgets::periodEnd(Seconds now) const
+{
+    return (windowIndex(now, periodLength) + 1) * periodLength;
+}
+
+uint32_t SubnetBudgets::tagOf(Seconds now) const
+    /// Index of the period modulo 2^(32 - counterBits).
+{
+    return (uint32_t)windowIndex(now, periodLength) & (0xFFFFFFFFu >> counterBits);
+}
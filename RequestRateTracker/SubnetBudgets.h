@@ -0,0 +1,80 @@
+#ifndef SUBNET_BUDGETS_H
+#define SUBNET_BUDGETS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "PageRegion.h"
+
+class SubnetBudgets
+    /// Responsible for a request limit shared by all clients of each IPv4
+    /// /24 prefix.
+    ///
+    /// Counters are kept in a directly indexed array of 32-bit words, one
+    /// per /24 prefix (64 MiB of address space for all 2^24 prefixes), so
+    /// a request touches exactly one cache line of the array and no lock.
+    /// The array is preallocated zero-filled and pages are only backed by
+    /// memory once a subnet in them sends a request.
+    ///
+    /// A word packs the counter into its low bits and the index of the
+    /// counter's period modulo the remaining bits into its high bits, so
+    /// counters of past periods are recognised and reset without a sweep.
+    /// Periods are aligned to multiples of the period.
+    ///
+    /// The period index wraps: a subnet without requests for exactly
+    /// a multiple of 2^(32 - counter bits) periods finds the count it left.
+    /// Limits are at most maxLimit, so at least 20 bits remain for the
+    /// index, and the wrap takes over a million periods (12 days with
+    /// a period of one second).
+{
+public:
+    using Address = uint32_t;
+    using Seconds = int64_t;
+
+    static constexpr int64_t maxLimit = ((int64_t)1 << 12) - 1;
+        /// Larger limits would leave fewer than 20 bits to tell periods
+        /// apart.
+
+    SubnetBudgets(int64_t limit, Seconds period, bool hugePages = false);
+        /// limit must be between 1 and maxLimit, period must be positive.
+
+    SubnetBudgets(const SubnetBudgets&) = delete;
+    SubnetBudgets& operator=(const SubnetBudgets&) = delete;
+
+    bool        tryAcquire(Address client, Seconds now);
+        /// Counts a request of the client's subnet at now (seconds on the
+        /// caller's clock) if the subnet's limit allows it. The return is
+        /// false if the request is denied; it is not counted then.
+
+    void        release(Address client, Seconds now);
+        /// Takes back a request counted by tryAcquire() at now.
+
+    int64_t     count(Address client, Seconds now) const;
+        /// Requests counted for the client's subnet in the period including now.
+
+    Seconds     periodEnd(Seconds now) const;
+
+    int64_t     limit() const { return maxRequests; }
+
+    Seconds     period() const { return periodLength; }
+
+private:
+    std::atomic_ref<uint32_t> wordOf(Address client) const
+    {
+        return std::atomic_ref<uint32_t>(words[client >> 8]);
+    }
+
+    uint32_t    tagOf(Seconds now) const;
+
+    int64_t     maxRequests;
+    Seconds     periodLength;
+    unsigned    counterBits;
+    uint32_t    counterMask;
+
+    PageRegion  region;
+    uint32_t*   words;
+        /// Accessed through std::atomic_ref, so zero-filled pages are
+        /// used as they are.
+};
+
+#endif // SUBNET_BUDGETS_H
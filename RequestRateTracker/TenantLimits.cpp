@@ -0,0 +1,43 @@
+//
+// Assignment of clients to tenants by IPv4 prefixes. See TenantLimits
+// class header for details.
+//
+#include "TenantLimits.h"
+#include <algorithm>
+
+size_t TenantLimits::addTenant(const Limit& limit)
+{
+    limits.push_back(limit);
+    return limits.size() - 1;
+}
+
+bool TenantLimits::addPrefix(size_t tenant, Address prefix, unsigned prefixLength)
+{
+    if (tenant >= limits.size() || prefixLength > 32)
+        return false;
+
+    const uint64_t size = (uint64_t)1 << (32 - prefixLength);
+    Range range;
+    range.first = (Address)(prefix & ~(size - 1));
+    range.last = (Address)(range.first + (size - 1));
+    range.tenant = tenant;
+
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), range.first,
+        [](Address address, const Range& r) { return address < r.first; });
+    if (next != ranges.end() && next->first <= range.last)
+        return false;
+    if (next != ranges.begin() && std::prev(next)->last >= range.first)
+        return false;
+    ranges.insert(next, range);
+    return true;
+}
+
+int TenantLimits::tenantOf(Address client) const
+{
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), client,
+        [](Address address, const Range& r) { return address < r.first; });
+    if (next == ranges.begin())
+        return -1;
+    --next;
+    return (client <= next->last) ? (int)next->tenant : -1;
+}
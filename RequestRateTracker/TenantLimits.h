@@ -0,0 +1,60 @@
+#ifndef TENANT_LIMITS_H
+#define TENANT_LIMITS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TenantLimits
+    /// Responsible for assigning clients to tenants by IPv4 prefixes and
+    /// for the request limit shared by all clients of each tenant.
+    ///
+    /// A tenant may own any number of prefixes, which must not overlap
+    /// prefixes of other tenants. Prefixes are kept as sorted address
+    /// ranges, so tenantOf() is a binary search over a compact array.
+    /// The list is built once and then only read: to change it, build
+    /// a new list and pass it to RequestRateTracker::setTenantLimits().
+{
+public:
+    using Address = uint32_t;
+
+    struct Limit
+    {
+        int64_t requests;
+            /// Requests of all clients of the tenant per period.
+        int64_t period;
+            /// Period in seconds.
+    };
+
+    size_t      addTenant(const Limit& limit);
+        /// Adds a tenant without prefixes and returns its index. A limit
+        /// of 0 requests denies all requests of the tenant's clients.
+
+    bool        addPrefix(size_t tenant, Address prefix, unsigned prefixLength);
+        /// Assigns clients of prefix/prefixLength to the tenant. Bits of the
+        /// prefix beyond prefixLength are ignored. The return is false if
+        /// the tenant does not exist, prefixLength is longer than 32 or the
+        /// prefix overlaps a prefix already added.
+
+    int         tenantOf(Address client) const;
+        /// Returns index of the client's tenant, or -1 if the client does
+        /// not belong to any tenant.
+
+    const Limit& limitOf(size_t tenant) const { return limits[tenant]; }
+
+    size_t      size() const { return limits.size(); }
+
+private:
+    struct Range
+    {
+        Address first;
+        Address last;
+        size_t  tenant;
+    };
+
+    std::vector<Limit>  limits;
+    std::vector<Range>  ranges;
+        /// Sorted by first address, not overlapping.
+};
+
+#endif // TENANT_LIMITS_H
@@ -0,0 +1,240 @@
+//
+// In-process RESP server for tests and benchmarks. See MockRespServer
+// class header for details.
+//
+#include "MockRespServer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include "RespRateLimitStore.h"
+
+namespace {
+
+Resp::Reply simpleReply(const std::string& text)
+{
+    Resp::Reply reply;
+    reply.type = Resp::Reply::Type::SimpleString;
+    reply.text = text;
+    return reply;
+}
+
+Resp::Reply integerReply(int64_t value)
+{
+    Resp::Reply reply;
+    reply.type = Resp::Reply::Type::Integer;
+    reply.integer = value;
+    return reply;
+}
+
+Resp::Reply bulkReply(const std::string& text)
+{
+    Resp::Reply reply;
+    reply.type = Resp::Reply::Type::BulkString;
+    reply.text = text;
+    return reply;
+}
+
+std::string digestOf(const std::string& script)
+{
+    // Any 40 hex digits do, as long as they are the same for a script
+    char digest[41];
+    size_t hash = std::hash<std::string>()(script);
+    for (int i = 0; i < 40; i++)
+        digest[i] = "0123456789abcdef"[(hash >> ((i % 16) * 4)) & 15];
+    digest[40] = 0;
+    return digest;
+}
+
+} // namespace
+
+MockRespServer::Connection::Connection(MockRespServer& server)
+    : server(server), opened(false)
+{
+    std::lock_guard<std::mutex> lock(server.mutex);
+    server.connections.push_back(this);
+}
+
+MockRespServer::Connection::~Connection()
+{
+    std::lock_guard<std::mutex> lock(server.mutex);
+    server.connections.erase(std::find(server.connections.begin(),
+        server.connections.end(), this));
+}
+
+bool MockRespServer::Connection::open()
+{
+    std::chrono::milliseconds latency;
+    {
+        std::lock_guard<std::mutex> serverLock(server.mutex);
+        latency = server.connectLatency;
+    }
+    std::this_thread::sleep_for(latency);
+    {
+        std::lock_guard<std::mutex> serverLock(server.mutex);
+        if (!server.available)
+            return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    opened = true;
+    parser = Resp::Parser();
+    output.clear();
+    return true;
+}
+
+bool MockRespServer::Connection::write(const char* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!opened)
+        return false;
+    parser.feed(data, size);
+    std::string replies;
+    Resp::Reply command;
+    while (parser.next(command))
+        Resp::appendReply(server.execute(command), replies);
+    if (parser.failed())
+        opened = false;
+    if (!replies.empty()) {
+        std::chrono::milliseconds latency;
+        {
+            std::lock_guard<std::mutex> serverLock(server.mutex);
+            latency = server.latency;
+        }
+        output.emplace_back(std::chrono::steady_clock::now() + latency, std::move(replies));
+        readable.notify_one();
+    }
+    return opened;
+}
+
+long MockRespServer::Connection::read(char* data, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        readable.wait(lock, [this] { return !output.empty() || !opened; });
+        if (output.empty())
+            return 0;
+        auto ready = output.front().first;
+        if (std::chrono::steady_clock::now() >= ready)
+            break;
+        readable.wait_until(lock, ready);
+    }
+    std::string& replies = output.front().second;
+    size_t length = std::min(size, replies.size());
+    replies.copy(data, length);
+    replies.erase(0, length);
+    if (replies.empty())
+        output.pop_front();
+    return (long)length;
+}
+
+void MockRespServer::Connection::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    opened = false;
+    output.clear();
+    readable.notify_all();
+}
+
+MockRespServer::MockRespServer(RequestRateTracker::NowFunction* nowFunction)
+    : nowFunction(nowFunction), available(true), latency(0), connectLatency(0)
+{
+}
+
+std::unique_ptr<MockRespServer::Connection> MockRespServer::connect()
+{
+    return std::make_unique<Connection>(*this);
+}
+
+void MockRespServer::setAvailable(bool available)
+{
+    std::vector<Connection*> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->available = available;
+        if (!available)
+            dropped = connections;
+    }
+    for (Connection* connection : dropped)
+        connection->close();
+}
+
+void MockRespServer::setLatency(std::chrono::milliseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->latency = latency;
+}
+
+void MockRespServer::setConnectLatency(std::chrono::milliseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    connectLatency = latency;
+}
+
+uint64_t MockRespServer::commands(const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = commandCounts.find(name);
+    return found != commandCounts.end() ? found->second : 0;
+}
+
+Resp::Reply MockRespServer::execute(const Resp::Reply& command)
+{
+    std::vector<std::string> arguments;
+    for (const Resp::Reply& argument : command.elements) {
+        if (argument.type != Resp::Reply::Type::BulkString)
+            return Resp::errorReply("ERR Protocol error");
+        arguments.push_back(argument.text);
+    }
+    if (command.type != Resp::Reply::Type::Array || arguments.empty())
+        return Resp::errorReply("ERR Protocol error");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::string& name = arguments[0];
+    commandCounts[name]++;
+    if (name == "PING")
+        return simpleReply("PONG");
+    if (name == "SCRIPT" && arguments.size() == 3 && arguments[1] == "LOAD") {
+        std::string digest = digestOf(arguments[2]);
+        scripts[digest] = arguments[2];
+        return bulkReply(digest);
+    }
+    if (name == "SCRIPT" && arguments.size() == 2 && arguments[1] == "FLUSH") {
+        scripts.clear();
+        return simpleReply("OK");
+    }
+    if (name == "GET" && arguments.size() == 2) {
+        auto found = counters.find(arguments[1]);
+        if (found == counters.end() || found->second.expires <= nowFunction())
+            return Resp::Reply();
+        return bulkReply(std::to_string(found->second.value));
+    }
+    if ((name == "EVAL" || name == "EVALSHA") && arguments.size() == 6 && arguments[2] == "1") {
+        std::string script = arguments[1];
+        if (name == "EVALSHA") {
+            auto found = scripts.find(script);
+            if (found == scripts.end())
+                return Resp::errorReply("NOSCRIPT No matching script. Please use EVAL.");
+            script = found->second;
+        }
+        if (script != RespRateLimitStore::script)
+            return Resp::errorReply("ERR script not supported by the mock");
+        return increment(arguments[3], std::atoll(arguments[4].c_str()),
+            std::atoll(arguments[5].c_str()));
+    }
+    return Resp::errorReply("ERR unknown command '" + name + "'");
+}
+
+Resp::Reply MockRespServer::increment(const std::string& key, int64_t requests, int64_t period)
+{
+    auto now = nowFunction();
+    Counter& counter = counters[key];
+    if (counter.expires <= now)
+        counter = Counter{ 0, now + std::chrono::seconds(period) };
+    counter.value += requests;
+    Resp::Reply reply;
+    reply.type = Resp::Reply::Type::Array;
+    reply.elements.push_back(integerReply(counter.value));
+    reply.elements.push_back(integerReply(std::chrono::duration_cast<std::chrono::seconds>(
+        counter.expires - now).count()));
+    return reply;
+}
@@ -0,0 +1,108 @@
+#ifndef MOCK_RESP_SERVER_H
+#define MOCK_RESP_SERVER_H
+
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Resp.h"
+#include "RespClient.h"
+#include "RequestRateTracker.h"
+
+class MockRespServer
+    /// In-process stand-in for a Redis compatible store, which speaks RESP
+    /// over in-memory connections, so RespClient and RespRateLimitStore are
+    /// tested down to the bytes on the wire.
+    ///
+    /// It knows PING, SCRIPT LOAD, SCRIPT FLUSH (which stands for a restart
+    /// of the store), GET, EVALSHA and EVAL, and runs only the script of
+    /// RespRateLimitStore, natively. Keys expire on the clock given to the
+    /// server. Replies and connections can be delayed in real time, to
+    /// stand for a slow store.
+{
+public:
+    class Connection : public RespClient::Transport
+    {
+    public:
+        explicit Connection(MockRespServer& server);
+
+        ~Connection();
+
+        bool    open() override;
+
+        bool    write(const char* data, size_t size) override;
+            /// Runs the commands written and queues their replies.
+
+        long    read(char* data, size_t size) override;
+
+        void    close() override;
+
+    private:
+        MockRespServer&         server;
+        std::mutex              mutex;
+            /// This mutex must be locked to access the members below.
+        std::condition_variable readable;
+        bool                    opened;
+        Resp::Parser            parser;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>>
+                                output;
+            /// Replies and when they may be read.
+    };
+
+    explicit MockRespServer(RequestRateTracker::NowFunction* nowFunction);
+
+    std::unique_ptr<Connection> connect();
+
+    void        setAvailable(bool available);
+        /// An unavailable server refuses connections and drops the open
+        /// ones.
+
+    void        setLatency(std::chrono::milliseconds latency);
+        /// Delays replies to commands written from now on.
+
+    void        setConnectLatency(std::chrono::milliseconds latency);
+        /// Delays attempts to connect from now on, e.g. to stand for a
+        /// store whose address does not answer until connecting times out.
+
+    uint64_t    commands(const std::string& name) const;
+        /// Commands of the name run so far, e.g. "EVALSHA".
+
+private:
+    Resp::Reply execute(const Resp::Reply& command);
+
+    Resp::Reply increment(const std::string& key, int64_t requests, int64_t period);
+
+    struct Counter
+    {
+        int64_t                                 value;
+        std::chrono::steady_clock::time_point   expires;
+    };
+
+    RequestRateTracker::NowFunction* nowFunction;
+
+    mutable std::mutex      mutex;
+        /// This mutex must be locked to access the members below.
+    bool                    available;
+    std::chrono::milliseconds
+                            latency;
+    std::chrono::milliseconds
+                            connectLatency;
+    std::unordered_map<std::string, Counter>
+                            counters;
+    std::unordered_map<std::string, std::string>
+                            scripts;
+        /// Loaded scripts by digest.
+    std::unordered_map<std::string, uint64_t>
+                            commandCounts;
+    std::vector<Connection*> connections;
+
+    friend class Connection;
+};
+
+#endif // MOCK_RESP_SERVER_H
@@ -19,6 +19,18 @@
 //
 #include "pch.h"
 #include "RequestRateTracker.h"
+#include "RequestWaitQueue.h"
+#include "RateLimiterApi.h"
+#include "ClientListLoader.h"
+#include "ClusterRateLimiter.h"
+#include "RespRateLimitStore.h"
+#include "StoreRateLimiter.h"
+#include "MockRespServer.h"
+#include "CircuitBreaker.h"
+#include "LeaseRateLimiter.h"
+#include "QuotaCoordinator.h"
+#include "StateHandoff.h"
+#include "PropertyLayers.h"
 
 class RequestRateTrackerTest : public CppUnit::TestCase
 {
@@ -36,6 +48,41 @@ public:
     void testMemoryReclaimed();
     void testOneClientIsRateLimited();
     void testRequestDeniedWhenManyRequestsAreAtBoundary();
+    void testClientHashWindowsSpreadResets();
+    void testFirstRequestWindowStartsAtFirstRequest();
+    void testRetryJitterFlattensRetries();
+    void testShardsOnSimulatedNumaNodes();
+    void testFixedCapacityTable();
+    void testOpenWindowsSurviveArenaRelease();
+    void testPackedCountersBytesPerClient();
+    void testPackedWindowStartWrapsAround();
+    void testKeyedHashSpreadsAdversarialKeys();
+    void testFixedTableEraseKeepsSurvivors();
+    void testSubnetStatesBypassCounters();
+    void testExemptClientsAreReloadable();
+    void testResolvedClientSharesCounters();
+    void testAcquireSuspendsUntilQuotaAllows();
+    void testCApiChecksBatchesAndStats();
+    void testGlobalLimitCapsAllClients();
+    void testHierarchicalLimitsRollBack();
+    void testFairShareServesLightClients();
+    void testPriorityClassesBorrowAndShed();
+    void testShadowLimitsAreNotEnforced();
+    void testCalendarQuotasSurviveRestart();
+    void testBulkListsAreLoadedAndSwapped();
+    void testClusterForwardsToOwner();
+    void testStoreClaimsBatchesOverResp();
+    void testSlowStoreTripsBreakerAndReconciles();
+    void testNodesLeaseQuotaFromCoordinator();
+    void testDrainedStateIsHandedOver();
+    void testShardsAreAllocatedWithTheirAlignment();
+    void testSubnetPeriodIndexWrapsAround();
+    void testPriorityCountsOfIdlePeriodsAreReset();
+    void testStoreDefersToTrackerChecks();
+    void testReloadedSettingsKeepTheirLayers();
+    void testUnreachableStoreDelaysOneRequest();
+    void testScriptIsLoadedOnceStoreIsReachable();
+    void testFixedCapacityReleasesArenas();
 
     void setUp()
     {
@@ -79,11 +126,56 @@ private:
     private:
         static time_point timeNow;
     };
+
+    class ManualWallClock
+        /// Provides wall clock which does not move, unless it is set.
+    {
+    public:
+        using time_point = std::chrono::system_clock::time_point;
+
+        static void set(time_point t) {
+            timeNow = t;
+        }
+        static void advance(std::chrono::system_clock::duration d) {
+            timeNow += d;
+        }
+        static time_point now() {
+            return timeNow;
+        }
+
+    private:
+        static time_point timeNow;
+    };
+
+    struct DetachedTask
+        /// Coroutine which starts at once and destroys itself when it ends.
+    {
+        struct promise_type
+        {
+            DetachedTask get_return_object() { return DetachedTask(); }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    static DetachedTask acquireRequest(RequestWaitQueue& queue,
+        RequestRateTracker::HTTPClientID client, std::vector<int>& acquired, int request)
+        /// Appends request to acquired when it is allowed, or -request
+        /// if the queue was shut down.
+    {
+        bool allowed = co_await queue.acquire(client);
+        acquired.push_back(allowed ? request : -request);
+    }
 };
 
 RequestRateTrackerTest::ManualClock::time_point
     RequestRateTrackerTest::ManualClock::timeNow(time_point(duration(0)));
 
+RequestRateTrackerTest::ManualWallClock::time_point
+    RequestRateTrackerTest::ManualWallClock::timeNow;
+
 CppUnit::Test* RequestRateTrackerTest::suite()
 {
     CppUnit::TestSuite* pSuite = new CppUnit::TestSuite("RequestRateTrackerTest");
@@ -97,6 +189,42 @@ CppUnit::Test* RequestRateTrackerTest::suite()
     CppUnit_addTest(pSuite, RequestRateTrackerTest, testOneClientIsRateLimited);
     CppUnit_addTest(pSuite, RequestRateTrackerTest,
         testRequestDeniedWhenManyRequestsAreAtBoundary);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testClientHashWindowsSpreadResets);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest,
+        testFirstRequestWindowStartsAtFirstRequest);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testRetryJitterFlattensRetries);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testShardsOnSimulatedNumaNodes);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testFixedCapacityTable);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testOpenWindowsSurviveArenaRelease);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testPackedCountersBytesPerClient);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testPackedWindowStartWrapsAround);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testKeyedHashSpreadsAdversarialKeys);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testFixedTableEraseKeepsSurvivors);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testSubnetStatesBypassCounters);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testExemptClientsAreReloadable);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testResolvedClientSharesCounters);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testAcquireSuspendsUntilQuotaAllows);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testCApiChecksBatchesAndStats);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testGlobalLimitCapsAllClients);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testHierarchicalLimitsRollBack);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testFairShareServesLightClients);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testPriorityClassesBorrowAndShed);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testShadowLimitsAreNotEnforced);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testCalendarQuotasSurviveRestart);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testBulkListsAreLoadedAndSwapped);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testClusterForwardsToOwner);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testStoreClaimsBatchesOverResp);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testSlowStoreTripsBreakerAndReconciles);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testNodesLeaseQuotaFromCoordinator);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testDrainedStateIsHandedOver);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testShardsAreAllocatedWithTheirAlignment);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testSubnetPeriodIndexWrapsAround);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testPriorityCountsOfIdlePeriodsAreReset);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testStoreDefersToTrackerChecks);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testReloadedSettingsKeepTheirLayers);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testUnreachableStoreDelaysOneRequest);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testScriptIsLoadedOnceStoreIsReachable);
+    CppUnit_addTest(pSuite, RequestRateTrackerTest, testFixedCapacityReleasesArenas);
 
     return pSuite;
 }
@@ -220,6 +348,1424 @@ void RequestRateTrackerTest::testRequestDeniedWhenManyRequestsAreAtBoundary()
     assertEqual(2, waitTime[2]);
 }
 
+void RequestRateTrackerTest::testClientHashWindowsSpreadResets()
+    /// Clients denied at the same moment must not be told to come back at the
+    /// same moment when windows are aligned by client hash. Replays a flood
+    /// from many clients and checks that wait times cover most of the period.
+{
+    const RequestRate::Seconds period = 60;
+    RequestRateTracker tracker(RequestRate{ 1, period }, ManualClock::now);
+    tracker.setWindowAlignment(RequestRateTracker::WindowAlignment::ClientHash);
+
+    std::vector<int> resetsPerSecond(period + 1, 0);
+    for (RequestRateTracker::HTTPClientID id = 0x0A000001; id <= 0x0A000258; id++) {
+        assertEqual(0, tracker.addRequest(id));
+        auto waitTime = tracker.addRequest(id);
+        assert(waitTime > 0 && waitTime <= period);
+        resetsPerSecond[waitTime]++;
+    }
+
+    int secondsWithResets = 0;
+    int maxResetsPerSecond = 0;
+    for (int resets : resetsPerSecond) {
+        secondsWithResets += (resets > 0) ? 1 : 0;
+        maxResetsPerSecond = std::max(maxResetsPerSecond, resets);
+    }
+    // 600 clients: global alignment would put all of them into a single second.
+    assert(secondsWithResets >= 50);
+    assert(maxResetsPerSecond <= 30);
+}
+
+void RequestRateTrackerTest::testFirstRequestWindowStartsAtFirstRequest()
+{
+    requestRateTracker->setWindowAlignment(RequestRateTracker::WindowAlignment::FirstRequest);
+
+    ManualClock::advance(std::chrono::seconds(7));
+    assertEqual(0, requestRateTracker->addRequest(33));
+    ManualClock::advance(std::chrono::seconds(5));      // t = 12
+    assertEqual(0, requestRateTracker->addRequest(33));
+    // Window of the client started at t = 7 and ends at t = 17
+    assertEqual(5, requestRateTracker->addRequest(33));
+
+    ManualClock::advance(std::chrono::seconds(5));      // t = 17
+    assertEqual(0, requestRateTracker->addRequest(33));
+    assertEqual(1, requestRateTracker->size());
+}
+
+void RequestRateTrackerTest::testRetryJitterFlattensRetries()
+    /// Simulates a flood which is denied at the same moment and checks that
+    /// clients are told to retry at different, but repeatable, times which are
+    /// never earlier than the end of their window.
+{
+    const RequestRate::Seconds jitter = 20;
+    requestRateTracker->setRetryJitter(jitter);
+
+    std::vector<int> retriesPerSecond(rateLimit.period + jitter + 1, 0);
+    for (RequestRateTracker::HTTPClientID id = 0x0A000001; id <= 0x0A0000C8; id++) {
+        requestRateTracker->addRequest(id);
+        requestRateTracker->addRequest(id);
+        auto waitTime = requestRateTracker->addRequest(id);
+        assert(waitTime >= rateLimit.period && waitTime <= rateLimit.period + jitter);
+        assertEqual(waitTime, requestRateTracker->addRequest(id));
+        retriesPerSecond[waitTime]++;
+    }
+
+    int maxRetriesPerSecond = 0;
+    for (int retries : retriesPerSecond)
+        maxRetriesPerSecond = std::max(maxRetriesPerSecond, retries);
+    // 200 clients over 21 possible seconds: without jitter all retry at once.
+    assert(maxRetriesPerSecond <= 25);
+}
+
+void RequestRateTrackerTest::testShardsOnSimulatedNumaNodes()
+    /// Clients must be rate-limited the same way when the tracker is split
+    /// into shards over several nodes, and requests handled by a thread on
+    /// a node which does not own the client must be reported.
+{
+    SimulatedNumaTopology topology(2);
+    RequestRateTracker tracker(rateLimit, topology, 4, ManualClock::now);
+
+    std::vector<RequestRateTracker::HTTPClientID> node0Clients;
+    for (RequestRateTracker::HTTPClientID id = 1; id <= 100; id++) {
+        if (tracker.nodeOf(id) == 0)
+            node0Clients.push_back(id);
+    }
+    assert(node0Clients.size() > 25 && node0Clients.size() < 75);
+
+    topology.pinCurrentThread(0);
+    for (auto id : node0Clients) {
+        assertEqual(0, tracker.addRequest(id));
+        assertEqual(0, tracker.addRequest(id));
+        assertEqual(rateLimit.period, tracker.addRequest(id));
+    }
+    assertEqual(node0Clients.size() * 3, tracker.localRequests());
+    assertEqual(0, tracker.crossNodeRequests());
+    assertEqual(node0Clients.size(), tracker.size());
+
+    topology.pinCurrentThread(1);
+    assertEqual(rateLimit.period, tracker.addRequest(node0Clients[0]));
+    assertEqual(1, tracker.crossNodeRequests());
+    topology.pinCurrentThread(0);
+}
+
+void RequestRateTrackerTest::testFixedCapacityTable()
+    /// Fixed-capacity table must limit clients like the default table, let
+    /// requests of clients it has no room for through, and keep clients with
+    /// open windows when expired ones are reclaimed.
+{
+    requestRateTracker->setWindowAlignment(RequestRateTracker::WindowAlignment::FirstRequest);
+    requestRateTracker->setFixedCapacity(64, true);
+    const RequestRateTracker::HTTPClientID clients = 64 + 64 / 8;
+
+    for (RequestRateTracker::HTTPClientID id = 1; id <= clients; id++)
+        assertEqual(0, requestRateTracker->addRequest(id * 2 - 1));
+    assertEqual(clients, requestRateTracker->size());
+    assertEqual(0, requestRateTracker->addRequest(2));
+    assertEqual(0, requestRateTracker->addRequest(2));
+    assertEqual(0, requestRateTracker->addRequest(2));
+    assertEqual(3, requestRateTracker->overflowRequests());
+
+    // At t = 10 global rollover reclaims all windows
+    ManualClock::advance(std::chrono::seconds(10));
+    assertEqual(0, requestRateTracker->addRequest(2));
+    assertEqual(1, requestRateTracker->size());
+
+    ManualClock::advance(std::chrono::seconds(5));      // t = 15
+    for (RequestRateTracker::HTTPClientID id = 4; id <= clients; id += 2) {
+        assertEqual(0, requestRateTracker->addRequest(id));
+        assertEqual(0, requestRateTracker->addRequest(id));
+        assertEqual(10, requestRateTracker->addRequest(id));
+    }
+
+    // At t = 20 only the window of client 2 is reclaimed
+    ManualClock::advance(std::chrono::seconds(5));
+    assertEqual(0, requestRateTracker->addRequest(1));
+    assertEqual(clients / 2, requestRateTracker->size());
+    for (RequestRateTracker::HTTPClientID id = 4; id <= clients; id += 2)
+        assertEqual(5, requestRateTracker->addRequest(id));
+}
+
+void RequestRateTrackerTest::testOpenWindowsSurviveArenaRelease()
+    /// Counters of clients whose windows are still open at the global rollover
+    /// must be carried over to the new arena for several rollovers in a row.
+{
+    requestRateTracker->setWindowAlignment(RequestRateTracker::WindowAlignment::FirstRequest);
+
+    for (RequestRateTracker::HTTPClientID id = 1; id <= 1000; id++)
+        requestRateTracker->addRequest(id);
+    ManualClock::advance(std::chrono::seconds(7));      // t = 7
+    requestRateTracker->addRequest(5000);
+    requestRateTracker->addRequest(5000);
+
+    ManualClock::advance(std::chrono::seconds(4));      // t = 11
+    requestRateTracker->addRequest(6000);
+    assertEqual(2, requestRateTracker->size());
+    assertEqual(6, requestRateTracker->addRequest(5000));
+
+    ManualClock::advance(std::chrono::seconds(10));     // t = 21
+    assertEqual(0, requestRateTracker->addRequest(6000));
+    assertEqual(0, requestRateTracker->addRequest(5000));
+    assertEqual(2, requestRateTracker->size());
+    assertEqual(0, requestRateTracker->addRequest(6000));
+    assertEqual(10, requestRateTracker->addRequest(6000));
+}
+
+void RequestRateTrackerTest::testPackedCountersBytesPerClient()
+    /// Fixed-capacity tables must take 8 bytes (plus a control byte) per client
+    /// when the rate limit fits into a packed window, and fall back to wide
+    /// slots otherwise.
+{
+    size_t growableBytes = requestRateTracker->bytesPerClient();
+    requestRateTracker->setFixedCapacity(1000, false);
+    assertEqual(9, requestRateTracker->bytesPerClient());
+    assert(growableBytes > 9);
+
+    const RequestRate::Seconds tenYears = 10L * 365 * 24 * 3600;
+    RequestRateTracker wide(RequestRate{ 100, tenYears }, ManualClock::now);
+    wide.setFixedCapacity(1000, false);
+    assert(wide.bytesPerClient() > 9);
+    assertEqual(0, wide.addRequest(33));
+}
+
+void RequestRateTrackerTest::testPackedWindowStartWrapsAround()
+    /// With a 21-bit counter only 11 bits (2048 seconds) are left for window
+    /// start. Limits must still be enforced after the stored start wraps.
+{
+    const int num = 1 << 20;
+    const RequestRate::Seconds period = 500;
+    RequestRateTracker tracker(RequestRate{ num, period }, ManualClock::now);
+    tracker.setWindowAlignment(RequestRateTracker::WindowAlignment::ClientHash);
+    tracker.setFixedCapacity(16, false);
+    assertEqual(9, tracker.bytesPerClient());
+
+    for (int round = 0; round < 3; round++) {
+        ManualClock::advance(std::chrono::seconds(1900));
+        for (int i = 0; i < num; i++)
+            tracker.addRequest(77);
+        auto waitTime = tracker.addRequest(77);
+        assert(waitTime > 0 && waitTime <= period);
+        ManualClock::advance(std::chrono::seconds(waitTime - 1));
+        assertEqual(1, tracker.addRequest(77));
+        ManualClock::advance(std::chrono::seconds(1));
+        assertEqual(0, tracker.addRequest(77));
+    }
+}
+
+void RequestRateTrackerTest::testKeyedHashSpreadsAdversarialKeys()
+    /// Addresses which all fall into one bucket under the identity hash (same
+    /// low bits, as an attacker controlling the high bits would pick) must be
+    /// spread evenly by the keyed hash, and the spread must depend on the seed.
+{
+    const size_t buckets = 1024;
+    const uint32_t keys = 16 * buckets;
+    KeyedClientHash hash(12345);
+    KeyedClientHash otherHash(54321);
+
+    std::vector<int> load(buckets, 0);
+    uint32_t sameBucket = 0;
+    for (uint32_t i = 0; i < keys; i++) {
+        uint32_t client = 0x0A000000 + i * (uint32_t)buckets;
+        load[hash(client) % buckets]++;
+        if (hash(client) % buckets == otherHash(client) % buckets)
+            sameBucket++;
+    }
+    // Identity hash would put all 16384 keys into one bucket
+    assert(*std::max_element(load.begin(), load.end()) <= 48);
+    assert(sameBucket < keys / 64);
+    assertEqual(hash(0x0A000001), KeyedClientHash(12345)(0x0A000001));
+}
+
+void RequestRateTrackerTest::testFixedTableEraseKeepsSurvivors()
+    /// Clients which survive eraseIf() must still be found with their values
+    /// after the in-place rehash, also when the table is nearly full and
+    /// probe sequences wrap around the end of the slots.
+{
+    uint32_t random = 12345;
+    auto next = [&random]() { random = random * 1103515245u + 12345u; return random >> 8; };
+
+    for (uint32_t capacity = 8; capacity <= 400; capacity += 13) {
+        const uint32_t keyRange = capacity * 3;
+        FixedClientTable<uint32_t> table(capacity, false);
+        std::vector<uint32_t> expected(keyRange, 0);
+        for (int round = 0; round < 20; round++) {
+            for (uint32_t n = next() % (capacity + capacity / 2); n > 0; n--) {
+                uint32_t key = next() % keyRange;
+                uint32_t* value = table.findOrInsert(key);
+                if (value == nullptr) {
+                    assertEqual(capacity, table.size());
+                    continue;
+                }
+                ++*value;
+                ++expected[key];
+            }
+            const uint32_t erased = next() % 4;
+            table.eraseIf([erased](uint32_t value) { return value % 4 == erased; });
+            size_t survivors = 0;
+            for (uint32_t key = 0; key < keyRange; key++) {
+                if (expected[key] % 4 == erased)
+                    expected[key] = 0;
+                uint32_t* value = table.find(key);
+                if (expected[key] == 0) {
+                    assert(value == nullptr);
+                    continue;
+                }
+                assert(value != nullptr && *value == expected[key]);
+                survivors++;
+            }
+            assertEqual(survivors, table.size());
+        }
+    }
+}
+
+void RequestRateTrackerTest::testSubnetStatesBypassCounters()
+    /// Requests of exempt subnets must always be allowed and requests of
+    /// blocked subnets always denied, without counting them. Other clients,
+    /// including neighbours of a blocked /24, must be limited as before.
+{
+    const auto exempt = RequestRateTracker::getClientId("10.1.2.3");
+    const auto blocked = RequestRateTracker::getClientId("192.168.77.5");
+    const auto neighbour = RequestRateTracker::getClientId("192.168.78.5");
+    assert(requestRateTracker->setSubnetState(
+        RequestRateTracker::getClientId("10.0.0.0"), 8, Ipv4PrefixMap::State::Exempt));
+    assert(requestRateTracker->setSubnetState(blocked, 24, Ipv4PrefixMap::State::Blocked));
+    assert(!requestRateTracker->setSubnetState(blocked, 25, Ipv4PrefixMap::State::Blocked));
+
+    for (int i = 0; i < 10; i++) {
+        assertEqual(0, requestRateTracker->addRequest(exempt));
+        assertEqual(10, requestRateTracker->addRequest(blocked));
+    }
+    assertEqual(0, requestRateTracker->size());
+
+    assertEqual(0, requestRateTracker->addRequest(neighbour));
+    assertEqual(0, requestRateTracker->addRequest(neighbour));
+    assertEqual(10, requestRateTracker->addRequest(neighbour));
+
+    // Unblocked subnet is tracked again
+    assert(requestRateTracker->setSubnetState(blocked, 16, Ipv4PrefixMap::State::Tracked));
+    assertEqual(0, requestRateTracker->addRequest(blocked));
+    assertEqual(10, requestRateTracker->addRequest(neighbour));
+    assertEqual(2, requestRateTracker->size());
+}
+
+void RequestRateTrackerTest::testExemptClientsAreReloadable()
+    /// Clients of allowlisted prefixes must not be limited nor counted, and
+    /// a replaced allowlist must take effect for the following requests.
+{
+    ClientAllowlist allowlist;
+    assertEqual(1, allowlist.addList("10.0.0.0/9, 10.128.0.0/9 192.168.1.15 300.1.1.1/8"));
+    assert(allowlist.contains(RequestRateTracker::getClientId("10.255.255.255")));
+    assert(!allowlist.contains(RequestRateTracker::getClientId("11.0.0.0")));
+    assert(!allowlist.add(0, 33));
+    requestRateTracker->setExemptClients(allowlist);
+
+    const auto internal = RequestRateTracker::getClientId("10.200.0.1");
+    const auto checker = RequestRateTracker::getClientId("192.168.1.15");
+    const auto other = RequestRateTracker::getClientId("192.168.1.16");
+    for (int i = 0; i < 10; i++) {
+        assertEqual(0, requestRateTracker->addRequest(internal));
+        assertEqual(0, requestRateTracker->addRequest(checker));
+    }
+    assertEqual(0, requestRateTracker->size());
+    assertEqual(0, requestRateTracker->addRequest(other));
+    assertEqual(0, requestRateTracker->addRequest(other));
+    assertEqual(10, requestRateTracker->addRequest(other));
+
+    requestRateTracker->setExemptClients(ClientAllowlist());
+    assertEqual(0, requestRateTracker->addRequest(internal));
+    assertEqual(0, requestRateTracker->addRequest(internal));
+    assertEqual(10, requestRateTracker->addRequest(internal));
+
+    ClientAllowlist everyone;
+    assert(everyone.add("0.0.0.0/0"));
+    requestRateTracker->setExemptClients(everyone);
+    assertEqual(0, requestRateTracker->addRequest(other));
+}
+
+void RequestRateTrackerTest::testResolvedClientSharesCounters()
+    /// Requests passed with a resolved handle must be counted together with
+    /// requests passed with the client ID, in growable and fixed tables.
+{
+    const auto client = requestRateTracker->resolveClient(33);
+    assertEqual(33, client.id);
+    assertEqual(0, requestRateTracker->addRequest(client));
+    assertEqual(0, requestRateTracker->addRequest(33));
+    assertEqual(10, requestRateTracker->addRequest(client));
+    assertEqual(1, requestRateTracker->size());
+
+    requestRateTracker->setFixedCapacity(100, false);
+    for (RequestRateTracker::HTTPClientID id = 1; id <= 100; id++) {
+        assertEqual(0, requestRateTracker->addRequest(requestRateTracker->resolveClient(id)));
+        assertEqual(0, requestRateTracker->addRequest(id));
+        assertEqual(10, requestRateTracker->addRequest(requestRateTracker->resolveClient(id)));
+    }
+    assertEqual(100, requestRateTracker->size());
+}
+
+void RequestRateTrackerTest::testAcquireSuspendsUntilQuotaAllows()
+    /// Coroutines must continue at once while the client is within the limit,
+    /// wait in order until its next windows otherwise, and be resumed with
+    /// false when the queue is shut down.
+{
+    std::vector<int> acquired;
+    auto resumeInline = [](std::coroutine_handle<> handle) { handle.resume(); };
+    {
+        RequestWaitQueue queue(*requestRateTracker, resumeInline, false, ManualClock::now);
+        for (int request = 1; request <= 7; request++)
+            acquireRequest(queue, 33, acquired, request);
+        assertEqual(2, acquired.size());
+        assertEqual(5, queue.waiting());
+
+        ManualClock::advance(std::chrono::seconds(9));
+        queue.resumeDue();
+        assertEqual(2, acquired.size());
+
+        ManualClock::advance(std::chrono::seconds(1));      // t = 10
+        queue.resumeDue();
+        assertEqual(4, acquired.size());
+        assertEqual(3, acquired[2]);
+        assertEqual(4, acquired[3]);
+        assertEqual(3, queue.waiting());
+
+        ManualClock::advance(std::chrono::seconds(10));     // t = 20
+        queue.resumeDue();
+        assertEqual(6, acquired.size());
+        assertEqual(1, queue.waiting());
+    }
+    assertEqual(7, acquired.size());
+    assertEqual(-7, acquired[6]);
+}
+
+void RequestRateTrackerTest::testCApiChecksBatchesAndStats()
+    /// C interface must limit clients like the tracker, reject invalid
+    /// arguments, and accept structures of older (smaller) versions.
+{
+    assertEqual(RRT_API_VERSION, rrt_api_version());
+    rrt_config config;
+    config.struct_size = sizeof(config);
+    rrt_config_init(&config);
+    assertEqual(sizeof(config), config.struct_size);
+    config.limit_requests = 2;
+    config.limit_period = 3600;
+    config.fixed_capacity = 100;
+    rrt_tracker* tracker = nullptr;
+    assertEqual(RRT_OK, rrt_create(&config, &tracker));
+    assert(tracker != nullptr);
+
+    const uint32_t client = rrt_client_id("192.168.0.7");
+    assertEqual(0xC0A80007, client);
+    assertEqual(0, rrt_check(tracker, client));
+    const uint32_t clients[] = { client, 8, 8, 8 };
+    int64_t waitTimes[4] = { -1, -1, -1, -1 };
+    assertEqual(RRT_OK, rrt_check_batch(tracker, clients, waitTimes, 4));
+    assertEqual(0, waitTimes[0]);
+    assertEqual(0, waitTimes[1]);
+    assertEqual(0, waitTimes[2]);
+    assert(waitTimes[3] > 0 && waitTimes[3] <= 3600);
+
+    rrt_stats stats;
+    stats.struct_size = sizeof(stats);
+    assertEqual(RRT_OK, rrt_get_stats(tracker, &stats));
+    assertEqual(2, stats.clients);
+    assertEqual(5, stats.local_requests + stats.cross_node_requests);
+    assertEqual(0, stats.overflow_requests);
+
+    // Caller built against a version without bytes_per_client
+    rrt_stats oldStats;
+    oldStats.bytes_per_client = 12345;
+    oldStats.struct_size = offsetof(rrt_stats, bytes_per_client);
+    assertEqual(RRT_OK, rrt_get_stats(tracker, &oldStats));
+    assertEqual(12345, oldStats.bytes_per_client);
+    rrt_destroy(tracker);
+
+    // Caller built against a version without the global limit
+    rrt_config oldConfig;
+    oldConfig.global_limit_requests = 12345;
+    oldConfig.struct_size = offsetof(rrt_config, global_limit_requests);
+    rrt_config_init(&oldConfig);
+    assertEqual(100, oldConfig.limit_requests);
+    assertEqual(12345, oldConfig.global_limit_requests);
+    assertEqual(RRT_OK, rrt_create(&oldConfig, &tracker));
+    rrt_destroy(tracker);
+
+    // Tables which cannot be allocated are reported, not leaked
+    if (sizeof(size_t) == 8) {
+        tracker = nullptr;
+        config.fixed_capacity = (uint64_t)1 << 40;
+        assertEqual(RRT_OUT_OF_MEMORY, rrt_create(&config, &tracker));
+        assert(tracker == nullptr);
+        config.fixed_capacity = 100;
+    }
+
+    assertEqual(RRT_INVALID_ARGUMENT, rrt_check(nullptr, client));
+    config.limit_period = 0;
+    assertEqual(RRT_INVALID_ARGUMENT, rrt_create(&config, &tracker));
+    rrt_destroy(nullptr);
+}
+
+void RequestRateTrackerTest::testGlobalLimitCapsAllClients()
+    /// Requests of all clients together must not exceed the global limit,
+    /// also when counted concurrently in several slices, and requests
+    /// denied by the global limit must not use up their client's limit.
+{
+    requestRateTracker->setGlobalLimit(RequestRate{ 5, 20 }, 2);
+    assertEqual(5, requestRateTracker->getGlobalLimit().num);
+    assertEqual(20, requestRateTracker->getGlobalLimit().period);
+    for (RequestRateTracker::HTTPClientID client = 1; client <= 5; client++)
+        assertEqual(0, requestRateTracker->addRequest(client));
+    assertEqual(20, requestRateTracker->addRequest(6));
+    assertEqual(20, requestRateTracker->addRequest(1));
+
+    // Client windows roll over, the global period does not
+    ManualClock::advance(std::chrono::seconds(10));
+    assertEqual(10, requestRateTracker->addRequest(6));
+    ManualClock::advance(std::chrono::seconds(10));
+    assertEqual(0, requestRateTracker->addRequest(6));
+    assertEqual(0, requestRateTracker->addRequest(6));
+    assertEqual(10, requestRateTracker->addRequest(6));
+
+    requestRateTracker->setGlobalLimit(RequestRate{ 0, 0 });
+    assertEqual(0, requestRateTracker->getGlobalLimit().num);
+    for (RequestRateTracker::HTTPClientID client = 10; client < 20; client++)
+        assertEqual(0, requestRateTracker->addRequest(client));
+
+    // Slices claim batches from the total, so it is never exceeded
+    const int threadCount = 4;
+    const int perThread = 1000;
+    RequestRateTracker tracker(RequestRate{ 100, 10 }, ManualClock::now);
+    tracker.setGlobalLimit(RequestRate{ 1000, 10 }, threadCount);
+    std::atomic<int> admitted(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&tracker, &admitted, t]() {
+            for (int i = 0; i < perThread; i++) {
+                if (tracker.addRequest((RequestRateTracker::HTTPClientID)(t * perThread + i + 1)) == 0)
+                    admitted++;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    GlobalRequestBudget budget(1000, 10, threadCount);
+    assert(admitted <= 1000);
+    assert(admitted >= 1000 - budget.maxUnused());
+}
+
+void RequestRateTrackerTest::testHierarchicalLimitsRollBack()
+    /// A request must be counted for its client, subnet, tenant and the
+    /// global limit only if all of them allow it: levels counted before
+    /// the denying one must be credited back.
+{
+    const auto a = RequestRateTracker::getClientId("10.1.1.1");
+    const auto b = RequestRateTracker::getClientId("10.1.1.2");
+    const auto c = RequestRateTracker::getClientId("10.1.2.1");
+    const auto d = RequestRateTracker::getClientId("10.1.2.2");
+    const auto e = RequestRateTracker::getClientId("10.1.2.3");
+    TenantLimits tenants;
+    size_t tenant = tenants.addTenant(TenantLimits::Limit{ 3, 20 });
+    assert(tenants.addPrefix(tenant, RequestRateTracker::getClientId("10.1.0.0"), 16));
+    assert(!tenants.addPrefix(tenant, c, 24));
+    assert(!tenants.addPrefix(tenant + 1, 0, 8));
+    assertEqual((int)tenant, tenants.tenantOf(e));
+    assertEqual(-1, tenants.tenantOf(RequestRateTracker::getClientId("10.2.0.0")));
+
+    assert(!requestRateTracker->setSubnetLimit(RequestRate{ SubnetBudgets::maxLimit + 1, 10 }));
+    assert(requestRateTracker->setSubnetLimit(RequestRate{ 3, 10 }));
+    assertEqual(3, requestRateTracker->getSubnetLimit().num);
+    requestRateTracker->setTenantLimits(tenants);
+
+    assertEqual(0, requestRateTracker->addRequest(a));
+    assertEqual(0, requestRateTracker->addRequest(a));
+    assertEqual(0, requestRateTracker->addRequest(b));
+    assertEqual(10, requestRateTracker->addRequest(b));     // subnet
+    for (int i = 0; i < 3; i++)
+        assertEqual(20, requestRateTracker->addRequest(c)); // tenant
+
+    // Denied requests of c were not counted for it nor for its subnet
+    requestRateTracker->setTenantLimits(TenantLimits());
+    assertEqual(0, requestRateTracker->addRequest(d));
+    assertEqual(0, requestRateTracker->addRequest(c));
+    assertEqual(0, requestRateTracker->addRequest(c));
+    assertEqual(10, requestRateTracker->addRequest(c));     // client
+    assertEqual(10, requestRateTracker->addRequest(e));     // subnet
+
+    // Request denied by the global limit is credited back to its tenant
+    ManualClock::advance(std::chrono::seconds(20));
+    requestRateTracker->setTenantLimits(tenants);
+    requestRateTracker->setGlobalLimit(RequestRate{ 1, 10 }, 1);
+    assertEqual(0, requestRateTracker->addRequest(a));
+    assertEqual(10, requestRateTracker->addRequest(b));     // global
+    requestRateTracker->setGlobalLimit(RequestRate{ 0, 0 });
+    assertEqual(0, requestRateTracker->addRequest(b));
+    assertEqual(0, requestRateTracker->addRequest(b));
+    assertEqual(20, requestRateTracker->addRequest(c));     // tenant
+}
+
+void RequestRateTrackerTest::testFairShareServesLightClients()
+    /// In the fair sharing mode light clients must keep being served in
+    /// full, heavy clients must share the rest of the capacity equally,
+    /// and the share must grow back when heavy clients go away.
+{
+    RequestRateTracker tracker(RequestRate{ 10, 10 }, ManualClock::now);
+    tracker.setFairCapacity(12);
+    assertEqual(10, tracker.getClientLimit());
+    const RequestRateTracker::HTTPClientID light[] = { 1, 2 };
+    const RequestRateTracker::HTTPClientID heavy[] = { 3, 4, 5 };
+    for (auto client : light)
+        assertEqual(0, tracker.addRequest(client));
+    for (auto client : heavy) {
+        for (int i = 0; i < 10; i++)
+            assertEqual(0, tracker.addRequest(client));
+    }
+
+    // Light clients take 2, heavy clients share the other 10
+    tracker.updateFairShare();
+    assertEqual(3, tracker.getClientLimit());
+
+    ManualClock::advance(std::chrono::seconds(10));
+    for (int i = 0; i < 3; i++)
+        assertEqual(0, tracker.addRequest(heavy[0]));
+    assertEqual(10, tracker.addRequest(heavy[0]));
+    assertEqual(0, tracker.addRequest(light[0]));
+
+    // Only one heavy client is left: it may use the whole limit again
+    tracker.updateFairShare();
+    assertEqual(10, tracker.getClientLimit());
+
+    tracker.setFairCapacity(3);
+    tracker.updateFairShare();
+    assertEqual(2, tracker.getClientLimit());
+    tracker.setFairCapacity(0);
+    assertEqual(10, tracker.getClientLimit());
+}
+
+void RequestRateTrackerTest::testPriorityClassesBorrowAndShed()
+    /// Priority classes must be able to borrow unused reservations of lower
+    /// classes but not of higher ones, and lowered capacity must be taken
+    /// from bulk requests first and from critical requests last.
+{
+    using Priority = RequestRateTracker::Priority;
+    assert(!requestRateTracker->setPriorityCapacity(
+        { PriorityCapacity::maxCapacity, 1, 0 }, 10));
+    assert(requestRateTracker->setPriorityCapacity({ 2, 2, 2 }, 10));
+    RequestRateTracker::HTTPClientID client = 1;
+
+    // Normal requests borrow the bulk reservation, critical requests
+    // get their own
+    for (int i = 0; i < 4; i++)
+        assertEqual(0, requestRateTracker->addRequest(client++));
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Normal));
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Bulk));
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Critical));
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Critical));
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Critical));
+
+    // Shedding half of the capacity removes bulk, then part of normal
+    ManualClock::advance(std::chrono::seconds(10));
+    requestRateTracker->setAvailableCapacity(3);
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Bulk));
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Normal));
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Normal));
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Critical));
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Critical));
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Critical));
+
+    // Bulk requests cannot borrow from higher classes
+    requestRateTracker->setAvailableCapacity(100);
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Bulk));
+    assertEqual(0, requestRateTracker->addRequest(client++, Priority::Bulk));
+    assertEqual(10, requestRateTracker->addRequest(client++, Priority::Bulk));
+}
+
+void RequestRateTrackerTest::testShadowLimitsAreNotEnforced()
+    /// Shadow limits must count the requests they would deny and the
+    /// clients affected, while requests are allowed or denied by the real
+    /// limit only.
+{
+    using ShadowLimit = RequestRateTracker::ShadowLimit;
+    const auto global = RequestRateTracker::WindowAlignment::Global;
+    std::vector<ShadowLimit> tooMany(RequestRateTracker::maxShadowLimits + 1,
+        ShadowLimit{ RequestRate{ 1, 10 }, global });
+    assert(!requestRateTracker->setShadowLimits(tooMany));
+    assert(requestRateTracker->setShadowLimits({
+        ShadowLimit{ RequestRate{ 1, 10 }, global },
+        ShadowLimit{ RequestRate{ 3, 20 }, global } }));
+
+    assertEqual(0, requestRateTracker->addRequest(7));
+    assertEqual(0, requestRateTracker->addRequest(7));
+    assertEqual(10, requestRateTracker->addRequest(7));
+    assertEqual(0, requestRateTracker->addRequest(8));
+    ManualClock::advance(std::chrono::seconds(10));
+    assertEqual(0, requestRateTracker->addRequest(7));
+    assertEqual(0, requestRateTracker->addRequest(7));
+
+    std::vector<RequestRateTracker::ShadowReport> reports =
+        requestRateTracker->shadowReports();
+    assertEqual(2, reports.size());
+    assertEqual(6, reports[0].requests);
+    assertEqual(3, reports[0].wouldDeny);
+    assertEqual(2, reports[0].affectedClients);
+    assertEqual(2, reports[0].sampleClients.size());
+    assertEqual(7, reports[0].sampleClients[0]);
+    // The 20 s window of client 7 spans both real windows
+    assertEqual(2, reports[1].wouldDeny);
+    assertEqual(1, reports[1].affectedClients);
+    assertEqual(20, reports[1].limit.rateLimit.period);
+
+    assert(requestRateTracker->setShadowLimits({}));
+    assert(requestRateTracker->shadowReports().empty());
+}
+
+void RequestRateTrackerTest::testCalendarQuotasSurviveRestart()
+    /// Quotas must be reset at local midnight and on the first day of
+    /// a month, and their usage must be restored from the journal after
+    /// a restart, ignoring a record torn by a crash.
+{
+    using namespace std::chrono;
+    const std::string journal = (std::filesystem::temp_directory_path()
+        / "RequestRateTrackerTest.quotas").string();
+    std::filesystem::remove(journal);
+    const CalendarQuotas::Quotas threePerDayFivePerMonth{ 3, 5 };
+    const CalendarQuotas::ClientID client = 0x0A000001;
+    const CalendarQuotas::ClientID other = 0x0A000002;
+
+    // 23:30 on January 30th in UTC+2
+    ManualWallClock::set(sys_days{ 2024y / January / 30 } + 21h + 30min);
+    {
+        CalendarQuotas quotas(threePerDayFivePerMonth, hours(2), ManualWallClock::now);
+        assert(quotas.openJournal(journal, hours(1)));
+        for (int i = 0; i < 3; i++)
+            assertEqual(0, quotas.tryAcquire(client));
+        assertEqual(30 * 60, quotas.tryAcquire(client));
+        ManualWallClock::advance(hours(1));
+        assertEqual(0, quotas.tryAcquire(client));
+        assertEqual(0, quotas.tryAcquire(client));
+        assertEqual(23 * 3600 + 30 * 60, quotas.tryAcquire(client));
+        assert(quotas.commit());
+        assertEqual(1, quotas.commits());
+        // Committed when the quotas are destroyed
+        assertEqual(0, quotas.tryAcquire(other));
+    }
+    {
+        std::ofstream torn(journal, std::ios::binary | std::ios::app);
+        torn.write("torn", 4);
+    }
+
+    {
+        auto quotas = std::make_unique<CalendarQuotas>(threePerDayFivePerMonth, hours(2),
+            ManualWallClock::now);
+        assert(quotas->openJournal(journal, hours(1)));
+        assertEqual(2, quotas->usage(client).daily);
+        assertEqual(5, quotas->usage(client).monthly);
+        assertEqual(1, quotas->usage(other).daily);
+
+        // Requests denied by the client limit must not use the quotas
+        RequestRateTracker tracker(RequestRate{ 1, 10 }, ManualClock::now);
+        tracker.setCalendarQuotas(std::move(quotas));
+        assertEqual(23 * 3600 + 30 * 60, tracker.addRequest(client));
+        assertEqual(0, tracker.addRequest(other));
+        assertEqual(10, tracker.addRequest(other));
+        assertEqual(2, tracker.getCalendarQuotas()->usage(other).daily);
+        ManualWallClock::advance(hours(24));
+        assertEqual(0, tracker.addRequest(client));
+        assertEqual(1, tracker.getCalendarQuotas()->usage(client).monthly);
+    }
+    std::filesystem::remove(journal);
+}
+
+void RequestRateTrackerTest::testBulkListsAreLoadedAndSwapped()
+    /// Lists loaded from files must skip comments and invalid lines, merge
+    /// prefixes, and take effect for tracked and blocked clients at once.
+{
+    const std::string text =
+        "# blocklist\n"
+        "10.0.0.1\r\n"
+        "10.0.0.2/31, 1\n"
+        "\n"
+        "192.168.0.0/16 2 # tier 2\n"
+        "10.0.0.256\n"
+        "10.0.0/8\n"
+        "10.1.0.0/33\n"
+        "10.1.0.0x\n"
+        "172.16.0.1 1 1";
+    std::vector<ClientListLoader::Entry> entries;
+    ClientListLoader::Result parsed =
+        ClientListLoader::parse(text.data(), text.size(), entries);
+    assertEqual(3, parsed.entries);
+    assertEqual(5, parsed.invalid);
+    assertEqual(0x0A000002, entries[1].first);
+    assertEqual(0x0A000003, entries[1].last);
+    assertEqual(1, entries[1].value);
+    assertEqual(ClientListLoader::noValue, entries[0].value);
+    assertEqual(0xC0A8FFFF, entries[2].last);
+
+    const std::string path = (std::filesystem::temp_directory_path()
+        / "RequestRateTrackerTest.list").string();
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << text;
+    }
+    ClientAllowlist blocked;
+    assert(ClientListLoader::load(path, blocked).opened);
+    // 10.0.0.1 and 10.0.0.2/31 are merged
+    assertEqual(2, blocked.size());
+    std::vector<ClientAllowlist> tiers(3);
+    ClientListLoader::Result loaded = ClientListLoader::load(path, tiers);
+    assertEqual(2, loaded.entries);
+    assertEqual(6, loaded.invalid);
+    assert(tiers[1].contains(0x0A000003));
+    assert(tiers[2].contains(0xC0A80101));
+    assert(tiers[0].empty());
+    std::filesystem::remove(path);
+    assert(!ClientListLoader::load(path, blocked).opened);
+
+    requestRateTracker->setBlockedClients(std::move(blocked));
+    assertEqual(rateLimit.period, requestRateTracker->addRequest(0x0A000002));
+    assertEqual(0, requestRateTracker->size());
+
+    ClientAllowlist tracked;
+    tracked.addRanges({ { 0x0B000000, 0x0B0000FF } });
+    requestRateTracker->setTrackedClients(std::move(tracked));
+    for (int i = 0; i < 3; i++)
+        assertEqual(0, requestRateTracker->addRequest(0x0C000001));
+    assertEqual(0, requestRateTracker->addRequest(0x0B000001));
+    assertEqual(0, requestRateTracker->addRequest(0x0B000001));
+    assertEqual(10, requestRateTracker->addRequest(0x0B000001));
+
+    requestRateTracker->setBlockedClients(ClientAllowlist());
+    requestRateTracker->setTrackedClients(ClientAllowlist());
+    assertEqual(0, requestRateTracker->addRequest(0x0A000002));
+}
+
+void RequestRateTrackerTest::testClusterForwardsToOwner()
+    /// Requests made to any node must be counted once by the client's owner,
+    /// denials must be answered from the cache until shortly before they
+    /// end, and requests must be decided locally if the owner is down.
+{
+    struct LoopbackChannel : ClusterRateLimiter::Channel
+        /// Passes decisions through the wire format to limiters in the
+        /// same process.
+    {
+        RequestRate::Seconds forward(size_t node, RequestRateTracker::HTTPClientID client,
+            RequestRateTracker::Priority priority) override
+        {
+            forwards++;
+            if (node >= nodes.size() || nodes[node] == nullptr)
+                return -1;
+            uint8_t frame[ClusterRateLimiter::requestSize];
+            ClusterRateLimiter::encodeRequest({ forwards, client, priority }, frame);
+            ClusterRateLimiter::DecisionRequest request = ClusterRateLimiter::decodeRequest(frame);
+            uint8_t reply[ClusterRateLimiter::responseSize];
+            ClusterRateLimiter::encodeResponse({ request.sequence,
+                (uint32_t)nodes[node]->decideOwned(request.client, request.priority) }, reply);
+            return ClusterRateLimiter::decodeResponse(reply).waitTime;
+        }
+
+        std::vector<ClusterRateLimiter*> nodes;
+        uint32_t forwards = 0;
+    };
+
+    HashRing ring(42);
+    ring.addNode("127.0.0.1:9990");
+    ring.addNode("127.0.0.1:9991");
+    HashRing reversed(42);
+    reversed.addNode("127.0.0.1:9991");
+    reversed.addNode("127.0.0.1:9990");
+    size_t owned = 0;
+    RequestRateTracker::HTTPClientID remote = 0;
+    for (RequestRateTracker::HTTPClientID client = 1; client <= 1000; client++) {
+        // Owners depend on the names only, not on the order of nodes
+        assertEqual(ring.nameOf(ring.ownerOf(client)),
+            reversed.nameOf(reversed.ownerOf(client)));
+        if (ring.ownerOf(client) == 0)
+            owned++;
+        else
+            remote = client;
+    }
+    assert(owned > 350 && owned < 650);
+
+    RequestRateTracker tracker0(RequestRate{ 2, 10 }, ManualClock::now);
+    RequestRateTracker tracker1(RequestRate{ 2, 10 }, ManualClock::now);
+    LoopbackChannel channel;
+    ClusterRateLimiter node0(tracker0, ring, 0, channel, ManualClock::now);
+    ClusterRateLimiter node1(tracker1, ring, 1, channel, ManualClock::now);
+    channel.nodes = { &node0, &node1 };
+
+    assert(!node0.owns(remote) && node1.owns(remote));
+    assertEqual(0, node0.addRequest(remote));
+    assertEqual(0, node1.addRequest(remote));
+    assertEqual(10, node0.addRequest(remote));
+    assertEqual(2, channel.forwards);
+    assertEqual(0, tracker0.size());
+    // Denied from the cache, one second shorter than the owner's denial
+    ManualClock::advance(std::chrono::seconds(3));
+    assertEqual(7, node0.addRequest(remote));
+    assertEqual(2, channel.forwards);
+    assertEqual(1, node0.cachedDenials());
+    ManualClock::advance(std::chrono::seconds(6));
+    assertEqual(1, node0.addRequest(remote));
+    assertEqual(3, channel.forwards);
+    ManualClock::advance(std::chrono::seconds(1));
+    assertEqual(0, node0.addRequest(remote));
+
+    channel.nodes[1] = nullptr;
+    assertEqual(0, node0.addRequest(remote));
+    assertEqual(1, node0.unreachableRequests());
+    assertEqual(1, tracker0.size());
+}
+
+void RequestRateTrackerTest::testStoreClaimsBatchesOverResp()
+    /// Processes sharing a store must never admit more requests of a client
+    /// than the limit, while most requests are decided without the store.
+{
+    // Replies are parsed from pieces of any size
+    Resp::Parser parser;
+    std::string bytes = "*2\r\n:42\r\n$5\r\nhello\r\n-NOSCRIPT gone\r\n";
+    Resp::Reply reply;
+    for (char byte : bytes) {
+        assert(!parser.next(reply) || reply.type == Resp::Reply::Type::Array);
+        parser.feed(&byte, 1);
+    }
+    assert(parser.next(reply) && reply.isError() && reply.text == "NOSCRIPT gone");
+    assert(!parser.next(reply) && !parser.failed());
+    parser.feed("?\r\n", 3);
+    assert(!parser.next(reply) && parser.failed());
+
+    MockRespServer server(ManualClock::now);
+    auto connectionA = server.connect();
+    auto connectionB = server.connect();
+    const std::chrono::milliseconds retryDelay(50);
+    RespClient clientA(*connectionA, retryDelay);
+    RespClient clientB(*connectionB);
+    RespRateLimitStore storeA(clientA);
+    RespRateLimitStore storeB(clientB);
+    RequestRateTracker trackerA(RequestRate{ 100, 60 }, ManualClock::now);
+    RequestRateTracker trackerB(RequestRate{ 100, 60 }, ManualClock::now);
+    const std::chrono::milliseconds timeout(1000);
+    StoreRateLimiter limiterA(trackerA, storeA, 10, timeout, ManualClock::now);
+    StoreRateLimiter limiterB(trackerB, storeB, 10, timeout, ManualClock::now);
+
+    const RequestRateTracker::HTTPClientID client = 7;
+    int allowed = 0;
+    for (int i = 0; i < 120; i++) {
+        if (((i % 2 == 0) ? limiterA : limiterB).addRequest(client) == 0)
+            allowed++;
+    }
+    assert(allowed <= 100 && allowed >= 100 - 2 * 10);
+    assertEqual(120, limiterA.localDecisions() + limiterB.localDecisions()
+        + limiterA.storeRequests() + limiterB.storeRequests());
+    assert(limiterA.storeRequests() + limiterB.storeRequests() < 40);
+    assert(server.commands("EVALSHA") > 0);
+    Resp::Reply stored = clientA.call({ "GET", "rrt:7" });
+    assert(std::atoll(stored.text.c_str()) >= 100);
+    // Denied until the window of the store ends
+    uint64_t claims = limiterB.storeRequests();
+    assertEqual(60, limiterB.addRequest(client));
+    assertEqual(claims, limiterB.storeRequests());
+    ManualClock::advance(std::chrono::seconds(60));
+    assertEqual(0, limiterB.addRequest(client));
+
+    // A restarted store has lost the script, which is sent again
+    clientA.call({ "SCRIPT", "FLUSH" });
+    uint64_t evaluated = server.commands("EVAL");
+    assertEqual(0, limiterA.addRequest(8));
+    assertEqual(1, storeA.scriptReloads());
+    assertEqual(evaluated + 1, server.commands("EVAL"));
+
+    // Requests are decided locally while the store cannot be reached
+    server.setAvailable(false);
+    assertEqual(0, limiterA.addRequest(9));
+    assertEqual(1, limiterA.storeFailures());
+    assertEqual(1, trackerA.size());
+    // It is not connected to again until the retry delay has passed
+    server.setAvailable(true);
+    assertEqual(0, limiterA.addRequest(10));
+    assertEqual(2, limiterA.storeFailures());
+    std::this_thread::sleep_for(retryDelay + std::chrono::milliseconds(10));
+    assertEqual(0, limiterA.addRequest(11));
+    assertEqual(2, limiterA.storeFailures());
+}
+
+void RequestRateTrackerTest::testSlowStoreTripsBreakerAndReconciles()
+    /// Once a slow store has missed a few deadlines, requests must be
+    /// decided locally without waiting for it, and requests admitted
+    /// meanwhile must be added to the store when it recovers.
+{
+    MockRespServer server(ManualClock::now);
+    auto connection = server.connect();
+    RespClient client(*connection);
+    RespRateLimitStore store(client);
+    RequestRateTracker tracker(RequestRate{ 10, 60 }, ManualClock::now);
+    CircuitBreaker::Settings settings;
+    settings.failureThreshold = 3;
+    settings.openTime = std::chrono::milliseconds(5000);
+    const std::chrono::milliseconds deadline(20);
+    StoreRateLimiter limiter(tracker, store, 1, deadline, ManualClock::now, settings);
+
+    server.setLatency(std::chrono::milliseconds(200));
+    auto start = std::chrono::steady_clock::now();
+    for (RequestRateTracker::HTTPClientID id = 1; id <= 3; id++)
+        assertEqual(0, limiter.addRequest(id));
+    assert(std::chrono::steady_clock::now() - start >= 3 * deadline);
+    assertEqual(3, limiter.storeFailures());
+    assert(limiter.circuitBreaker().state() == CircuitBreaker::State::Open);
+
+    // The breaker is open: no request waits for the store
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 12; i++)
+        limiter.addRequest(1);
+    assert(std::chrono::steady_clock::now() - start < deadline);
+    assertEqual(3, limiter.storeFailures());
+    assertEqual(15, limiter.fallbackDecisions());
+
+    // A failed probe keeps the breaker open
+    ManualClock::advance(std::chrono::seconds(5));
+    assertEqual(0, limiter.addRequest(4));
+    assertEqual(4, limiter.storeFailures());
+    assert(limiter.circuitBreaker().state() == CircuitBreaker::State::Open);
+
+    // The probe after recovery closes it and the store learns of the
+    // requests admitted locally. Late replies of the slow store are still
+    // ahead of the probe on the connection until they are read.
+    server.setLatency(std::chrono::milliseconds(0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    ManualClock::advance(std::chrono::seconds(10));
+    assertEqual(0, limiter.addRequest(5));
+    assert(limiter.circuitBreaker().state() == CircuitBreaker::State::Closed);
+    assertEqual(1, limiter.circuitBreaker().trips());
+    assertEqual(13, limiter.reconciledRequests());
+    // Claims which missed their deadline were counted by the store as well
+    assertEqual(std::string("11"), client.call({ "GET", "rrt:1" }).text);
+    assertEqual(std::string("2"), client.call({ "GET", "rrt:2" }).text);
+    // Client 1 is denied from the store's count without the tracker
+    uint64_t fallbacks = limiter.fallbackDecisions();
+    assert(limiter.addRequest(1) > 0);
+    assertEqual(fallbacks, limiter.fallbackDecisions());
+}
+
+void RequestRateTrackerTest::testNodesLeaseQuotaFromCoordinator()
+    /// Nodes leasing a client's quota must never admit more requests than
+    /// the limit, ask the coordinator once per lease, and return unused
+    /// leases so that other nodes can use them.
+{
+    struct LoopbackCoordinator : LeaseRateLimiter::Coordinator
+        /// Passes leases through the wire format to a coordinator in the
+        /// same process.
+    {
+        explicit LoopbackCoordinator(QuotaCoordinator& coordinator)
+            : coordinator(coordinator)
+        {
+        }
+
+        bool lease(const QuotaCoordinator::LeaseRequest& request,
+            QuotaCoordinator::LeaseGrant& grant) override
+        {
+            if (!available)
+                return false;
+            uint8_t frame[QuotaCoordinator::requestSize];
+            QuotaCoordinator::encodeRequest(request, frame);
+            uint8_t reply[QuotaCoordinator::grantSize];
+            QuotaCoordinator::encodeGrant(
+                coordinator.lease(QuotaCoordinator::decodeRequest(frame)), reply);
+            grant = QuotaCoordinator::decodeGrant(reply);
+            return true;
+        }
+
+        QuotaCoordinator& coordinator;
+        bool available = true;
+    };
+
+    QuotaCoordinator coordinator(RequestRate{ 100, 60 }, ManualClock::now);
+    LoopbackCoordinator channel(coordinator);
+    RequestRateTracker trackerA(RequestRate{ 100, 60 }, ManualClock::now);
+    RequestRateTracker trackerB(RequestRate{ 100, 60 }, ManualClock::now);
+    const std::chrono::seconds leaseTime(5);
+    LeaseRateLimiter nodeA(trackerA, channel, 16, leaseTime, ManualClock::now);
+    LeaseRateLimiter nodeB(trackerB, channel, 16, leaseTime, ManualClock::now);
+
+    const RequestRateTracker::HTTPClientID client = 7;
+    int allowed = 0;
+    for (int i = 0; i < 140; i++) {
+        if (((i % 2 == 0) ? nodeA : nodeB).addRequest(client) == 0)
+            allowed++;
+    }
+    assertEqual(100, allowed);
+    assertEqual(100, coordinator.leasedRequests());
+    assert(nodeA.leaseRequests() + nodeB.leaseRequests() < 40);
+    assertEqual(140, nodeA.localDecisions() + nodeB.localDecisions()
+        + nodeA.leaseRequests() + nodeB.leaseRequests());
+    // Denied until the window of the coordinator ends
+    uint64_t leases = nodeB.leaseRequests();
+    assertEqual(60, nodeB.addRequest(client));
+    assertEqual(leases, nodeB.leaseRequests());
+
+    // The unused part of an idle node's lease is leased by the other one
+    ManualClock::advance(std::chrono::seconds(60));
+    assertEqual(0, nodeA.addRequest(client));
+    ManualClock::advance(leaseTime);
+    nodeA.returnUnused();
+    assertEqual(15, nodeA.returnedRequests());
+    assertEqual(15, coordinator.returnedRequests());
+    allowed = 0;
+    for (int i = 0; i < 110; i++) {
+        if (nodeB.addRequest(client) == 0)
+            allowed++;
+    }
+    assertEqual(99, allowed);
+
+    // Requests returned after the window rolled over are not leased again
+    ManualClock::advance(std::chrono::seconds(55));
+    assertEqual(0, nodeA.addRequest(client));
+    ManualClock::advance(std::chrono::seconds(60));
+    assertEqual(0, nodeA.addRequest(client));
+    assertEqual(30, nodeA.returnedRequests());
+    assertEqual(15, coordinator.returnedRequests());
+
+    // Requests are decided locally while the coordinator cannot be reached
+    channel.available = false;
+    assertEqual(0, nodeB.addRequest(8));
+    assertEqual(1, nodeB.coordinatorFailures());
+    assertEqual(1, nodeB.fallbackDecisions());
+
+    // Exempt and blocked clients are decided by the tracker without
+    // a lease, and leased requests are counted in its priority classes
+    channel.available = true;
+    ClientAllowlist exempt;
+    exempt.addList("10.0.0.1");
+    trackerA.setExemptClients(exempt);
+    ClientAllowlist blocked;
+    blocked.addList("10.0.0.2");
+    trackerA.setBlockedClients(std::move(blocked));
+    leases = nodeA.leaseRequests();
+    assertEqual(0, nodeA.addRequest(0x0A000001));
+    assertEqual(60, nodeA.addRequest(0x0A000002));
+    assertEqual(leases, nodeA.leaseRequests());
+    assert(trackerA.setPriorityCapacity({ 1, 1, 0 }, 60));
+    assertEqual(60, nodeA.addRequest(9, RequestRateTracker::Priority::Bulk));
+    assertEqual(0, nodeA.addRequest(9, RequestRateTracker::Priority::Critical));
+    assertEqual(leases + 1, nodeA.leaseRequests());
+}
+
+void RequestRateTrackerTest::testDrainedStateIsHandedOver()
+    /// Clients of a drained server must keep what is left of their budgets
+    /// on the server which takes over its state.
+{
+    RequestRateTracker drained(RequestRate{ 10, 60 }, ManualClock::now);
+    RequestRateTracker successor(RequestRate{ 10, 60 }, ManualClock::now);
+    successor.setFixedCapacity(1000, false);
+    for (int i = 0; i < 10; i++)
+        assertEqual(0, drained.addRequest(1));
+    for (int i = 0; i < 3; i++)
+        assertEqual(0, drained.addRequest(2));
+    for (int i = 0; i < 4; i++)
+        assertEqual(0, successor.addRequest(2));
+    for (RequestRateTracker::HTTPClientID id = 1000; id < 1100; id++)
+        assertEqual(0, drained.addRequest(id));
+    ManualClock::advance(std::chrono::seconds(20));
+
+    std::vector<uint8_t> stream;
+    assert(StateHandoff::exportTo(drained, [&](const uint8_t* data, size_t size) {
+        stream.insert(stream.end(), data, data + size);
+        return true;
+    }));
+    // Compact: a few bytes per client
+    assert(stream.size() < 102 * 8);
+
+    // Fed in pieces of any size
+    StateHandoff::Reader reader(successor);
+    for (size_t i = 0; i < stream.size(); i += 3) {
+        assert(!reader.finished());
+        assert(reader.feed(stream.data() + i, std::min<size_t>(3, stream.size() - i)));
+    }
+    assert(reader.finished());
+    assertEqual(102, reader.decoded());
+    assertEqual(102, reader.imported());
+    assertEqual(102, successor.size());
+
+    // Denied until the window of the drained server ends
+    assertEqual(40, successor.addRequest(1));
+    // Requests counted on both servers are added up
+    for (int i = 0; i < 3; i++)
+        assertEqual(0, successor.addRequest(2));
+    assertEqual(40, successor.addRequest(2));
+    ManualClock::advance(std::chrono::seconds(40));
+    assertEqual(0, successor.addRequest(1));
+
+    // Streams of another period or cut short are not finished
+    RequestRateTracker other(RequestRate{ 10, 30 }, ManualClock::now);
+    StateHandoff::Reader mismatched(other);
+    assert(!mismatched.feed(stream.data(), stream.size()) && mismatched.failed());
+    StateHandoff::Reader truncated(successor);
+    assert(truncated.feed(stream.data(), stream.size() - 1) && !truncated.finished());
+    assert(!truncated.feed(stream.data(), 2) && truncated.failed());
+}
+
+void RequestRateTrackerTest::testShardsAreAllocatedWithTheirAlignment()
+    /// Shards are aligned to cache lines, so the topology must be asked for
+    /// memory with that alignment and must return it.
+{
+    struct RecordingTopology : SimulatedNumaTopology
+    {
+        RecordingTopology() : SimulatedNumaTopology(2) {}
+
+        void* allocate(size_t size, size_t alignment, unsigned node) const override
+        {
+            void* ptr = SimulatedNumaTopology::allocate(size, alignment, node);
+            if (alignment >= 64 && (uintptr_t)ptr % alignment == 0)
+                alignedAllocations++;
+            return ptr;
+        }
+
+        mutable int alignedAllocations = 0;
+    };
+
+    RecordingTopology topology;
+    {
+        RequestRateTracker tracker(rateLimit, topology, 4, ManualClock::now);
+        assertEqual(0, tracker.addRequest(1));
+    }
+    assertEqual(8, topology.alignedAllocations);
+}
+
+void RequestRateTrackerTest::testSubnetPeriodIndexWrapsAround()
+    /// At the largest subnet limit a 12-bit counter leaves 20 bits for the
+    /// period index. A subnet must get a fresh count after 4096 idle periods
+    /// and only finds its old count after 2^20 of them.
+{
+    SubnetBudgets budgets(SubnetBudgets::maxLimit, 1);
+    const SubnetBudgets::Address client = 0x0A000001;
+    for (int64_t i = 0; i < SubnetBudgets::maxLimit; i++)
+        assert(budgets.tryAcquire(client, 0));
+    assert(!budgets.tryAcquire(client, 0));
+
+    assertEqual(0, budgets.count(client, 1 << 12));
+    assertEqual(SubnetBudgets::maxLimit, budgets.count(client, 1 << 20));
+    assert(budgets.tryAcquire(client, 1 << 12));
+    assertEqual(1, budgets.count(client, 1 << 12));
+    assertEqual(0, budgets.count(client, (1 << 12) + (1 << 20) - 1));
+}
+
+void RequestRateTrackerTest::testPriorityCountsOfIdlePeriodsAreReset()
+    /// Counts of a period must not come back after any number of idle
+    /// periods short of the 2^16 the period index can tell apart.
+{
+    using Priority = PriorityCapacity::Priority;
+    PriorityCapacity capacity({ 1, 1, 1 }, 1);
+    assert(capacity.tryAcquire(Priority::Bulk, 0));
+    assert(capacity.tryAcquire(Priority::Normal, 0));
+    assert(capacity.tryAcquire(Priority::Critical, 0));
+    assert(!capacity.tryAcquire(Priority::Critical, 0));
+
+    for (PriorityCapacity::Seconds idle : { 16, 17, 1 << 12, (1 << 16) - 1 })
+        assertEqual(0, capacity.used(Priority::Critical, idle));
+    assert(capacity.tryAcquire(Priority::Critical, 16));
+    assert(capacity.tryAcquire(Priority::Critical, 17));
+    assertEqual(1, capacity.used(Priority::Critical, 17));
+}
+
+void RequestRateTrackerTest::testStoreDefersToTrackerChecks()
+    /// Requests of exempt and blocked clients must be decided by the
+    /// tracker without the store, and requests which the store allows
+    /// must still be counted in the tracker's shared limits and priority
+    /// classes.
+{
+    using Priority = RequestRateTracker::Priority;
+    MockRespServer server(ManualClock::now);
+    auto connection = server.connect();
+    RespClient client(*connection);
+    RespRateLimitStore store(client);
+    RequestRateTracker tracker(RequestRate{ 2, 60 }, ManualClock::now);
+    StoreRateLimiter limiter(tracker, store, 10, std::chrono::milliseconds(1000),
+        ManualClock::now);
+
+    ClientAllowlist exempt;
+    exempt.addList("10.0.0.1");
+    tracker.setExemptClients(exempt);
+    ClientAllowlist blocked;
+    blocked.addList("10.0.0.2");
+    tracker.setBlockedClients(std::move(blocked));
+    for (int i = 0; i < 5; i++)
+        assertEqual(0, limiter.addRequest(0x0A000001));
+    assertEqual(60, limiter.addRequest(0x0A000002));
+    assertEqual(0, limiter.storeRequests());
+    assertEqual(0, limiter.localDecisions());
+
+    // Bulk requests have no reservation, and the global limit is reached
+    // before the store's limits of two clients
+    assert(tracker.setPriorityCapacity({ 2, 2, 0 }, 60));
+    tracker.setGlobalLimit(RequestRate{ 3, 60 });
+    assertEqual(60, limiter.addRequest(7, Priority::Bulk));
+    // The request claimed for the bulk one is left for the next request
+    assertEqual(0, limiter.addRequest(7, Priority::Critical));
+    assertEqual(1, limiter.storeRequests());
+    assertEqual(0, limiter.addRequest(7));
+    assertEqual(60, limiter.addRequest(7));
+    assertEqual(0, limiter.addRequest(8));
+    assertEqual(60, limiter.addRequest(8));
+    assertEqual(0, tracker.size());
+}
+
+void RequestRateTrackerTest::testReloadedSettingsKeepTheirLayers()
+    /// Settings reread by a running server must come from the file which
+    /// set them at startup, not only from the file given on the command
+    /// line, e.g. exempt clients of the default file of a cluster node.
+{
+    std::map<std::string, std::string> parsed;
+    PropertyLayers::parse(
+        "# node 0\n"
+        "! comment\r\n"
+        "  HTTPBasicServer.port = 9981\r\n"
+        "HTTPBasicServer.clusterNodes: a:1, \\\n"
+        "b:2\n"
+        "HTTPBasicServer.empty\n"
+        "tab=\\tx\n"
+        "HTTPBasicServer.port=9982", parsed);
+    assertEqual(4, parsed.size());
+    assertEqual(std::string("9982"), parsed["HTTPBasicServer.port"]);
+    assertEqual(std::string("a:1, b:2"), parsed["HTTPBasicServer.clusterNodes"]);
+    assertEqual(std::string(""), parsed["HTTPBasicServer.empty"]);
+    assertEqual(std::string("x"), parsed["tab"]);
+
+    const auto directory = std::filesystem::temp_directory_path();
+    const std::string nodePath = (directory / "RequestRateTrackerTest.node0.properties").string();
+    const std::string defaultPath = (directory / "RequestRateTrackerTest.properties").string();
+    {
+        std::ofstream node(nodePath, std::ios::binary);
+        node << "HTTPBasicServer.port=9981\n";
+        std::ofstream defaults(defaultPath, std::ios::binary);
+        defaults << "HTTPBasicServer.port=9980\n"
+            "HTTPBasicServer.exemptClients=10.0.0.0/8\n";
+    }
+    PropertyLayers config({ nodePath, defaultPath });
+    assert(config.load());
+    assertEqual(std::string("9981"), config.getString("HTTPBasicServer.port", ""));
+    assertEqual(std::string("10.0.0.0/8"), config.getString("HTTPBasicServer.exemptClients", ""));
+    assertEqual(std::string("1"), config.getString("HTTPBasicServer.exemptReloadInterval", "1"));
+
+    // A key set in the file of the node takes precedence once it is added
+    {
+        std::ofstream node(nodePath, std::ios::binary | std::ios::app);
+        node << "HTTPBasicServer.exemptClients=127.0.0.1\n";
+    }
+    assert(config.load());
+    assertEqual(std::string("127.0.0.1"), config.getString("HTTPBasicServer.exemptClients", ""));
+
+    // A file which cannot be read leaves nothing to reload from
+    std::filesystem::remove(defaultPath);
+    assert(!config.load());
+    assertEqual(defaultPath, config.unreadablePath());
+    assertEqual(std::string(""), config.getString("HTTPBasicServer.exemptClients", ""));
+    std::filesystem::remove(nodePath);
+}
+
+void RequestRateTrackerTest::testUnreachableStoreDelaysOneRequest()
+    /// While a store cannot be connected to, only the request which tries
+    /// to connect may wait for it; concurrent requests must be decided
+    /// locally at once instead of taking turns to connect.
+{
+    MockRespServer server(ManualClock::now);
+    auto connection = server.connect();
+    const std::chrono::milliseconds connectTimeout(100);
+    server.setAvailable(false);
+    server.setConnectLatency(connectTimeout);
+    // Every request may attempt to connect, without a retry delay
+    RespClient client(*connection, std::chrono::milliseconds(0));
+    RespRateLimitStore store(client);
+    RequestRateTracker tracker(RequestRate{ 10, 60 }, ManualClock::now);
+    CircuitBreaker::Settings settings;
+    settings.failureThreshold = 100;
+    StoreRateLimiter limiter(tracker, store, 1, std::chrono::milliseconds(20),
+        ManualClock::now, settings);
+
+    const int threadCount = 4;
+    std::vector<std::chrono::steady_clock::duration> latencies(threadCount);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back([&, i] {
+            auto start = std::chrono::steady_clock::now();
+            limiter.addRequest((RequestRateTracker::HTTPClientID)i + 1);
+            latencies[i] = std::chrono::steady_clock::now() - start;
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    assertEqual(threadCount, limiter.fallbackDecisions());
+    auto waited = std::count_if(latencies.begin(), latencies.end(),
+        [&](auto latency) { return latency >= connectTimeout; });
+    assert(waited <= 1);
+}
+
+void RequestRateTrackerTest::testScriptIsLoadedOnceStoreIsReachable()
+    /// A store constructed while the server is unreachable must load its
+    /// script once the server can be reached, rather than sending the
+    /// whole script with every increment.
+{
+    MockRespServer server(ManualClock::now);
+    auto connection = server.connect();
+    server.setAvailable(false);
+    RespClient client(*connection, std::chrono::milliseconds(0));
+    RespRateLimitStore store(client);
+    assertEqual(0, server.commands("SCRIPT"));
+    server.setAvailable(true);
+
+    auto increment = [&](RequestRateTracker::HTTPClientID id) {
+        std::promise<bool> counted;
+        store.increment(id, 1, 60, [&](bool ok, const RateLimitStore::Window&) {
+            counted.set_value(ok);
+        });
+        return counted.get_future().get();
+    };
+    assert(increment(1));
+    assertEqual(1, server.commands("EVAL"));
+    // Replies arrive in order, so SCRIPT LOAD sent after EVAL has been
+    // answered once this one is
+    client.call({ "GET", "rrt:1" });
+    assertEqual(1, server.commands("SCRIPT"));
+    assert(increment(2));
+    assert(increment(3));
+    assertEqual(1, server.commands("EVAL"));
+    assertEqual(2, server.commands("EVALSHA"));
+    assertEqual(1, server.commands("SCRIPT"));
+}
+
+void RequestRateTrackerTest::testFixedCapacityReleasesArenas()
+    /// Once fixed-capacity tables replace the growable ones, the memory of
+    /// the growable tables must be given back to the topology rather than
+    /// kept in their arenas.
+{
+    struct CountingTopology : SimulatedNumaTopology
+    {
+        CountingTopology() : SimulatedNumaTopology(2) {}
+
+        void* allocate(size_t size, size_t alignment, unsigned node) const override
+        {
+            allocated += size;
+            return SimulatedNumaTopology::allocate(size, alignment, node);
+        }
+
+        void deallocate(void* ptr, size_t size, size_t alignment, unsigned node) const override
+        {
+            allocated -= size;
+            SimulatedNumaTopology::deallocate(ptr, size, alignment, node);
+        }
+
+        mutable size_t allocated = 0;
+    };
+
+    CountingTopology topology;
+    RequestRateTracker tracker(rateLimit, topology, 4, ManualClock::now);
+    const size_t shardsOnly = topology.allocated;
+    for (RequestRateTracker::HTTPClientID id = 1; id <= 10000; id++)
+        tracker.addRequest(id);
+    const size_t grown = topology.allocated;
+    assert(grown - shardsOnly >= 10000 * sizeof(RequestRateTracker::HTTPClientID));
+
+    tracker.setFixedCapacity(10000, false);
+    assertEqual(0, tracker.size());
+    assert(topology.allocated < shardsOnly + (grown - shardsOnly) / 10);
+    assertEqual(0, tracker.addRequest(1));
+    assertEqual(1, tracker.size());
+}
+
 // TODO: Implement 3 more cases for sliding window checks:
 // - Same as testRequestDeniedWhenManyRequestsAreAtBoundary but only 1 request in
 //   the previous fixed window. The 1st add must be ok, 2nd add must be denied.
@@ -11,5 +11,13 @@
 
 #include <iostream>
 #include <cstdint>
+#include <algorithm>
+#include <vector>
+#include <coroutine>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
 
 #endif //PCH_H